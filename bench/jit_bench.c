@@ -0,0 +1,128 @@
+// evaluation throughput of f and f' at many points:
+// evaluate_ast (tree walk) vs run_program (bytecode) vs jit_compile (native code)
+// the jit in strict fp (chains as parsed) and with balanced chains (balance.h)
+// usage: jit_bench [points] [repeats]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "parse.h"
+#include "derivative.h"
+#include "eval.h"
+#include "bytecode.h"
+#include "jit.h"
+#include "balance.h"
+
+
+static const char* samples[] = {
+    "x^2*sin(x) + 3x",
+    "1.5x^4 - 2.25x^3 + 0.5x^2 - 7x + 11",
+    "exp(x)*ln(x)/log(x) - 4.25x^3 + 2",
+    "(x+1)/(x-1) * (2x+3)/(x^2+1)",
+    "x + 2x + 3x + 4x + 5x + 6x + 7x + 8x + 9x + 10x + 11x + 12x + 13x + 14x + 15x + 16x",
+    "sin(x) * 2x * 3x * 4x * 5x * 6x * 7x * 8x * 9x * 10x * 11x * 12x + 1",
+};
+#define SAMPLE_COUNT (sizeof(samples) / sizeof(samples[0]))
+
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double sink;
+
+static double time_tree(AstNode* tree, const double* xs, int points, int repeats) {
+    double sum = 0, begin = now();
+    for (int r = 0; r < repeats; r++) {
+        for (int i = 0; i < points; i++) sum += evaluate_ast(tree, xs[i]);
+    }
+    sink += sum;
+    return now() - begin;
+}
+
+static double time_bytecode(Program* program, const double* xs, int points, int repeats) {
+    double sum = 0, begin = now();
+    for (int r = 0; r < repeats; r++) {
+        for (int i = 0; i < points; i++) sum += run_program(program, xs[i]);
+    }
+    sink += sum;
+    return now() - begin;
+}
+
+static double time_jit(JitFunction* jit, const double* xs, int points, int repeats) {
+    double sum = 0, begin = now();
+    for (int r = 0; r < repeats; r++) {
+        for (int i = 0; i < points; i++) sum += jit->fn(xs[i]);
+    }
+    sink += sum;
+    return now() - begin;
+}
+
+int main(int argc, char** argv) {
+    int points = argc > 1 ? atoi(argv[1]) : 10000;
+    int repeats = argc > 2 ? atoi(argv[2]) : 100;
+
+    double* xs = (double*) malloc(points * sizeof(double));
+    for (int i = 0; i < points; i++) xs[i] = 0.5 + 3.0 * i / points;
+
+    printf("%d points x %d repeats, ns per evaluation\n", points, repeats);
+    printf("  %-44s %8s %8s %8s %8s %8s\n", "expression", "tree", "bytecode", "jit", "balanced", "compile");
+
+    double scale = 1e9 / ((double) points * repeats);
+    for (int s = 0; s < (int) SAMPLE_COUNT; s++) {
+        char* input = strdup(samples[s]);
+        AstNode* f = parse(input);
+        AstNode* df = derivative_expression(f);
+        AstNode* trees[] = { f, df };
+
+        for (int k = 0; k < 2; k++) {
+            set_strict_fp(true);
+            double compile_begin = now();
+            JitFunction* jit = jit_compile(trees[k]);
+            double compile_time = now() - compile_begin;
+
+            set_strict_fp(false);
+            JitFunction* balanced = jit_compile(trees[k]);
+
+            if (jit == NULL || balanced == NULL) {
+                fprintf(stderr, "jit not available on this platform\n");
+                return 1;
+            }
+
+            Program* program = compile_ast(trees[k]);
+
+            // strict fp, same libm calls in the same order: results must match bit for bit
+            for (int i = 0; i < points; i++) {
+                double a = evaluate_ast(trees[k], xs[i]), b = jit->fn(xs[i]);
+                if (memcmp(&a, &b, sizeof(double)) != 0 && !(a != a && b != b)) {
+                    fprintf(stderr, "mismatch at x = %g: %.17g vs %.17g\n", xs[i], a, b);
+                    return 1;
+                }
+            }
+
+            double t_tree = time_tree(trees[k], xs, points, repeats);
+            double t_bytecode = time_bytecode(program, xs, points, repeats);
+            double t_jit = time_jit(jit, xs, points, repeats);
+            double t_balanced = time_jit(balanced, xs, points, repeats);
+
+            char label[64];
+            snprintf(label, sizeof(label), "%s%.40s", k ? "d/dx " : "", samples[s]);
+            printf("  %-44s %8.2f %8.2f %8.2f %8.2f %6.1fus\n", label,
+                   t_tree * scale, t_bytecode * scale, t_jit * scale, t_balanced * scale, compile_time * 1e6);
+
+            destroy_program(program);
+            destroy_jit_function(jit);
+            destroy_jit_function(balanced);
+        }
+
+        destroy_ast_node(f);
+        destroy_ast_node(df);
+        free(input);
+    }
+
+    free(xs);
+    return sink == 0.12345; // keep the sums alive
+}
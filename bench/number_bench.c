@@ -0,0 +1,129 @@
+// number literal conversion: parse_number_literal (fast paths, in place)
+// vs parse_number_literal_strtod (copy + strtod, the previous path of the tokenizer)
+// then the whole parse of a coefficient-heavy polynomial
+// usage: number_bench [literals] [repeats]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include "number.h"
+#include "parse.h"
+#include "arena.h"
+
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t random_state = 0x2545F4914F6CDD1DULL;
+
+static uint64_t next_random() {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+// literals of one kind, back to back in one buffer
+typedef struct {
+    const char* name;
+    int int_digits; // up to
+    int frac_digits; // up to
+} LiteralKind;
+
+static const LiteralKind kinds[] = {
+    { "integers (1-4 digits)", 4, 0 },
+    { "coefficients (3.25, 0.125)", 3, 4 },
+    { "long decimals (17 digits)", 2, 17 },
+    { "very long (30 digits)", 10, 20 },
+};
+#define KIND_COUNT (sizeof(kinds) / sizeof(kinds[0]))
+
+static double sink;
+
+static double time_literals(double (*convert)(const char*, size_t), const char* text,
+                            const size_t* offsets, int count, int repeats) {
+    double sum = 0, begin = now();
+    for (int r = 0; r < repeats; r++) {
+        for (int i = 0; i < count; i++) {
+            sum += convert(text + offsets[i], offsets[i + 1] - offsets[i]);
+        }
+    }
+    sink += sum;
+    return now() - begin;
+}
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? atoi(argv[1]) : 100000;
+    int repeats = argc > 2 ? atoi(argv[2]) : 20;
+
+    char* text = (char*) malloc((size_t) count * 40);
+    size_t* offsets = (size_t*) malloc((count + 1) * sizeof(size_t));
+
+    printf("%d literals x %d repeats, ns per literal\n", count, repeats);
+    printf("  %-30s %8s %8s %8s\n", "literals", "strtod", "fast", "speedup");
+
+    for (int k = 0; k < (int) KIND_COUNT; k++) {
+        size_t len = 0;
+        for (int i = 0; i < count; i++) {
+            offsets[i] = len;
+            int int_digits = 1 + (int) (next_random() % kinds[k].int_digits);
+            for (int d = 0; d < int_digits; d++) text[len++] = '0' + next_random() % 10;
+            if (kinds[k].frac_digits > 0) {
+                text[len++] = '.';
+                int frac_digits = 1 + (int) (next_random() % kinds[k].frac_digits);
+                for (int d = 0; d < frac_digits; d++) text[len++] = '0' + next_random() % 10;
+            }
+        }
+        offsets[count] = len;
+
+        // same bits as strtod
+        for (int i = 0; i < count; i++) {
+            size_t n = offsets[i + 1] - offsets[i];
+            double a = parse_number_literal(text + offsets[i], n);
+            double b = parse_number_literal_strtod(text + offsets[i], n);
+            if (memcmp(&a, &b, sizeof(double)) != 0) {
+                fprintf(stderr, "mismatch for '%.*s': %.17g vs %.17g\n", (int) n, text + offsets[i], a, b);
+                return 1;
+            }
+        }
+
+        double t_strtod = time_literals(parse_number_literal_strtod, text, offsets, count, repeats);
+        double t_fast = time_literals(parse_number_literal, text, offsets, count, repeats);
+
+        double scale = 1e9 / ((double) count * repeats);
+        printf("  %-30s %8.2f %8.2f %7.1fx\n", kinds[k].name, t_strtod * scale, t_fast * scale, t_strtod / t_fast);
+    }
+
+    // a polynomial of machine-generated coefficients, parsed as a whole
+    size_t poly_len = 0, poly_cap = 1 << 20;
+    char* poly = (char*) malloc(poly_cap);
+    for (int i = 0; i < 20000 && poly_len + 64 < poly_cap; i++) {
+        poly_len += snprintf(poly + poly_len, poly_cap - poly_len, "%s%.15g*x^%d",
+                             i ? " + " : "", (double) (next_random() % 1000000000) / 7919.0, i % 9);
+    }
+
+    Arena* arena = create_arena(0);
+    set_ast_arena(arena);
+    int parse_repeats = repeats > 0 ? repeats : 1;
+    double begin = now();
+    for (int r = 0; r < parse_repeats; r++) {
+        if (parse_n(poly, poly_len) == NULL) return 1;
+        reset_arena(arena);
+    }
+    double t_parse = (now() - begin) / parse_repeats;
+    set_ast_arena(NULL);
+    destroy_arena(arena);
+
+    printf("  parse of 20000 coefficients (%zu bytes): %.3f ms, %.1f MB/s\n",
+           poly_len, t_parse * 1e3, poly_len / 1e6 / t_parse);
+
+    free(poly);
+    free(text);
+    free(offsets);
+    return sink == 0.12345; // keep the sums alive
+}
@@ -0,0 +1,94 @@
+// parse throughput: 'parse' (Pratt, single pass) vs 'parse_descent' (tokenize + recursive descent)
+// usage: parse_bench [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "parse.h"
+#include "arena.h"
+
+
+static const char* samples[] = {
+    "x^2*sin(x) + 3x",
+    "2x(x+1)^3/ln(x)",
+    "sin(cos(tan(x)))",
+    "exp(x)*ln(x)/log(x) - 4.25x^3 + 2",
+    "(x+1)^(2x) - 3(x-1)(x+2)",
+    "-x^2 + -3x - -2",
+    "1.5x^4 - 2.25x^3 + 0.5x^2 - 7x + 11",
+    "sin(x)cos(x)exp(x)ln(x)",
+};
+#define SAMPLE_COUNT (sizeof(samples) / sizeof(samples[0]))
+
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// return seconds for parsing every sample 'iterations' times
+static double run(AstNode* (*parser)(char*), char** inputs, int count, int iterations) {
+    Arena* arena = create_arena(0);
+    set_ast_arena(arena); // measure the parser, not malloc
+
+    double begin = now();
+    for (int it = 0; it < iterations; it++) {
+        for (int i = 0; i < count; i++) {
+            if (parser(inputs[i]) == NULL) {
+                fprintf(stderr, "parse failed: %s\n", inputs[i]);
+                exit(1);
+            }
+        }
+        reset_arena(arena);
+    }
+    double elapsed = now() - begin;
+
+    set_ast_arena(NULL);
+    destroy_arena(arena);
+    return elapsed;
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 200000;
+
+    // short expressions + one long generated polynomial
+    int count = SAMPLE_COUNT + 1;
+    char** inputs = (char**) malloc(count * sizeof(char*));
+    size_t bytes = 0;
+
+    for (int i = 0; i < (int) SAMPLE_COUNT; i++) {
+        inputs[i] = strdup(samples[i]);
+        bytes += strlen(inputs[i]);
+    }
+
+    size_t long_len = 0, long_cap = 1 << 16;
+    char* long_expr = (char*) malloc(long_cap);
+    for (int k = 0; k < 2000; k++) {
+        long_len += snprintf(long_expr + long_len, long_cap - long_len, "%s%d.5x^%d", k ? " + " : "", k, k % 7);
+    }
+    inputs[SAMPLE_COUNT] = long_expr;
+    bytes += long_len;
+
+    int long_iterations = iterations / 100 > 0 ? iterations / 100 : 1;
+    double t_descent = run(parse_descent, inputs, count, long_iterations);
+    double t_pratt = run(parse, inputs, count, long_iterations);
+
+    double t_descent_short = run(parse_descent, inputs, SAMPLE_COUNT, iterations);
+    double t_pratt_short = run(parse, inputs, SAMPLE_COUNT, iterations);
+
+    double short_count = (double) SAMPLE_COUNT * iterations;
+    printf("short expressions (%d x %d)\n", (int) SAMPLE_COUNT, iterations);
+    printf("  parse_descent: %8.3f s  %10.0f expr/s\n", t_descent_short, short_count / t_descent_short);
+    printf("  parse (pratt): %8.3f s  %10.0f expr/s  (x%.2f)\n", t_pratt_short, short_count / t_pratt_short, t_descent_short / t_pratt_short);
+
+    double mb = (double) bytes * long_iterations / (1024 * 1024);
+    printf("all inputs incl. %zu byte polynomial (x %d)\n", long_len, long_iterations);
+    printf("  parse_descent: %8.3f s  %10.1f MB/s\n", t_descent, mb / t_descent);
+    printf("  parse (pratt): %8.3f s  %10.1f MB/s  (x%.2f)\n", t_pratt, mb / t_pratt, t_descent / t_pratt);
+
+    for (int i = 0; i < count; i++) free(inputs[i]);
+    free(inputs);
+    return 0;
+}
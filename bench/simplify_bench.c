@@ -0,0 +1,104 @@
+// simplify_ast_node on large derivative trees
+// one call reaches the fixpoint, the time per node should stay flat as the trees grow
+// usage: simplify_bench [iterations]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "parse.h"
+#include "derivative.h"
+#include "calc.h"
+#include "arena.h"
+
+
+static double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static size_t count_nodes(AstNode* node) {
+    if (node == NULL) return 0;
+
+    switch (node->type) {
+    case AST_OP: return 1 + count_nodes(node->op.left) + count_nodes(node->op.right);
+    case AST_FUNC: return 1 + count_nodes(node->func.arg);
+    case AST_UNARY: return 1 + count_nodes(node->unary.operand);
+    default: return 1;
+    }
+}
+
+// sum of k.5 * x^(k%7) * sin(x)^(k%3) for k < terms
+static char* make_input(int terms) {
+    size_t cap = (size_t) terms * 40 + 1, len = 0;
+    char* str = (char*) malloc(cap);
+    str[0] = '\0';
+
+    for (int k = 0; k < terms; k++) {
+        len += snprintf(str + len, cap - len, "%s%d.5x^%d*sin(x)^%d", k ? " + " : "", k, k % 7, k % 3);
+    }
+    return str;
+}
+
+static void run(const char* label, char* input, int iterations) {
+    Arena* arena = create_arena(0);
+    set_ast_arena(arena);
+
+    size_t before = 0, after = 0;
+    double t_first = 0, t_second = 0, t_rederive = 0;
+
+    for (int it = 0; it < iterations; it++) {
+        AstNode* tree = parse(input);
+        AstNode* derv = derivative_expression(tree);
+        before = count_nodes(derv);
+
+        double begin = now();
+        simplify_ast_node(&derv);
+        t_first += now() - begin;
+        after = count_nodes(derv);
+
+        // already at the fixpoint: nothing is visited
+        begin = now();
+        if (simplify_ast_node(&derv)) {
+            fprintf(stderr, "second call changed the tree\n");
+            exit(1);
+        }
+        t_second += now() - begin;
+
+        // derivative of the simplified tree: the cloned parts keep their mark,
+        // only the new nodes are visited
+        AstNode* derv2 = derivative_expression(derv);
+        begin = now();
+        simplify_ast_node(&derv2);
+        t_rederive += now() - begin;
+
+        reset_arena(arena);
+    }
+
+    printf("  %-14s %8zu -> %7zu nodes  first %8.3f ms (%5.1f ns/node)  again %6.3f us  f'' %8.3f ms\n",
+           label, before, after,
+           t_first / iterations * 1e3, t_first / iterations / before * 1e9,
+           t_second / iterations * 1e6, t_rederive / iterations * 1e3);
+
+    set_ast_arena(NULL);
+    destroy_arena(arena);
+}
+
+int main(int argc, char** argv) {
+    int iterations = argc > 1 ? atoi(argv[1]) : 20;
+
+    printf("simplify_ast_node on d/dx of generated sums (%d iterations)\n", iterations);
+    for (int terms = 250; terms <= 16000; terms *= 4) {
+        char label[32];
+        snprintf(label, sizeof(label), "%d terms", terms);
+
+        char* input = make_input(terms);
+        run(label, input, iterations);
+        free(input);
+    }
+
+    char nested[] = "sin(x)*x^2*exp(x)/ln(x) + tan(x)^3*log(x)";
+    run("nested", nested, iterations * 100);
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include "arena.h"
+
+#include <stdlib.h>
+
+
+// every allocation is aligned to this
+#define ARENA_ALIGN 16
+
+static size_t align_up(size_t n) {
+    return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+// the data begins right after the (aligned) header
+static char* block_data(ArenaBlock* block) {
+    return (char*) block + align_up(sizeof(ArenaBlock));
+}
+
+static ArenaBlock* create_arena_block(size_t size) {
+    ArenaBlock* block = (ArenaBlock*) malloc(align_up(sizeof(ArenaBlock)) + size);
+    if (block == NULL) return NULL;
+
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+
+Arena* create_arena(size_t block_size) {
+    Arena* arena = (Arena*) malloc(sizeof(Arena));
+    arena->head = NULL;
+    arena->free_list = NULL;
+    arena->block_size = block_size == 0 ? ARENA_DEFAULT_BLOCK_SIZE : block_size;
+    return arena;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    size = align_up(size);
+
+    ArenaBlock* block = arena->head;
+    if (block == NULL || block->size - block->used < size) {
+        // current block is full, take a new one
+        // reuse the kept block if it is big enough (only the first one is checked)
+        if (arena->free_list != NULL && arena->free_list->size >= size) {
+            block = arena->free_list;
+            arena->free_list = block->next;
+        } else {
+            // bigger allocation than block_size gets its own block
+            block = create_arena_block(size > arena->block_size ? size : arena->block_size);
+            if (block == NULL) return NULL;
+        }
+
+        block->used = 0;
+        block->next = arena->head;
+        arena->head = block;
+    }
+
+    void* ptr = block_data(block) + block->used;
+    block->used += size;
+    return ptr;
+}
+
+void reset_arena(Arena* arena) {
+    ArenaBlock* block = arena->head;
+    ArenaBlock* next;
+
+    while (block != NULL) {
+        next = block->next;
+        block->next = arena->free_list;
+        arena->free_list = block;
+        block = next;
+    }
+
+    arena->head = NULL;
+}
+
+static void destroy_arena_blocks(ArenaBlock* block) {
+    ArenaBlock* next;
+
+    while (block != NULL) {
+        next = block->next;
+        free(block);
+        block = next;
+    }
+}
+
+void destroy_arena(Arena* arena) {
+    if (arena == NULL) return;
+
+    destroy_arena_blocks(arena->head);
+    destroy_arena_blocks(arena->free_list);
+    free(arena);
+}
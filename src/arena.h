@@ -0,0 +1,42 @@
+#ifndef __ARENA_H__
+#define __ARENA_H__
+
+#include <stddef.h>
+
+// default size of a single arena block (bytes)
+#define ARENA_DEFAULT_BLOCK_SIZE (64 * 1024)
+
+/*
+Arena (region) allocator:
+memory is handed out from big blocks by bumping a pointer,
+and all the memory is released at once by 'reset_arena' or 'destroy_arena'.
+there is no way to free a single allocation.
+*/
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size; // usable bytes in data
+    size_t used;
+    // data follows the header
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* head; // block currently allocated from
+    ArenaBlock* free_list; // blocks kept by 'reset_arena' for reuse
+    size_t block_size;
+} Arena;
+
+
+// block_size == 0 means ARENA_DEFAULT_BLOCK_SIZE
+Arena* create_arena(size_t block_size);
+
+// return NULL only if out of memory
+void* arena_alloc(Arena* arena, size_t size);
+
+// release every allocation but keep the blocks for the next use
+void reset_arena(Arena* arena);
+
+// release every allocation and the arena itself
+void destroy_arena(Arena* arena);
+
+#endif
@@ -3,23 +3,55 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include "strbuf.h"
+#include "stack.h"
+
+
+// arena for the nodes of the current thread (NULL = malloc)
+static _Thread_local Arena* ast_arena = NULL;
+
+void set_ast_arena(Arena* arena) {
+    ast_arena = arena;
+}
+
+Arena* get_ast_arena() {
+    return ast_arena;
+}
+
+static AstNode* alloc_ast_node() {
+    AstNode* node;
+
+    if (ast_arena != NULL) {
+        node = (AstNode*) arena_alloc(ast_arena, sizeof(AstNode));
+        node->flags = AST_FLAG_ARENA;
+    } else {
+        node = (AstNode*) malloc(sizeof(AstNode));
+        node->flags = 0;
+    }
+
+    node->refs = 1;
+    return node;
+}
 
 
 AstNode* create_num_node(double num) {
-    AstNode* node = (AstNode*) malloc(sizeof(AstNode));
+    AstNode* node = alloc_ast_node();
     node->type = AST_NUM;
     node->number = num;
     return node;
 }
 
 AstNode* create_var_node() {
-    AstNode* node = (AstNode*) malloc(sizeof(AstNode));
+    AstNode* node = alloc_ast_node();
     node->type = AST_VAR;
     return node;
 }
 
 AstNode* create_op_node(Operator op, AstNode* left, AstNode* right) {
-    AstNode* node = (AstNode*) malloc(sizeof(AstNode));
+    AstNode* node = alloc_ast_node();
     node->type = AST_OP;
     node->op.op = op;
     node->op.left = left;
@@ -28,7 +60,7 @@ AstNode* create_op_node(Operator op, AstNode* left, AstNode* right) {
 }
 
 AstNode* create_func_node(Function func, AstNode* arg) {
-    AstNode* node = (AstNode*) malloc(sizeof(AstNode));
+    AstNode* node = alloc_ast_node();
     node->type = AST_FUNC;
     node->func.func = func;
     node->func.arg = arg;
@@ -36,7 +68,7 @@ AstNode* create_func_node(Function func, AstNode* arg) {
 }
 
 AstNode* create_unary_node(Unary unary, AstNode* operand) {
-    AstNode* node = (AstNode*) malloc(sizeof(AstNode));
+    AstNode* node = alloc_ast_node();
     node->type = AST_UNARY;
     node->unary.unary = unary;
     node->unary.operand = operand;
@@ -44,94 +76,261 @@ AstNode* create_unary_node(Unary unary, AstNode* operand) {
 }
 
 
+AstNode* retain_ast_node(AstNode* node) {
+    if (node != NULL && !(node->flags & AST_FLAG_SHARED) && node->refs < AST_REFS_MAX) node->refs++;
+    return node;
+}
+
+static bool is_node_shared(AstNode* node) {
+    return (node->flags & AST_FLAG_SHARED) || node->refs > 1;
+}
+
+AstNode* unshare_ast_node(AstNode* node) {
+    if (node == NULL || !is_node_shared(node)) return node;
+
+    AstNode* copy = alloc_ast_node();
+    unsigned int flags = copy->flags;
+    *copy = *node;
+    copy->flags = flags | (node->flags & AST_FLAG_SIMPLIFIED);
+    copy->refs = 1;
+
+    destroy_ast_node_only(node); // the copy holds the references to the children
+    return copy;
+}
+
+// children of a node in order, return how many
+static int node_children(AstNode* node, AstNode** children) {
+    switch (node->type) {
+    case AST_OP:
+        children[0] = node->op.left;
+        children[1] = node->op.right;
+        return 2;
+    case AST_FUNC:
+        children[0] = node->func.arg;
+        return 1;
+    case AST_UNARY:
+        children[0] = node->unary.operand;
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// explicit stack size before the traversals below go to the heap
+#define LOCAL_STACK 64
+
+typedef struct {
+    AstNode* node;
+    bool children_done;
+} CloneFrame;
+
+// postorder with an explicit stack (no recursion: any depth)
+// the clones of the children wait on 'done' until their parent is built
 AstNode* clone_ast_node(AstNode *node) {
     if (node == NULL) return NULL;
 
-    if (node->type == AST_NUM) {
-        return create_num_node(node->number);
-    } else if (node->type == AST_VAR) {
-        return create_var_node();
-    } else if (node->type == AST_OP) {
-        AstNode* left = clone_ast_node(node->op.left);
-        AstNode* right = clone_ast_node(node->op.right);
+    CloneFrame frames_local[LOCAL_STACK];
+    AstNode* done_local[LOCAL_STACK];
+    Stack frames, done;
+    STACK_INIT_LOCAL(&frames, CloneFrame, frames_local);
+    STACK_INIT_LOCAL(&done, AstNode*, done_local);
 
-        return create_op_node(node->op.op, left, right);
-    } else if (node->type == AST_FUNC) {
-        AstNode* arg = clone_ast_node(node->func.arg);
+    *(CloneFrame*) stack_push(&frames) = (CloneFrame) { node, false };
 
-        return create_func_node(node->func.func, arg);
-    } else if (node->type == AST_UNARY) {
-        AstNode* operand = clone_ast_node(node->unary.operand);
+    while (!stack_empty(&frames)) {
+        CloneFrame* frame = (CloneFrame*) stack_top(&frames);
+        AstNode* src = frame->node;
 
-        return create_unary_node(node->unary.unary, operand);
-    } else {
-        return NULL;
+        AstNode* children[2];
+        int count = src != NULL ? node_children(src, children) : 0;
+
+        if (!frame->children_done && count > 0) {
+            frame->children_done = true;
+            // the last child is pushed first so the first one is cloned first
+            for (int i = count - 1; i >= 0; i--) {
+                *(CloneFrame*) stack_push(&frames) = (CloneFrame) { children[i], false };
+            }
+            continue;
+        }
+        stack_pop(&frames);
+
+        AstNode* clone;
+        if (src == NULL) {
+            clone = NULL;
+        } else if (src->type == AST_NUM) {
+            clone = create_num_node(src->number);
+        } else if (src->type == AST_VAR) {
+            clone = create_var_node();
+        } else if (src->type == AST_OP) {
+            AstNode* right = *(AstNode**) stack_pop(&done);
+            AstNode* left = *(AstNode**) stack_pop(&done);
+            clone = create_op_node(src->op.op, left, right);
+        } else if (src->type == AST_FUNC) {
+            clone = create_func_node(src->func.func, *(AstNode**) stack_pop(&done));
+        } else {
+            clone = create_unary_node(src->unary.unary, *(AstNode**) stack_pop(&done));
+        }
+
+        // a simplified subtree stays simplified: simplify_ast_node will skip it
+        if (clone != NULL) clone->flags |= src->flags & AST_FLAG_SIMPLIFIED;
+        *(AstNode**) stack_push(&done) = clone;
+    }
+
+    AstNode* clone = *(AstNode**) stack_pop(&done);
+    free_stack(&frames);
+    free_stack(&done);
+    return clone;
+}
+
+
+// every node is counted once per parent, its children only the first time
+void count_ast_uses(AstNode* tree, PtrMap* uses) {
+    AstNode* pending_local[LOCAL_STACK];
+    Stack pending;
+    STACK_INIT_LOCAL(&pending, AstNode*, pending_local);
+    if (tree != NULL) *(AstNode**) stack_push(&pending) = tree;
+
+    while (!stack_empty(&pending)) {
+        AstNode* node = *(AstNode**) stack_pop(&pending);
+
+        intptr_t count = (intptr_t) ptrmap_get(uses, node);
+        ptrmap_put(uses, node, (void*) (count + 1));
+        if (count > 0) continue; // children already counted
+
+        AstNode* children[2];
+        int child_count = node_children(node, children);
+        for (int i = 0; i < child_count; i++) {
+            if (children[i] != NULL) *(AstNode**) stack_push(&pending) = children[i];
+        }
     }
+
+    free_stack(&pending);
 }
 
+// drop one reference, return true if it was the last one
+static bool release(AstNode* node) {
+    if (node->flags & AST_FLAG_SHARED) return false; // owned by its store
+    if (node->refs == AST_REFS_MAX) return false; // stuck
+    if (node->refs > 1) {
+        node->refs--;
+        return false;
+    }
+    return true;
+}
 
 void destroy_ast_node(AstNode* node) {
-    if (node == NULL) return;
+    if (node == NULL || !release(node)) return;
+    if (node->flags & AST_FLAG_ARENA) return; // freed with its arena
+
+    // nodes whose last reference is gone, freed one at a time (no recursion: any depth)
+    AstNode* pending_local[LOCAL_STACK];
+    Stack pending;
+    STACK_INIT_LOCAL(&pending, AstNode*, pending_local);
+    *(AstNode**) stack_push(&pending) = node;
+
+    while (!stack_empty(&pending)) {
+        node = *(AstNode**) stack_pop(&pending);
 
-    if (node->type == AST_OP) {
-        destroy_ast_node(node->op.left);
-        destroy_ast_node(node->op.right);
-    } else if (node->type == AST_FUNC) {
-        destroy_ast_node(node->func.arg);
-    } else if (node->type == AST_UNARY) {
-        destroy_ast_node(node->unary.operand);
+        AstNode* children[2];
+        int count = node_children(node, children);
+        for (int i = 0; i < count; i++) {
+            AstNode* child = children[i];
+            if (child != NULL && release(child) && !(child->flags & AST_FLAG_ARENA)) {
+                *(AstNode**) stack_push(&pending) = child;
+            }
+        }
+
+        free(node);
     }
 
-    free(node);
+    free_stack(&pending);
 }
 
 // no recursive
 void destroy_ast_node_only(AstNode* node) {
     if (node == NULL) return;
+
+    if (!release(node)) {
+        // still used elsewhere: it keeps its children, the caller gets references of its own
+        if (node->type == AST_OP) {
+            retain_ast_node(node->op.left);
+            retain_ast_node(node->op.right);
+        } else if (node->type == AST_FUNC) {
+            retain_ast_node(node->func.arg);
+        } else if (node->type == AST_UNARY) {
+            retain_ast_node(node->unary.operand);
+        }
+        return;
+    }
+
+    if (node->flags & AST_FLAG_ARENA) return;
     free(node);
 }
 
 
+typedef struct {
+    AstNode* node;
+    int indent;
+} PrintFrame;
+
+// preorder with an explicit stack (no recursion: any depth)
 void print_ast_node(AstNode *node, int indent) {
-    for (int i = 0; i < indent; i++) {
-        printf("  ");;
-    }
+    PrintFrame frames_local[LOCAL_STACK];
+    Stack frames;
+    STACK_INIT_LOCAL(&frames, PrintFrame, frames_local);
+    *(PrintFrame*) stack_push(&frames) = (PrintFrame) { node, indent };
 
-    switch (node->type) {
-    case AST_NUM:
-        printf("[NUM: %lf]\n", node->number);
-        break;
-    case AST_VAR:
-        printf("[VAR: x]\n");
-        break;
-    case AST_OP:
-        printf("[OP: %d]\n", node->op.op);
-        print_ast_node(node->op.left, indent+1);
-        print_ast_node(node->op.right, indent+1);
-        break;
-    case AST_FUNC:
-        printf("[FUNC: %d]\n", node->func.func);
-        print_ast_node(node->func.arg, indent+1);
-        break;
-    case AST_UNARY:
-        printf("[UNARY: %d]\n", node->unary.unary);
-        print_ast_node(node->unary.operand, indent+1);
+    while (!stack_empty(&frames)) {
+        PrintFrame frame = *(PrintFrame*) stack_pop(&frames);
+        node = frame.node;
+
+        for (int i = 0; i < frame.indent; i++) {
+            printf("  ");;
+        }
+
+        switch (node->type) {
+        case AST_NUM:
+            printf("[NUM: %lf]\n", node->number);
+            break;
+        case AST_VAR:
+            printf("[VAR: x]\n");
+            break;
+        case AST_OP:
+            printf("[OP: %d]\n", node->op.op);
+            break;
+        case AST_FUNC:
+            printf("[FUNC: %d]\n", node->func.func);
+            break;
+        case AST_UNARY:
+            printf("[UNARY: %d]\n", node->unary.unary);
+            break;
+        }
+
+        AstNode* children[2];
+        int count = node_children(node, children);
+        for (int i = count - 1; i >= 0; i--) {
+            *(PrintFrame*) stack_push(&frames) = (PrintFrame) { children[i], frame.indent + 1 };
+        }
     }
+
+    free_stack(&frames);
 }
 
 
-static char* strmerge(const char* a, const char* b) {
-    char* result = malloc(strlen(a) + strlen(b) + 1);
-    strcpy(result, a);
-    strcat(result, b);
-    return result;
-}
+// infix output goes either to a buffer or straight to a stream
+typedef struct {
+    StrBuf* buf;
+    FILE* fp;
+    PtrMap* names; // node -> number of its temporary, NULL = no temporaries
+    AstNode* root; // written in full even if it is named
+} InfixWriter;
 
-static char* strmerge3(const char* a, const char* b, const char* c) {
-    char* ab = strmerge(a, b);
-    char* abc = strmerge(ab, c);
-    free(ab);
-    return abc;
+static void write_str(InfixWriter* w, const char* str, size_t len) {
+    if (w->fp != NULL) {
+        fwrite(str, 1, len, w->fp);
+    } else {
+        strbuf_append(w->buf, str, len);
+    }
 }
 
 // operator priority
@@ -164,66 +363,160 @@ static char* function_to_str(Function func) {
         return "<?>";
     }
 }
-char* ast_to_infix(AstNode* node) {
-    if (!node) return strdup("<?>");
 
-    switch (node->type) {
-        case AST_NUM: {
-            char buf[64];
-            snprintf(buf, sizeof(buf), "%.10g", node->number);
-            return strdup(buf);
-        }
-        case AST_VAR:
-            return strdup("x");
-        case AST_OP: {
-            char* left_str = ast_to_infix(node->op.left);
-            char* right_str = ast_to_infix(node->op.right);
-
-            // is pathensesis needed
-            int my_prec = precedence(node->op.op);
-            int left_prec = (node->op.left && node->op.left->type == AST_OP) ? precedence(node->op.left->op.op) : 99;
-            int right_prec = (node->op.right && node->op.right->type == AST_OP) ? precedence(node->op.right->op.op) : 99;
-
-            if (left_prec < my_prec) {
-                char* temp = left_str;
-                left_str = strmerge3("(", temp, ")");
-                free(temp);
-            }
+static const char* operator_to_str(Operator op) {
+    switch (op) {
+        case OP_ADD: return " + ";
+        case OP_SUB: return " - ";
+        case OP_MUL: return " * ";
+        case OP_DIV: return " / ";
+        case OP_POW: return " ^ ";
+        default:     return " ? ";
+    }
+}
 
-            if (right_prec < my_prec || (node->op.op == OP_SUB && right_prec == my_prec)) {
-                char* temp = right_str;
-                right_str = strmerge3("(", temp, ")");
-                free(temp);
-            }
+#define WRITE_LITERAL(w, s) write_str(w, s, sizeof(s) - 1)
 
-            const char* op_str = NULL;
-            switch (node->op.op) {
-                case OP_ADD: op_str = " + "; break;
-                case OP_SUB: op_str = " - "; break;
-                case OP_MUL: op_str = " * "; break;
-                case OP_DIV: op_str = " / "; break;
-                case OP_POW: op_str = " ^ "; break;
-                default:     op_str = " ? "; break;
-            }
+// number of the temporary written in place of the node, 0 if none
+static int temp_number(InfixWriter* w, AstNode* node) {
+    if (w->names == NULL || node == NULL || node == w->root) return 0;
+    return (int) (intptr_t) ptrmap_get(w->names, node);
+}
 
-            char* expr = strmerge3(left_str, op_str, right_str);
-            free(left_str);
-            free(right_str);
-            return expr;
+// written with a leading '-'
+static bool is_signed(InfixWriter* w, AstNode* node) {
+    if (temp_number(w, node) != 0) return false;
+    return node != NULL && (node->type == AST_UNARY || (node->type == AST_NUM && signbit(node->number)));
+}
+
+// a temporary is written as a name: an atom like a number
+static int operand_precedence(InfixWriter* w, AstNode* node) {
+    if (node == NULL || node->type != AST_OP || temp_number(w, node) != 0) return 99;
+    return precedence(node->op.op);
+}
+
+// what is left to write: a subtree, or a piece of text when text != NULL
+typedef struct {
+    AstNode* node;
+    const char* text; // static string
+    size_t len;
+} InfixItem;
+
+#define PUSH_NODE(stack, n) (*(InfixItem*) stack_push(stack) = (InfixItem) { n, NULL, 0 })
+#define PUSH_TEXT(stack, s, l) (*(InfixItem*) stack_push(stack) = (InfixItem) { NULL, s, l })
+#define PUSH_LITERAL(stack, s) PUSH_TEXT(stack, s, sizeof(s) - 1)
+
+// one traversal, every piece is written once in order
+// the pieces of a node are pushed in reverse, so they are written in order
+// (explicit stack, no recursion: any depth)
+static void write_infix(InfixWriter* w, AstNode* node) {
+    InfixItem items_local[LOCAL_STACK];
+    Stack items;
+    STACK_INIT_LOCAL(&items, InfixItem, items_local);
+    PUSH_NODE(&items, node);
+
+    while (!stack_empty(&items)) {
+        InfixItem item = *(InfixItem*) stack_pop(&items);
+        if (item.text != NULL) {
+            write_str(w, item.text, item.len);
+            continue;
         }
-        case AST_FUNC: {
-            char* arg_str = ast_to_infix(node->func.arg);
-            char* temp = strmerge3(function_to_str(node->func.func), "(", arg_str);
-            char* result = strmerge(temp, ")");
-            free(temp);
-            free(arg_str);
-            return result;
+
+        node = item.node;
+        if (!node) {
+            WRITE_LITERAL(w, "<?>");
+            continue;
         }
-        case AST_UNARY: {
-            char* operand_str = ast_to_infix(node->unary.operand);
-            char* result = strmerge3("-(", operand_str, ")");
-            free(operand_str);
-            return result;
+
+        int temp = temp_number(w, node);
+        if (temp != 0) {
+            char buf[16];
+            int len = snprintf(buf, sizeof(buf), "t%d", temp);
+            write_str(w, buf, len);
+            continue;
+        }
+
+        switch (node->type) {
+            case AST_NUM: {
+                char buf[64];
+                int len = snprintf(buf, sizeof(buf), "%.10g", node->number);
+                write_str(w, buf, len);
+                break;
+            }
+            case AST_VAR:
+                WRITE_LITERAL(w, "x");
+                break;
+            case AST_OP: {
+                // is pathensesis needed
+                int my_prec = precedence(node->op.op);
+                int left_prec = operand_precedence(w, node->op.left);
+                int right_prec = operand_precedence(w, node->op.right);
+
+                // parentheses wherever the text would parse back as another tree:
+                //   a - (b + c), a / (b * c): - and / are left associative
+                //   (a ^ b) ^ c: ^ is right associative
+                //   (-3) ^ x, x ^ (-3): ^ takes no sign on either side (-(3) ^ x is -(3 ^ x), x ^ -(3) is an error)
+                // the rules for / and ^ changed the printed output on purpose:
+                // x / (2 * x) used to be printed x / 2 * x, which reads as (x / 2) * x
+                bool left_paren = left_prec < my_prec
+                    || (node->op.op == OP_POW && (left_prec == my_prec || is_signed(w, node->op.left)));
+                bool right_paren = right_prec < my_prec
+                    || ((node->op.op == OP_SUB || node->op.op == OP_DIV) && right_prec == my_prec)
+                    || (node->op.op == OP_POW && is_signed(w, node->op.right));
+
+                if (right_paren) PUSH_LITERAL(&items, ")");
+                PUSH_NODE(&items, node->op.right);
+                if (right_paren) PUSH_LITERAL(&items, "(");
+
+                PUSH_TEXT(&items, operator_to_str(node->op.op), 3);
+
+                if (left_paren) PUSH_LITERAL(&items, ")");
+                PUSH_NODE(&items, node->op.left);
+                if (left_paren) PUSH_LITERAL(&items, "(");
+                break;
+            }
+            case AST_FUNC: {
+                const char* name = function_to_str(node->func.func);
+                write_str(w, name, strlen(name));
+                WRITE_LITERAL(w, "(");
+                PUSH_LITERAL(&items, ")");
+                PUSH_NODE(&items, node->func.arg);
+                break;
+            }
+            case AST_UNARY:
+                WRITE_LITERAL(w, "-(");
+                PUSH_LITERAL(&items, ")");
+                PUSH_NODE(&items, node->unary.operand);
+                break;
         }
     }
+
+    free_stack(&items);
+}
+
+void ast_append_infix(StrBuf* buf, AstNode* node) {
+    InfixWriter w = { buf, NULL, NULL, NULL };
+    write_infix(&w, node);
+}
+
+void ast_fprint_infix(FILE* fp, AstNode* node) {
+    InfixWriter w = { NULL, fp, NULL, NULL };
+    write_infix(&w, node);
+}
+
+void ast_append_infix_named(StrBuf* buf, AstNode* node, PtrMap* names) {
+    InfixWriter w = { buf, NULL, names, node };
+    write_infix(&w, node);
+}
+
+void ast_fprint_infix_named(FILE* fp, AstNode* node, PtrMap* names) {
+    InfixWriter w = { NULL, fp, names, node };
+    write_infix(&w, node);
+}
+
+char* ast_to_infix(AstNode* node) {
+    StrBuf buf;
+    init_strbuf(&buf);
+    ast_append_infix(&buf, node);
+    return strbuf_detach(&buf);
 }
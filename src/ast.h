@@ -1,6 +1,10 @@
 #ifndef __AST_H__
 #define __AST_H__
 
+#include <stdio.h>
+#include "arena.h"
+#include "strbuf.h"
+#include "ptrmap.h"
 
 typedef enum {
     AST_NUM, AST_VAR, AST_OP, AST_FUNC, AST_UNARY
@@ -21,8 +25,18 @@ typedef enum {
     UNARY_PLUS, UNARY_MINUS
 } Unary;
 
+// AstNode.flags
+#define AST_FLAG_ARENA 0x01 // allocated from an arena, never freed one by one
+#define AST_FLAG_SHARED 0x02 // interned in a HashCons store (see hashcons.h)
+#define AST_FLAG_SIMPLIFIED 0x04 // subtree already at the fixpoint of simplify_ast_node (see calc.h)
+
+// AstNode.refs: references to the node (parents and holders), see retain_ast_node
+#define AST_REFS_MAX 0xFFFFFF // a count that reaches it sticks: the node is never freed
+
 typedef struct AstNode {
     AstType type;
+    unsigned int flags : 8;
+    unsigned int refs : 24;
     union {
         // AST_NUM
         double number;
@@ -49,21 +63,69 @@ typedef struct AstNode {
 } AstNode;
 
 
+// every create_* (and so the parser, clone_ast_node, derivative_expression
+// and simplify_ast_node) allocates from the arena set for the current thread.
+// while the nodes are in an arena, destroy_ast_node* only drops the reference
+// and the whole tree is freed at once by reset_arena/destroy_arena.
+// a tree built in an arena must only point to nodes of the same arena.
+// NULL (default) = malloc/free
+void set_ast_arena(Arena* arena);
+Arena* get_ast_arena();
+
 AstNode* create_num_node(double num);
 AstNode* create_var_node();
 AstNode* create_op_node(Operator op, AstNode* left, AstNode* right);
 AstNode* create_func_node(Function func, AstNode* arg);
 AstNode* create_unary_node(Unary unary, AstNode* operand);
 
-// clone ast node recursively (deep clone)
+/*
+nodes are reference counted and never modified while they are shared:
+a subtree can be used by many parents at once (a DAG), create_* returns a node
+with one reference and takes over the references to its children.
+    AstNode* square = create_op_node(OP_MUL, retain_ast_node(f), retain_ast_node(f));
+a node with a single reference may be changed in place (simplify_ast_node),
+a shared one is copied first (unshare_ast_node).
+the counts are not atomic: a tree belongs to one thread at a time.
+interned nodes (AST_FLAG_SHARED) are not counted, the store owns them.
+*/
+
+// one more reference to the node, return the node
+AstNode* retain_ast_node(AstNode* node);
+
+// copy on write: 'node' itself if the caller holds its only reference,
+// else a copy of the node (not of its children, they are retained)
+// and the caller's reference to 'node' is dropped
+AstNode* unshare_ast_node(AstNode* node);
+
+// deep clone, AST_FLAG_SIMPLIFIED is kept
+// clone, destroy, print and the infix writers walk the tree with an explicit stack (stack.h):
+// any depth, a chain of a million terms does not overflow the call stack
 AstNode* clone_ast_node(AstNode* node);
 
+// parents of every node of the DAG under 'tree', added to 'uses'
+// (node -> count as (void*) (intptr_t) count, the root counts as used once)
+void count_ast_uses(AstNode* tree, PtrMap* uses);
+
+// drop a reference, the subtree is freed with the last one
 void destroy_ast_node(AstNode* node);
-void destroy_ast_node_only(AstNode* node); // no recursive
+// drop a reference to the node but not to its children: the caller takes over
+// the node's references to them (no recursive)
+void destroy_ast_node_only(AstNode* node);
 
 // Print ast tree nodes (just for test and debug)
 void print_ast_node(AstNode* node, int indent);
 
+// infix string (must be freed)
+// all three write exactly the same text in one traversal (linear time)
 char* ast_to_infix(AstNode* node);
+// append to the end of 'buf' (reuse the buffer for many trees)
+void ast_append_infix(StrBuf* buf, AstNode* node);
+// write straight to the stream, no string is built
+void ast_fprint_infix(FILE* fp, AstNode* node);
+
+// same, but the nodes below 'node' found in 'names' (node -> number n as (void*) (intptr_t) n)
+// are written as the temporary tn instead of their subtree (see cse.h)
+void ast_append_infix_named(StrBuf* buf, AstNode* node, PtrMap* names);
+void ast_fprint_infix_named(FILE* fp, AstNode* node, PtrMap* names);
 
 #endif
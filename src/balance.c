@@ -0,0 +1,172 @@
+#include "balance.h"
+
+#include "ast.h"
+#include "ptrmap.h"
+#include "stack.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+
+static bool strict_fp = false;
+
+void set_strict_fp(bool strict) {
+    strict_fp = strict;
+}
+
+bool get_strict_fp() {
+    return strict_fp;
+}
+
+
+static bool is_associative(AstNode* node) {
+    return node->type == AST_OP && (node->op.op == OP_ADD || node->op.op == OP_MUL);
+}
+
+// operands of the run of 'root->op.op' under 'root' pushed on 'operands', left to right
+// (a + b) + (c * d + e) -> a, b, c * d, e
+static int collect_run(AstNode* root, Stack* pending, Stack* operands) {
+    Operator op = root->op.op;
+    int count = 0;
+
+    *(AstNode**) stack_push(pending) = root;
+    while (!stack_empty(pending)) {
+        AstNode* node = *(AstNode**) stack_pop(pending);
+
+        if (node != NULL && node->type == AST_OP && node->op.op == op) {
+            *(AstNode**) stack_push(pending) = node->op.right;
+            *(AstNode**) stack_push(pending) = node->op.left;
+        } else {
+            *(AstNode**) stack_push(operands) = node;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+// combine terms[0..count) pairwise, level by level, into one tree of depth ceil(log2(count))
+// takes over the references of the terms
+static AstNode* build_balanced(Operator op, AstNode** terms, int count) {
+    while (count > 1) {
+        int half = count / 2;
+        for (int i = 0; i < half; i++) {
+            terms[i] = create_op_node(op, terms[2 * i], terms[2 * i + 1]);
+        }
+        if (count % 2 != 0) terms[half] = terms[count - 1]; // the last one goes up a level as it is
+        count = half + count % 2;
+    }
+
+    return terms[0];
+}
+
+
+// a node waiting for the balanced trees of its operands
+typedef struct {
+    AstNode* node;
+    bool children_done;
+    int count; // operands on 'done' once they are balanced
+} BalanceFrame;
+
+#define LOCAL_STACK 64
+
+// postorder with an explicit stack (no recursion: any depth)
+// a run is one frame whose operands are all the non-run nodes under it
+AstNode* balance_ast(AstNode* tree) {
+    if (tree == NULL) return NULL;
+
+    BalanceFrame frames_local[LOCAL_STACK];
+    AstNode* done_local[LOCAL_STACK];
+    AstNode* pending_local[LOCAL_STACK];
+    AstNode* operands_local[LOCAL_STACK];
+    Stack frames, done, pending, operands;
+    STACK_INIT_LOCAL(&frames, BalanceFrame, frames_local);
+    STACK_INIT_LOCAL(&done, AstNode*, done_local);
+    STACK_INIT_LOCAL(&pending, AstNode*, pending_local);
+    STACK_INIT_LOCAL(&operands, AstNode*, operands_local);
+
+    // input node -> its balanced tree (a DAG is balanced once per node)
+    PtrMap memo;
+    init_ptrmap(&memo);
+
+    *(BalanceFrame*) stack_push(&frames) = (BalanceFrame) { tree, false, 0 };
+
+    while (!stack_empty(&frames)) {
+        BalanceFrame* frame = (BalanceFrame*) stack_top(&frames);
+        AstNode* node = frame->node;
+
+        if (!frame->children_done) {
+            AstNode* known = node != NULL ? (AstNode*) ptrmap_get(&memo, node) : NULL;
+
+            if (node == NULL || node->type == AST_NUM || node->type == AST_VAR || known != NULL) {
+                stack_pop(&frames);
+                *(AstNode**) stack_push(&done) = retain_ast_node(known != NULL ? known : node);
+                continue;
+            }
+
+            frame->children_done = true;
+
+            int count;
+            if (is_associative(node)) {
+                count = collect_run(node, &pending, &operands);
+            } else {
+                count = node->type == AST_OP ? 2 : 1;
+                if (node->type == AST_OP) *(AstNode**) stack_push(&operands) = node->op.left;
+                *(AstNode**) stack_push(&operands) = node->type == AST_OP ? node->op.right
+                    : node->type == AST_FUNC ? node->func.arg : node->unary.operand;
+            }
+            frame->count = count;
+
+            // the last operand is pushed first so the first one is done first
+            for (int i = 0; i < count; i++) {
+                AstNode* operand = *(AstNode**) stack_pop(&operands);
+                *(BalanceFrame*) stack_push(&frames) = (BalanceFrame) { operand, false, 0 };
+            }
+            continue;
+        }
+
+        BalanceFrame finished = *(BalanceFrame*) stack_pop(&frames);
+        AstNode** results = (AstNode**) stack_top(&done) - (finished.count - 1);
+        AstNode* result;
+
+        if (is_associative(node) && finished.count > 2) {
+            result = build_balanced(node->op.op, results, finished.count);
+        } else {
+            AstNode* children[2] = { NULL, NULL };
+            if (node->type == AST_OP) {
+                children[0] = node->op.left;
+                children[1] = node->op.right;
+            } else {
+                children[0] = node->type == AST_FUNC ? node->func.arg : node->unary.operand;
+            }
+
+            bool unchanged = true;
+            for (int i = 0; i < finished.count; i++) {
+                if (results[i] != children[i]) unchanged = false;
+            }
+
+            if (unchanged) {
+                // share the node itself, drop the references taken on its children
+                for (int i = 0; i < finished.count; i++) destroy_ast_node(results[i]);
+                result = retain_ast_node(node);
+            } else if (node->type == AST_OP) {
+                result = create_op_node(node->op.op, results[0], results[1]);
+            } else if (node->type == AST_FUNC) {
+                result = create_func_node(node->func.func, results[0]);
+            } else {
+                result = create_unary_node(node->unary.unary, results[0]);
+            }
+        }
+
+        done.size -= finished.count;
+        *(AstNode**) stack_push(&done) = result;
+        ptrmap_put(&memo, node, result);
+    }
+
+    AstNode* result = *(AstNode**) stack_pop(&done);
+    free_ptrmap(&memo);
+    free_stack(&frames);
+    free_stack(&done);
+    free_stack(&pending);
+    free_stack(&operands);
+    return result;
+}
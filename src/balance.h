@@ -0,0 +1,32 @@
+#ifndef __BALANCE_H__
+#define __BALANCE_H__
+
+#include <stdbool.h>
+#include "ast.h"
+
+/*
+rebalancing of associative chains:
+the parser folds to the left, so a + b + c + d is ((a + b) + c) + d,
+a chain as deep as it has terms: every addition waits for the one before it.
+runs of + (and of *) are rebuilt pairwise into trees of log depth
+    a + b + c + d + e  ->  ((a + b) + (c + d)) + e
+the operands keep their order, only the grouping changes.
+- and / are not associative and are left as they are (a - b - c stays a chain).
+
+the grouping changes the rounding of a floating point sum or product,
+so the result may differ from the tree in the last bits (and 1e308 + 1e308 - 1e308
+style overflows can appear or disappear).
+*/
+
+// balanced tree of 'tree' (allocated like create_*)
+// 'tree' is only read (it may be a DAG), the result shares (retains) its unchanged subtrees:
+// the caller still destroys 'tree' and destroys the result
+AstNode* balance_ast(AstNode* tree);
+
+// strict floating point: the compilers (compile_ast in bytecode.h, jit_compile in jit.h)
+// rebalance the tree first unless strict fp is on, in which case they keep
+// the order of the tree and give the same bits as evaluate_ast (off by default)
+void set_strict_fp(bool strict);
+bool get_strict_fp();
+
+#endif
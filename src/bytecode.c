@@ -0,0 +1,456 @@
+#include "bytecode.h"
+
+#include "ast.h"
+#include "balance.h"
+#include "eval.h"
+#include "stack.h"
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define BYTECODE_SIMD
+#include "vecmath.h"
+#endif
+
+
+// run_program (and compile_node, for its frames) keeps the stack in a local array when it is small enough
+#define LOCAL_STACK_SIZE 64
+// points evaluated together by run_program_batch
+#define BATCH_BLOCK 256
+
+
+static void emit(Program* program, Opcode op, double value) {
+    if (program->size == program->capacity) {
+        program->capacity = program->capacity == 0 ? 32 : program->capacity * 2;
+        program->code = (Instruction*) realloc(program->code, program->capacity * sizeof(Instruction));
+    }
+
+    Instruction* inst = &program->code[program->size++];
+    inst->op = op;
+    inst->value = value;
+}
+
+static Opcode function_opcode(Function func) {
+    switch (func) {
+    case FUNC_SIN: return BC_SIN;
+    case FUNC_COS: return BC_COS;
+    case FUNC_TAN: return BC_TAN;
+    case FUNC_LN: return BC_LN;
+    case FUNC_LOG: return BC_LOG;
+    case FUNC_EXP: return BC_EXP;
+    default: return BC_CONST; // FUNC_INVALID, handled by the caller
+    }
+}
+
+typedef struct {
+    AstNode* node;
+    int depth; // stack size before the node
+    int operands_done; // operands compiled so far (0 = the node is not visited yet)
+} CompileFrame;
+
+// emit code leaving the value of the tree on top of the stack
+// 'depth' = stack size before this tree, keeps track of max_stack
+// with 'cse', the temporaries already stored (number <= slot_count) are loaded
+// postorder with an explicit stack (no recursion: any depth), the code is emitted in the same order
+static void compile_node(Program* program, Cse* cse, AstNode* tree, int depth) {
+    CompileFrame frames_local[LOCAL_STACK_SIZE];
+    Stack frames;
+    STACK_INIT_LOCAL(&frames, CompileFrame, frames_local);
+
+    *(CompileFrame*) stack_push(&frames) = (CompileFrame) { tree, depth, 0 };
+
+    while (!stack_empty(&frames)) {
+        CompileFrame* frame = (CompileFrame*) stack_top(&frames);
+        AstNode* node = frame->node;
+        int node_depth = frame->depth;
+
+        if (frame->operands_done == 0) {
+            if (node_depth + 1 > program->max_stack) program->max_stack = node_depth + 1;
+
+            if (node == NULL) {
+                emit(program, BC_CONST, NAN);
+                stack_pop(&frames);
+                continue;
+            }
+
+            if (cse != NULL) {
+                int temp = cse_temp_number(cse, node);
+                if (temp > 0 && temp <= program->slot_count) {
+                    emit(program, BC_LOAD, temp - 1);
+                    stack_pop(&frames);
+                    continue;
+                }
+            }
+        }
+
+        switch (node->type) {
+        case AST_NUM:
+            emit(program, BC_CONST, node->number);
+            stack_pop(&frames);
+            break;
+        case AST_VAR:
+            emit(program, BC_VAR, 0);
+            stack_pop(&frames);
+            break;
+        case AST_OP: {
+            // ADD, SUB, MUL, DIV, POW are in the same order in Operator and Opcode
+            int op = node->op.op;
+            AstNode* right = node->op.right;
+
+            if (frame->operands_done == 0) {
+                frame->operands_done = 1;
+                *(CompileFrame*) stack_push(&frames) = (CompileFrame) { node->op.left, node_depth, 0 };
+            } else if (frame->operands_done == 1 && right != NULL && right->type == AST_NUM) {
+                emit(program, (Opcode) (BC_ADD_CONST + op), right->number);
+                stack_pop(&frames);
+            } else if (frame->operands_done == 1 && right != NULL && right->type == AST_VAR) {
+                emit(program, (Opcode) (BC_ADD_VAR + op), 0);
+                stack_pop(&frames);
+            } else if (frame->operands_done == 1) {
+                frame->operands_done = 2;
+                *(CompileFrame*) stack_push(&frames) = (CompileFrame) { right, node_depth + 1, 0 };
+            } else {
+                emit(program, (Opcode) (BC_ADD + op), 0);
+                stack_pop(&frames);
+            }
+            break;
+        }
+        case AST_FUNC:
+            if (node->func.func == FUNC_INVALID) {
+                emit(program, BC_CONST, NAN);
+                stack_pop(&frames);
+            } else if (frame->operands_done == 0) {
+                frame->operands_done = 1;
+                *(CompileFrame*) stack_push(&frames) = (CompileFrame) { node->func.arg, node_depth, 0 };
+            } else {
+                emit(program, function_opcode(node->func.func), 0);
+                stack_pop(&frames);
+            }
+            break;
+        case AST_UNARY:
+            if (frame->operands_done == 0) {
+                frame->operands_done = 1;
+                *(CompileFrame*) stack_push(&frames) = (CompileFrame) { node->unary.operand, node_depth, 0 };
+            } else {
+                if (node->unary.unary == UNARY_MINUS) emit(program, BC_NEG, 0);
+                stack_pop(&frames);
+            }
+            break;
+        }
+    }
+
+    free_stack(&frames);
+}
+
+static Program* create_program() {
+    Program* program = (Program*) malloc(sizeof(Program));
+    program->code = NULL;
+    program->size = 0;
+    program->capacity = 0;
+    program->max_stack = 0;
+    program->slot_count = 0;
+    return program;
+}
+
+Program* compile_ast(AstNode* tree) {
+    Program* program = create_program();
+
+    if (get_strict_fp()) {
+        compile_node(program, NULL, tree, 0);
+    } else {
+        AstNode* balanced = balance_ast(tree);
+        compile_node(program, NULL, balanced, 0);
+        destroy_ast_node(balanced);
+    }
+
+    return program;
+}
+
+Program* compile_cse(Cse* cse) {
+    Program* program = create_program();
+
+    // each temporary is computed from the ones before it, then stored
+    for (int i = 0; i < cse->temp_count; i++) {
+        compile_node(program, cse, cse->temps[i], 0);
+        emit(program, BC_STORE, i);
+        program->slot_count = i + 1;
+    }
+
+    compile_node(program, cse, cse->root, 0);
+    return program;
+}
+
+void destroy_program(Program* program) {
+    if (program == NULL) return;
+
+    free(program->code);
+    free(program);
+}
+
+
+// the interpreter loop, 'stack' has at least max_stack + slot_count elements
+// (the slots follow the stack)
+static double execute(const Program* program, double x, double* stack) {
+    const Instruction* inst = program->code;
+    const Instruction* end = inst + program->size;
+    double* slots = stack + program->max_stack;
+    int sp = -1; // index of the top element
+
+    for (; inst < end; inst++) {
+        switch (inst->op) {
+        case BC_CONST: stack[++sp] = inst->value; break;
+        case BC_VAR: stack[++sp] = x; break;
+
+        case BC_ADD: sp--; stack[sp] += stack[sp+1]; break;
+        case BC_SUB: sp--; stack[sp] -= stack[sp+1]; break;
+        case BC_MUL: sp--; stack[sp] *= stack[sp+1]; break;
+        case BC_DIV: sp--; stack[sp] /= stack[sp+1]; break;
+        case BC_POW: sp--; stack[sp] = pow(stack[sp], stack[sp+1]); break;
+
+        case BC_ADD_CONST: stack[sp] += inst->value; break;
+        case BC_SUB_CONST: stack[sp] -= inst->value; break;
+        case BC_MUL_CONST: stack[sp] *= inst->value; break;
+        case BC_DIV_CONST: stack[sp] /= inst->value; break;
+        case BC_POW_CONST: stack[sp] = pow(stack[sp], inst->value); break;
+
+        case BC_ADD_VAR: stack[sp] += x; break;
+        case BC_SUB_VAR: stack[sp] -= x; break;
+        case BC_MUL_VAR: stack[sp] *= x; break;
+        case BC_DIV_VAR: stack[sp] /= x; break;
+        case BC_POW_VAR: stack[sp] = pow(stack[sp], x); break;
+
+        case BC_NEG: stack[sp] = -stack[sp]; break;
+
+        case BC_SIN: stack[sp] = sin(stack[sp]); break;
+        case BC_COS: stack[sp] = cos(stack[sp]); break;
+        case BC_TAN: stack[sp] = tan(stack[sp]); break;
+        case BC_LN: stack[sp] = log(stack[sp]); break;
+        case BC_LOG: stack[sp] = log10(stack[sp]); break;
+        case BC_EXP: stack[sp] = exp(stack[sp]); break;
+
+        case BC_LOAD: stack[++sp] = slots[(int) inst->value]; break;
+        case BC_STORE: slots[(int) inst->value] = stack[sp--]; break;
+        }
+    }
+
+    return stack[sp];
+}
+
+double run_program(const Program* program, double x) {
+    int need = program->max_stack + program->slot_count;
+
+    if (need <= LOCAL_STACK_SIZE) {
+        double stack[LOCAL_STACK_SIZE];
+        return execute(program, x, stack);
+    }
+
+    double* stack = (double*) malloc(need * sizeof(double));
+    double value = execute(program, x, stack);
+    free(stack);
+    return value;
+}
+
+
+// same as 'execute' but every stack slot is a block of n points
+static void execute_block(const Program* program, const double* xs, double* out, size_t n, double* stack) {
+    const Instruction* inst = program->code;
+    const Instruction* end = inst + program->size;
+    double* slots = stack + (size_t) program->max_stack * BATCH_BLOCK;
+    size_t sp = 0; // number of blocks on the stack
+    size_t i;
+
+    for (; inst < end; inst++) {
+        double v = inst->value;
+        double* a; // left operand of a binary op (second block from the top)
+        double* b; // top block
+
+        if (inst->op == BC_CONST || inst->op == BC_VAR || inst->op == BC_LOAD) {
+            b = stack + sp++ * BATCH_BLOCK;
+            a = NULL;
+        } else {
+            b = stack + (sp - 1) * BATCH_BLOCK;
+            a = b - (sp > 1 ? BATCH_BLOCK : 0);
+        }
+
+        switch (inst->op) {
+        case BC_CONST: for (i = 0; i < n; i++) b[i] = v; break;
+        case BC_VAR: for (i = 0; i < n; i++) b[i] = xs[i]; break;
+
+        case BC_ADD: for (i = 0; i < n; i++) a[i] += b[i]; sp--; break;
+        case BC_SUB: for (i = 0; i < n; i++) a[i] -= b[i]; sp--; break;
+        case BC_MUL: for (i = 0; i < n; i++) a[i] *= b[i]; sp--; break;
+        case BC_DIV: for (i = 0; i < n; i++) a[i] /= b[i]; sp--; break;
+        case BC_POW: for (i = 0; i < n; i++) a[i] = pow(a[i], b[i]); sp--; break;
+
+        case BC_ADD_CONST: for (i = 0; i < n; i++) b[i] += v; break;
+        case BC_SUB_CONST: for (i = 0; i < n; i++) b[i] -= v; break;
+        case BC_MUL_CONST: for (i = 0; i < n; i++) b[i] *= v; break;
+        case BC_DIV_CONST: for (i = 0; i < n; i++) b[i] /= v; break;
+        case BC_POW_CONST: for (i = 0; i < n; i++) b[i] = pow(b[i], v); break;
+
+        case BC_ADD_VAR: for (i = 0; i < n; i++) b[i] += xs[i]; break;
+        case BC_SUB_VAR: for (i = 0; i < n; i++) b[i] -= xs[i]; break;
+        case BC_MUL_VAR: for (i = 0; i < n; i++) b[i] *= xs[i]; break;
+        case BC_DIV_VAR: for (i = 0; i < n; i++) b[i] /= xs[i]; break;
+        case BC_POW_VAR: for (i = 0; i < n; i++) b[i] = pow(b[i], xs[i]); break;
+
+        case BC_NEG: for (i = 0; i < n; i++) b[i] = -b[i]; break;
+
+        case BC_SIN: for (i = 0; i < n; i++) b[i] = sin(b[i]); break;
+        case BC_COS: for (i = 0; i < n; i++) b[i] = cos(b[i]); break;
+        case BC_TAN: for (i = 0; i < n; i++) b[i] = tan(b[i]); break;
+        case BC_LN: for (i = 0; i < n; i++) b[i] = log(b[i]); break;
+        case BC_LOG: for (i = 0; i < n; i++) b[i] = log10(b[i]); break;
+        case BC_EXP: for (i = 0; i < n; i++) b[i] = exp(b[i]); break;
+
+        case BC_LOAD: memcpy(b, slots + (size_t) v * BATCH_BLOCK, n * sizeof(double)); break;
+        case BC_STORE: memcpy(slots + (size_t) v * BATCH_BLOCK, b, n * sizeof(double)); sp--; break;
+        }
+    }
+
+    for (i = 0; i < n; i++) out[i] = stack[i];
+}
+
+
+#ifdef BYTECODE_SIMD
+
+// 'execute_block' on 4 lanes at a time, with the vector functions of vecmath.h
+// 'stack' blocks are BATCH_BLOCK/4 vectors each
+VEC_INLINE void execute_block_vec(const Program* program, const double* xs, double* out, size_t n, v4df* stack) {
+    const Instruction* inst = program->code;
+    const Instruction* end = inst + program->size;
+    const size_t stride = BATCH_BLOCK / 4;
+    v4df* slots = stack + (size_t) program->max_stack * stride;
+    size_t vn = (n + 3) / 4; // vectors in use (the last one may be partly padding)
+    size_t sp = 0;
+    size_t i;
+    int k;
+
+    v4df xv[BATCH_BLOCK / 4];
+    memset(&xv[vn - 1], 0, sizeof(v4df));
+    memcpy(xv, xs, n * sizeof(double));
+
+    for (; inst < end; inst++) {
+        v4df v = v4_set(inst->value);
+        v4df* a; // second vector block from the top
+        v4df* b; // top vector block
+
+        if (inst->op == BC_CONST || inst->op == BC_VAR || inst->op == BC_LOAD) {
+            b = stack + sp++ * stride;
+            a = NULL;
+        } else {
+            b = stack + (sp - 1) * stride;
+            a = b - (sp > 1 ? stride : 0);
+        }
+
+        switch (inst->op) {
+        case BC_CONST: for (i = 0; i < vn; i++) b[i] = v; break;
+        case BC_VAR: for (i = 0; i < vn; i++) b[i] = xv[i]; break;
+
+        case BC_ADD: for (i = 0; i < vn; i++) a[i] += b[i]; sp--; break;
+        case BC_SUB: for (i = 0; i < vn; i++) a[i] -= b[i]; sp--; break;
+        case BC_MUL: for (i = 0; i < vn; i++) a[i] *= b[i]; sp--; break;
+        case BC_DIV: for (i = 0; i < vn; i++) a[i] /= b[i]; sp--; break;
+        case BC_POW:
+            for (i = 0; i < vn; i++) for (k = 0; k < 4; k++) a[i][k] = pow(a[i][k], b[i][k]);
+            sp--;
+            break;
+
+        case BC_ADD_CONST: for (i = 0; i < vn; i++) b[i] += v; break;
+        case BC_SUB_CONST: for (i = 0; i < vn; i++) b[i] -= v; break;
+        case BC_MUL_CONST: for (i = 0; i < vn; i++) b[i] *= v; break;
+        case BC_DIV_CONST: for (i = 0; i < vn; i++) b[i] /= v; break;
+        case BC_POW_CONST:
+            if (inst->value == 2) {
+                // the most common power, x*x is exactly pow(x, 2)
+                for (i = 0; i < vn; i++) b[i] *= b[i];
+            } else {
+                for (i = 0; i < vn; i++) for (k = 0; k < 4; k++) b[i][k] = pow(b[i][k], inst->value);
+            }
+            break;
+
+        case BC_ADD_VAR: for (i = 0; i < vn; i++) b[i] += xv[i]; break;
+        case BC_SUB_VAR: for (i = 0; i < vn; i++) b[i] -= xv[i]; break;
+        case BC_MUL_VAR: for (i = 0; i < vn; i++) b[i] *= xv[i]; break;
+        case BC_DIV_VAR: for (i = 0; i < vn; i++) b[i] /= xv[i]; break;
+        case BC_POW_VAR:
+            for (i = 0; i < vn; i++) for (k = 0; k < 4; k++) b[i][k] = pow(b[i][k], xv[i][k]);
+            break;
+
+        case BC_NEG: for (i = 0; i < vn; i++) b[i] = -b[i]; break;
+
+        case BC_SIN: for (i = 0; i < vn; i++) b[i] = v4_sin(b[i]); break;
+        case BC_COS: for (i = 0; i < vn; i++) b[i] = v4_cos(b[i]); break;
+        case BC_TAN: for (i = 0; i < vn; i++) b[i] = v4_tan(b[i]); break;
+        case BC_LN: for (i = 0; i < vn; i++) b[i] = v4_ln(b[i]); break;
+        case BC_LOG: for (i = 0; i < vn; i++) b[i] = v4_log10(b[i]); break;
+        case BC_EXP: for (i = 0; i < vn; i++) b[i] = v4_exp(b[i]); break;
+
+        case BC_LOAD: memcpy(b, slots + (size_t) inst->value * stride, vn * sizeof(v4df)); break;
+        case BC_STORE: memcpy(slots + (size_t) inst->value * stride, b, vn * sizeof(v4df)); sp--; break;
+        }
+    }
+
+    memcpy(out, stack, n * sizeof(double));
+}
+
+// compiled for AVX2 + FMA whatever the target of the build is, used only if the CPU has them
+// (the same code on plain SSE2 is slower than libm for exp/ln, so there is no SSE2 version)
+__attribute__((target("avx2,fma")))
+static void execute_block_avx2(const Program* program, const double* xs, double* out, size_t n, v4df* stack) {
+    execute_block_vec(program, xs, out, n, stack);
+}
+
+#endif
+
+
+SimdLevel detect_simd_level() {
+#ifdef BYTECODE_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SIMD_AVX2;
+#endif
+    return SIMD_NONE;
+}
+
+// -1: not decided yet, detect on first use
+// atomic: the batch workers read it while any thread may be the first one to decide it
+static atomic_int simd_level = -1;
+
+SimdLevel get_simd_level() {
+    int level = atomic_load_explicit(&simd_level, memory_order_relaxed);
+    if (level < 0) {
+        int unset = -1;
+        level = detect_simd_level();
+        // a level set meanwhile by set_simd_level (or another first use) wins
+        if (!atomic_compare_exchange_strong(&simd_level, &unset, level)) level = unset;
+    }
+    return (SimdLevel) level;
+}
+
+void set_simd_level(SimdLevel level) {
+    SimdLevel supported = detect_simd_level();
+    atomic_store(&simd_level, level < supported ? level : supported);
+}
+
+void run_program_batch(const Program* program, const double* xs, double* out, size_t n) {
+    // aligned for the vector loads, the slots follow the stack
+    size_t blocks = (size_t) program->max_stack + program->slot_count;
+    double* stack = (double*) aligned_alloc(32, blocks * BATCH_BLOCK * sizeof(double));
+    SimdLevel level = get_simd_level();
+
+    for (size_t begin = 0; begin < n; begin += BATCH_BLOCK) {
+        size_t count = n - begin < BATCH_BLOCK ? n - begin : BATCH_BLOCK;
+
+#ifdef BYTECODE_SIMD
+        if (level == SIMD_AVX2) {
+            execute_block_avx2(program, xs + begin, out + begin, count, (v4df*) stack);
+            continue;
+        }
+#endif
+        execute_block(program, xs + begin, out + begin, count, stack);
+    }
+
+    free(stack);
+}
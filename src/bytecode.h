@@ -0,0 +1,76 @@
+#ifndef __BYTECODE_H__
+#define __BYTECODE_H__
+
+#include <stddef.h>
+#include "ast.h"
+#include "cse.h"
+
+/*
+stack bytecode for fast repeated evaluation of one tree:
+the tree is compiled once to a flat array of instructions (postfix order)
+and 'run_program' executes it with a tight loop, no pointer chasing.
+
+an operand that is a number or x is folded into the instruction
+e.g. (x + 1) * x  ->  VAR, ADD_CONST 1, MUL_VAR
+
+with compile_cse every temporary (cse.h) is computed once into a slot
+and loaded where it is used:
+t1 = cos(x); t1 * t1  ->  VAR, COS, STORE 0, LOAD 0, LOAD 0, MUL
+*/
+
+typedef enum {
+    BC_CONST, // push value
+    BC_VAR, // push x
+    BC_ADD, BC_SUB, BC_MUL, BC_DIV, BC_POW, // pop b, pop a, push (a op b)
+    BC_ADD_CONST, BC_SUB_CONST, BC_MUL_CONST, BC_DIV_CONST, BC_POW_CONST, // top = top op value
+    BC_ADD_VAR, BC_SUB_VAR, BC_MUL_VAR, BC_DIV_VAR, BC_POW_VAR, // top = top op x
+    BC_NEG, // top = -top
+    BC_SIN, BC_COS, BC_TAN, BC_LN, BC_LOG, BC_EXP, // top = func(top)
+    BC_LOAD, // push slot[value]
+    BC_STORE, // pop into slot[value]
+} Opcode;
+
+typedef struct {
+    Opcode op;
+    double value; // BC_CONST, BC_*_CONST, slot index of BC_LOAD/BC_STORE
+} Instruction;
+
+typedef struct {
+    Instruction* code;
+    int size;
+    int capacity;
+    int max_stack; // stack depth needed to run
+    int slot_count; // temporaries of compile_cse
+} Program;
+
+
+// compile any tree (parse(), derivative_expression(), ...)
+// the tree is only read, it can be destroyed after compiling
+// chains of + and * are compiled balanced (balance.h) unless strict fp is on
+Program* compile_ast(AstNode* tree);
+// the tree of 'cse' with its temporaries, same result as compile_ast of the tree in strict fp
+// 'cse' can be destroyed after compiling
+Program* compile_cse(Cse* cse);
+void destroy_program(Program* program);
+
+// same result as evaluate_ast (eval.h), up to the rounding of the balanced chains
+// (bitwise equal in strict fp, see balance.h)
+double run_program(const Program* program, double x);
+// out[i] = value at xs[i], every instruction runs over a block of points at once
+// with SIMD (see below) the functions differ from libm by a few ulp (see vecmath.h)
+void run_program_batch(const Program* program, const double* xs, double* out, size_t n);
+
+
+// vector instructions used by run_program_batch
+// picked at runtime from what the CPU supports (AVX2 + FMA, else scalar libm)
+typedef enum {
+    SIMD_NONE, // scalar loops and libm: same result as run_program
+    SIMD_AVX2, // 4 lanes, vecmath.h functions
+} SimdLevel;
+
+SimdLevel detect_simd_level(); // best level of this CPU
+SimdLevel get_simd_level(); // level in use
+// use at most 'level' (e.g. SIMD_NONE to get exactly the libm results)
+void set_simd_level(SimdLevel level);
+
+#endif
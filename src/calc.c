@@ -1,412 +1,568 @@
 #include "calc.h"
 
 #include "ast.h"
+#include "stack.h"
 #include <math.h>
 #include <stdbool.h>
-#include <stdio.h>
-#include <assert.h>
 
 
 
 static bool is_node_num(AstNode* node) {
-    return node->type == AST_NUM;
+    return node != NULL && node->type == AST_NUM;
 }
 
 
 
 static bool is_node_value_num(AstNode* node, double num) {
-    return node->type == AST_NUM && node->number == num;
+    return node != NULL && node->type == AST_NUM && node->number == num;
 }
 
 
-static AstNode* calculate_add(AstNode* a, AstNode* b){
-    assert(a->type == AST_NUM && b->type == AST_NUM);
-    return create_num_node(a->number + b->number);
+// 'keep' takes the place of 'node': 'node' itself and the 'drop' subtree are destroyed
+static AstNode* replace_node(AstNode* node, AstNode* keep, AstNode* drop) {
+    destroy_ast_node_only(node);
+    destroy_ast_node(drop);
+    return keep;
+}
+
+// 'node' (with all its children) becomes a number
+static AstNode* replace_with_num(AstNode* node, double num) {
+    destroy_ast_node(node);
+    return create_num_node(num);
 }
 
 
-static AstNode* calculate_mul(AstNode* a, AstNode* b){
-    assert(a->type == AST_NUM && b->type == AST_NUM);
-    return create_num_node(a->number * b->number);
+// a + b has no rounding error (TwoSum: the error is itself a double)
+static bool is_exact_sum(double a, double b, double sum) {
+    double b_part = sum - a;
+    double a_part = sum - b_part;
+    return (a - a_part) + (b - b_part) == 0;
 }
 
-// op only can be OP_ADD or OP_MUL
-static bool calculate_operator(AstNode** parent_dp) {
-    AstNode* parent = *parent_dp;
-    assert(parent->type == AST_OP);
+// a op b for two numbers, only if the result is exact: no rounding error
+// (0.1 + 0.2 and 1 / 3 stay as they are, so do 2 ^ 0.5, 0.1 ^ 2, 1 / 0 and 0 ^ -1)
+bool calculate_constant(Operator op, double a, double b, double* result) {
+    switch (op) {
+    case OP_ADD:
+        *result = a + b;
+        if (!is_exact_sum(a, b, *result)) return false;
+        break;
+    case OP_SUB:
+        *result = a - b;
+        if (!is_exact_sum(a, -b, *result)) return false;
+        break;
+    case OP_MUL:
+        *result = a * b;
+        if (fma(a, b, -*result) != 0) return false;
+        break;
+    case OP_DIV:
+        *result = a / b;
+        if (b == 0 || fma(*result, b, -a) != 0) return false;
+        break;
+    case OP_POW:
+        if (b < 0 || b != floor(b)) return false;
+        if (a == floor(a)) {
+            // an integer power of an integer: exact up to 2^53
+            *result = pow(a, b);
+            if (fabs(*result) > 9007199254740992.0) return false; // 2^53
+        } else {
+            // multiplied out, every product exact (0.5 ^ 2 = 0.25)
+            if (b > 64) return false;
+            *result = 1;
+            for (int i = 0; i < b; i++) {
+                double product = *result * a;
+                if (fma(*result, a, -product) != 0) return false;
+                *result = product;
+            }
+        }
+        break;
+    }
 
-    Operator op = parent->op.op;
-    assert(op == OP_ADD || op == OP_MUL);
+    return isfinite(*result);
+}
 
-    AstNode* (*calc)(AstNode*, AstNode*);
-    if (op == OP_ADD) {
-        calc = &calculate_add;
-    } else if (op == OP_MUL) {
-        calc = &calculate_mul;
+// (num1 op expr) op num2 -> (num1 op num2) op expr, for op = + or *
+// also (num1 op expr1) op (num2 op expr2) -> (num1 op num2) op (expr1 op expr2)
+static AstNode* collect_constants(AstNode* node) {
+    Operator op = node->op.op;
+    AstNode* left = node->op.left;
+    AstNode* right = node->op.right;
+
+    AstNode *nums[2], *exprs[2];
+    int num_count = 0, expr_count = 0;
+    AstNode* absorbed[2]; // inner nodes that disappear
+    int absorbed_count = 0;
+
+    AstNode* sides[2] = { left, right };
+    for (int i = 0; i < 2; i++) {
+        AstNode* side = sides[i];
+
+        if (is_node_num(side)) {
+            nums[num_count++] = side;
+        } else if (side->type == AST_OP && side->op.op == op && is_node_num(side->op.left)) {
+            nums[num_count++] = side->op.left;
+            exprs[expr_count++] = side->op.right;
+            absorbed[absorbed_count++] = side;
+        } else if (side->type == AST_OP && side->op.op == op && is_node_num(side->op.right)) {
+            nums[num_count++] = side->op.right;
+            exprs[expr_count++] = side->op.left;
+            absorbed[absorbed_count++] = side;
+        } else {
+            exprs[expr_count++] = side;
+        }
     }
 
-    AstNode* left = parent->op.left;
-    AstNode* right = parent->op.right;
+    // needs two numbers and at least one of them from inside
+    double value;
+    if (num_count != 2 || absorbed_count == 0) return NULL;
+    if (!calculate_constant(op, nums[0]->number, nums[1]->number, &value)) return NULL;
 
-    bool is_left_num = is_node_num(left);
-    bool is_right_num = is_node_num(right);
+    AstNode* expr = expr_count == 1 ? exprs[0] : create_op_node(op, exprs[0], exprs[1]);
 
-    if (is_left_num && is_right_num) {
-        // num + num
-        *parent_dp = calc(left, right);
-        destroy_ast_node(parent); // destroy left, right recursively
-        return true;
+    for (int i = 0; i < absorbed_count; i++) destroy_ast_node_only(absorbed[i]);
+    destroy_ast_node_only(nums[0]);
+    destroy_ast_node_only(nums[1]);
+    destroy_ast_node_only(node);
 
-    } else if (is_left_num || is_right_num) { // Logical XOR (only one of is_left, is_right is true)
-        // num + (?) or (?) + num
-        AstNode **num1, **expr, **num2, **expr_child;
-        if (is_left_num) {
-            if (right->type != AST_OP || right->op.op != op) return false;
+    return create_op_node(op, create_num_node(value), expr);
+}
 
-            num1 = &parent->op.left;
-            expr = &parent->op.right;
-        } else if (is_right_num) {
-            if (left->type != AST_OP || left->op.op != op) return false;
 
-            num1 = &parent->op.right;
-            expr = &parent->op.left;
-        }
+// 1 / y
+static bool is_reciprocal(AstNode* node) {
+    return node->type == AST_OP && node->op.op == OP_DIV && is_node_value_num(node->op.left, 1);
+}
 
-        AstNode* expr_left = (*expr)->op.left;
-        AstNode* expr_right = (*expr)->op.right;
+// 'node' = x * (1 / y) -> x / y
+static AstNode* divide_by(AstNode* node, AstNode* x, AstNode* reciprocal) {
+    AstNode* one = reciprocal->op.left;
+    AstNode* result = create_op_node(OP_DIV, x, reciprocal->op.right);
+    destroy_ast_node_only(reciprocal);
+    destroy_ast_node(one);
+    destroy_ast_node_only(node);
+    return result;
+}
 
-        // assume only one of them can be num
-        if (is_node_num(expr_left)) {
-            num2 = &(*expr)->op.left;
-            expr_child = &(*expr)->op.right;
-        } else if (is_node_num(expr_right)) {
-            num2 = &(*expr)->op.right;
-            expr_child = &(*expr)->op.left;
-        } else {
-            return false;
-        }
 
-        parent->op.left = calc(*num1, *num2);
-        parent->op.right = *expr_child;
-        destroy_ast_node_only(*num1);
-        destroy_ast_node_only(*num2);
-        return true;
-    } else {
-        // (non-num..) + (non-num..)
-        if (left->op.op != op || right->op.op != op) return false;
+FoldResult fold_op(Operator op, AstNode* left, AstNode* right, double* value) {
+    if (left == NULL || right == NULL) return FOLD_NONE;
 
-        AstNode *left_num, *right_num, *left_expr, *right_expr;
+    // 2 + 3 = 5
+    if (is_node_num(left) && is_node_num(right) && calculate_constant(op, left->number, right->number, value)) {
+        return FOLD_NUMBER;
+    }
 
-        if (is_node_num(left->op.left)) {
-            left_num = left->op.left;
-            left_expr = left->op.right;
-        } else if (is_node_num(left->op.right)) {
-            left_num = left->op.right;
-            left_expr = left->op.left;
-        } else {
-            return false;
+    switch (op) {
+    case OP_ADD:
+        // 0 + x = x, x + 0 = x
+        if (is_node_value_num(left, 0)) return FOLD_RIGHT;
+        if (is_node_value_num(right, 0)) return FOLD_LEFT;
+        break;
+
+    case OP_SUB:
+        // x - 0 = x, 0 - x = -x
+        if (is_node_value_num(right, 0)) return FOLD_LEFT;
+        if (is_node_value_num(left, 0)) return FOLD_NEGATE;
+        break;
+
+    case OP_MUL:
+        // x * 0 = 0, x * 1 = x
+        if (is_node_value_num(left, 0) || is_node_value_num(right, 0)) {
+            *value = 0;
+            return FOLD_NUMBER;
         }
-
-        if (is_node_num(right->op.left)) {
-            right_num = right->op.left;
-            right_expr = right->op.right;
-        } else if (is_node_num(right->op.right)) {
-            right_num = right->op.right;
-            right_expr = right->op.left;
-        } else {
-            return false;
+        if (is_node_value_num(left, 1)) return FOLD_RIGHT;
+        if (is_node_value_num(right, 1)) return FOLD_LEFT;
+        break;
+
+    case OP_DIV:
+        // x / 1 = x, 0 / x = 0 (0 / 0 stays)
+        if (is_node_value_num(right, 1)) return FOLD_LEFT;
+        if (is_node_value_num(left, 0) && !is_node_num(right)) {
+            *value = 0;
+            return FOLD_NUMBER;
+        }
+        break;
+
+    case OP_POW:
+        // x ^ 1 = x
+        if (is_node_value_num(right, 1)) return FOLD_LEFT;
+        // x ^ 0 = 1 (0 ^ 0 too), 1 ^ x = 1
+        if (is_node_value_num(right, 0) || is_node_value_num(left, 1)) {
+            *value = 1;
+            return FOLD_NUMBER;
+        }
+        // 0 ^ x = 0 (x > 0), 0 ^ x (x < 0) is an error and stays as it is
+        if (is_node_value_num(left, 0) && is_node_num(right) && right->number > 0) {
+            *value = 0;
+            return FOLD_NUMBER;
         }
+        break;
+    }
+
+    return FOLD_NONE;
+}
+
+FoldResult fold_func(Function func, AstNode* arg, double* value) {
+    if (!is_node_num(arg)) return FOLD_NONE;
+
+    // only the exact values: sin(2) stays as it is
+    double x = arg->number;
+    switch (func) {
+    case FUNC_SIN:
+    case FUNC_TAN:
+        if (x != 0) return FOLD_NONE;
+        *value = 0; // sin(0) = 0, tan(0) = 0
+        return FOLD_NUMBER;
+    case FUNC_COS:
+    case FUNC_EXP:
+        if (x != 0) return FOLD_NONE;
+        *value = 1; // cos(0) = 1, exp(0) = 1
+        return FOLD_NUMBER;
+    case FUNC_LN:
+    case FUNC_LOG:
+        if (x != 1) return FOLD_NONE;
+        *value = 0; // ln(1) = 0, log(1) = 0
+        return FOLD_NUMBER;
+    default:
+        return FOLD_NONE;
+    }
+}
 
-        destroy_ast_node_only(left);
-        parent->op.left = calc(left_num, right_num);
+FoldResult fold_unary(Unary unary, AstNode* operand, double* value) {
+    if (operand == NULL) return FOLD_NONE;
 
-        right->op.left = left_expr;
-        right->op.right = right_expr;
+    // +x = x
+    if (unary == UNARY_PLUS) return FOLD_LEFT;
 
-        destroy_ast_node_only(left_num);
-        destroy_ast_node_only(right_num);
-        return true;
+    // -(2) = -2, -0 = 0
+    if (is_node_num(operand)) {
+        *value = operand->number == 0 ? 0 : -operand->number;
+        return FOLD_NUMBER;
     }
+
+    // -(-x) = x
+    if (operand->type == AST_UNARY && operand->unary.unary == UNARY_MINUS) return FOLD_INNER;
+
+    return FOLD_NONE;
 }
 
-static bool calculate_constant(AstNode** parent_dp) {
-    // because simplify_expression is called recursively (bottom-up)
-    // the left and right node is expected to have already done constant calculation
-    // so what this function has to do is
-    // just calculate the constant from left and right
-    // also all sub will be replaced with add, no need to handle sub
-    // also all unary with number will be replaced with just a single number node
-
-    AstNode* parent = *parent_dp;
-    AstNode* left = parent->op.left;
-    AstNode* right = parent->op.right;
-    
-    bool is_changed = false;
 
-    if (parent->type == AST_OP) {
+AstNode* fold_op_node(Operator op, AstNode* left, AstNode* right) {
+    double value;
+
+    switch (fold_op(op, left, right, &value)) {
+    case FOLD_NUMBER:
+        destroy_ast_node(left);
+        destroy_ast_node(right);
+        return create_num_node(value);
+    case FOLD_LEFT:
+        destroy_ast_node(right);
+        return left;
+    case FOLD_RIGHT:
+        destroy_ast_node(left);
+        return right;
+    case FOLD_NEGATE:
+        destroy_ast_node(left);
+        return fold_unary_node(UNARY_MINUS, right);
+    default:
+        return create_op_node(op, left, right);
+    }
+}
 
-        if (parent->op.op == OP_POW) {
-            if (is_node_num(left) && is_node_num(right)) {
-                double l_num = left->number;
-                double r_num = right->number;
+AstNode* fold_func_node(Function func, AstNode* arg) {
+    double value;
 
-                *parent_dp = create_num_node(pow(l_num, r_num));
-                destroy_ast_node(parent);
-                // r_num == 0 will be handled by 'simplify_ast_node()' so don't worry
-                is_changed =  true;
-            }
-        }
+    if (fold_func(func, arg, &value) == FOLD_NUMBER) {
+        destroy_ast_node(arg);
+        return create_num_node(value);
+    }
+    return create_func_node(func, arg);
+}
 
-        if (parent->op.op == OP_DIV) {
-            if (is_node_num(right)) {
-                // calculate inversion
-                double r_num = right->number;
-                parent->op.op = OP_MUL;
-                right->number = 1.0 / r_num;
-                is_changed = true;
-            }
-        }
+AstNode* fold_unary_node(Unary unary, AstNode* operand) {
+    double value;
+    AstNode* result;
+
+    switch (fold_unary(unary, operand, &value)) {
+    case FOLD_NUMBER:
+        destroy_ast_node(operand);
+        return create_num_node(value);
+    case FOLD_LEFT:
+        return operand;
+    case FOLD_INNER:
+        result = operand->unary.operand;
+        destroy_ast_node_only(operand);
+        return result;
+    default:
+        return create_unary_node(unary, operand);
+    }
+}
 
-        if (parent->op.op == OP_SUB) {
-            if (is_node_num(right)) {
-                parent->op.op = OP_ADD;
-                right->number = -right->number;
-                is_changed = true;
-            }
-        }
 
-        if (parent->op.op == OP_ADD || parent->op.op == OP_MUL) {
-            is_changed =  calculate_operator(parent_dp);
-        }
-    } else if (parent->type == AST_FUNC) {
-        // calculate the function value
-        AstNode* arg = parent->func.arg;
-        if (is_node_num(arg)) {
-            int func_value;
-    
-            switch (parent->func.func) {
-            case FUNC_SIN:
-                func_value = sin(arg->number);
-                break;
-            case FUNC_COS:
-                func_value = cos(arg->number);
-                break;
-            case FUNC_TAN:
-                func_value = tan(arg->number);
-                break;
-            case FUNC_EXP:
-                func_value = exp(arg->number);
-                break;
-            case FUNC_LOG:
-                func_value = log10(arg->number);
-                break;
-            case FUNC_LN:
-                func_value = log(arg->number);
-                break;
-            case FUNC_INVALID:
-                break;
-            }
+// one rule applied at 'node' whose children are already simplified
+// return the replacement of 'node' or NULL if no rule matches
+// the local rules are the ones of the folding constructors
+
+static AstNode* rewrite_op(AstNode* node) {
+    Operator op = node->op.op;
+    AstNode* left = node->op.left;
+    AstNode* right = node->op.right;
+    if (left == NULL || right == NULL) return NULL;
 
-            destroy_ast_node(parent); // recursively
-            *parent_dp = create_num_node(func_value);
-            is_changed = true;
-        }    
+    double value;
+    switch (fold_op(op, left, right, &value)) {
+    case FOLD_NUMBER: return replace_with_num(node, value);
+    case FOLD_LEFT: return replace_node(node, left, right);
+    case FOLD_RIGHT: return replace_node(node, right, left);
+    case FOLD_NEGATE: return replace_node(node, create_unary_node(UNARY_MINUS, right), left);
+    default: break;
     }
 
-    return is_changed;
+    switch (op) {
+    case OP_ADD:
+        return collect_constants(node);
+
+    case OP_SUB:
+        // 2 - (x + 2) = 2 - x - 2, 2 - (x - 2) = 2 - x + 2
+        if (right->type == AST_OP && (right->op.op == OP_ADD || right->op.op == OP_SUB)) {
+            AstNode* result = create_op_node(right->op.op == OP_ADD ? OP_SUB : OP_ADD,
+                create_op_node(OP_SUB, left, right->op.left),
+                right->op.right
+            );
+            destroy_ast_node_only(right);
+            destroy_ast_node_only(node);
+            return result;
+        }
+        return NULL;
+
+    case OP_MUL:
+        // x * (1 / y) = x / y, (1 / y) * x = x / y
+        if (is_reciprocal(right)) return divide_by(node, left, right);
+        if (is_reciprocal(left)) return divide_by(node, right, left);
+        return collect_constants(node);
+
+    case OP_DIV:
+        return NULL;
+
+    case OP_POW:
+        // x ^ (-n) = 1 / x ^ n
+        if (is_node_num(right) && right->number < 0) {
+            AstNode* result = create_op_node(OP_DIV,
+                create_num_node(1),
+                create_op_node(OP_POW, left, create_num_node(-right->number))
+            );
+            return replace_node(node, result, right);
+        }
+        return NULL;
+    }
+
+    return NULL;
 }
 
+static AstNode* rewrite_func(AstNode* node) {
+    AstNode* arg = node->func.arg;
+    if (arg == NULL) return NULL;
 
+    // sin(0) = 0, ln(1) = 0, ...
+    double value;
+    if (fold_func(node->func.func, arg, &value) == FOLD_NUMBER) return replace_with_num(node, value);
 
-// simplify expression in bottom-up
-bool simplify_ast_node(AstNode** parent_dp) {
-    AstNode* parent = *parent_dp;
-    bool is_changed = false;
+    // ln(exp(x)) = x
+    if (node->func.func == FUNC_LN && arg->type == AST_FUNC && arg->func.func == FUNC_EXP) {
+        AstNode* result = arg->func.arg;
+        destroy_ast_node_only(arg);
+        destroy_ast_node_only(node);
+        return result;
+    }
 
+    // log(10 ^ x) = x
+    if (node->func.func == FUNC_LOG && arg->type == AST_OP && arg->op.op == OP_POW
+        && is_node_value_num(arg->op.left, 10)) {
+        AstNode* ten = arg->op.left;
+        AstNode* result = arg->op.right;
+        destroy_ast_node_only(arg);
+        destroy_ast_node(ten);
+        destroy_ast_node_only(node);
+        return result;
+    }
 
-    if (parent->type == AST_OP) {
-        Operator op = parent->op.op;
+    return NULL;
+}
+
+static AstNode* rewrite_unary(AstNode* node) {
+    AstNode* operand = node->unary.operand;
+    if (operand == NULL) return NULL;
+
+    // +x = x, -(2) = -2, -(-x) = x
+    double value;
+    AstNode* result;
+    switch (fold_unary(node->unary.unary, operand, &value)) {
+    case FOLD_NUMBER:
+        return replace_with_num(node, value);
+    case FOLD_LEFT:
+        return replace_node(node, operand, NULL);
+    case FOLD_INNER:
+        result = operand->unary.operand;
+        destroy_ast_node_only(operand);
+        destroy_ast_node_only(node);
+        return result;
+    default:
+        break;
+    }
+
+    if (operand->type != AST_OP) return NULL;
+
+    Operator op = operand->op.op;
+    AstNode* left = operand->op.left;
+    AstNode* right = operand->op.right;
+
+    AstNode* folded = NULL; // the number replaced by its opposite
+    if (op == OP_ADD || op == OP_SUB) {
+        // -(x + 2) = -x - 2, -(x - 2) = -x + 2
+        result = create_op_node(op == OP_ADD ? OP_SUB : OP_ADD, create_unary_node(UNARY_MINUS, left), right);
+    } else if ((op == OP_MUL || op == OP_DIV) && is_node_num(left)) {
+        // -(2 * x) = -2 * x
+        result = create_op_node(op, create_num_node(-left->number), right);
+        folded = left;
+    } else if ((op == OP_MUL || op == OP_DIV) && is_node_num(right)) {
+        result = create_op_node(op, left, create_num_node(-right->number));
+        folded = right;
+    } else {
+        return NULL;
+    }
 
-        AstNode* left = parent->op.left;
-        AstNode* right = parent->op.right;
+    // the operand first: a shared one gives back references to its children
+    destroy_ast_node_only(operand);
+    destroy_ast_node(folded);
+    destroy_ast_node_only(node);
+    return result;
+}
 
-        // bottom-up
-        if (simplify_ast_node(&parent->op.left)) is_changed = true;
-        if (simplify_ast_node(&parent->op.right)) is_changed = true;
 
+// a subtree being simplified, 'slot' is where its root is stored
+// (a child field of the parent, or the root of the tree)
+typedef struct {
+    AstNode** slot;
+    bool children_done;
+    AstNode* original; // the shared node this frame simplifies (retained), NULL if not shared
+} SimplifyFrame;
 
-        if (calculate_constant(parent_dp)) is_changed = true;
+#define LOCAL_STACK 64
 
-        if (op == OP_ADD) {
-            // 0+x -> x
-            if (is_node_value_num(left, 0)) {
-                destroy_ast_node_only(parent);
-                destroy_ast_node_only(left);
-                *parent_dp = right;
-                is_changed = true;
-            } else if (is_node_value_num(right, 0)) {
-                destroy_ast_node_only(parent);
-                destroy_ast_node_only(right);
-                *parent_dp = left;
-                is_changed = true;
-            }
-            
-        } else if (op == OP_SUB) {
-            if (is_node_value_num(left, 0)) {
-                // 0 - x -> -x
-                destroy_ast_node_only(parent);
-                destroy_ast_node_only(left);
-                *parent_dp = create_unary_node(UNARY_MINUS, right);
-                is_changed = true;
-            } else if (is_node_value_num(right, 0)) {
-                // x - 0
-                destroy_ast_node_only(parent);
-                destroy_ast_node_only(right);
-                *parent_dp = left;
-                is_changed = true;
-            }
-        } else if (op == OP_MUL) {
-
-            // 0 * x -> 0
-            if (is_node_value_num(left, 0)) {
-                destroy_ast_node_only(parent);
-                destroy_ast_node_only(right);
-                *parent_dp = left;
-                is_changed = true;
-            } else if (is_node_value_num(right, 0)) {
-                destroy_ast_node_only(parent);
-                destroy_ast_node_only(left);
-                *parent_dp = right;
-                is_changed = true;
-            } else if (is_node_value_num(left, 1)) {
-                // 1 * x -> x
-                destroy_ast_node_only(parent);
-                destroy_ast_node_only(left);
-                *parent_dp = right;
-                is_changed = true;
-            } else if (is_node_value_num(right, 1)) {
-                destroy_ast_node_only(parent);
-                destroy_ast_node_only(right);
-                *parent_dp = left;
-                is_changed = true;
-            }
-        } else if (op == OP_DIV) {
-            // x / 1 -> x
-            if (is_node_value_num(right, 1)) {
-                destroy_ast_node_only(parent);
-                destroy_ast_node_only(right);
-                *parent_dp = left;
-                is_changed = true;
+static bool is_shared(AstNode* node) {
+    return (node->flags & AST_FLAG_SHARED) || node->refs > 1;
+}
+
+// the frame is at its fixpoint: remember the result of its shared node
+// the memo holds a reference to both, so a freed original cannot come back at the same address
+static void finish_frame(PtrMap* memo, SimplifyFrame* frame) {
+    if (frame->original != NULL) ptrmap_put(memo, frame->original, retain_ast_node(*frame->slot));
+}
+
+// simplify a subtree to its fixpoint, return its new root
+// nodes marked AST_FLAG_SIMPLIFIED are already at their fixpoint and are skipped,
+// so after a rewrite only the newly built nodes are visited again
+// the caller's reference to 'node' is taken over by the result
+//
+// bottom-up with an explicit stack (no recursion: any depth):
+// a node is rewritten once its children are done, a rewritten node
+// stays on the stack and is visited again from its new root
+//
+// a shared node is copied before its children change (the copy is the one marked),
+// 'memo' (shared node -> its result) makes it simplified once per call,
+// the other parents take a reference to the same result
+static AstNode* simplify_node(AstNode* node, bool* is_changed) {
+    SimplifyFrame frames_local[LOCAL_STACK];
+    Stack frames;
+    STACK_INIT_LOCAL(&frames, SimplifyFrame, frames_local);
+    *(SimplifyFrame*) stack_push(&frames) = (SimplifyFrame) { &node, false, NULL };
+
+    PtrMap memo;
+    init_ptrmap(&memo);
+
+    while (!stack_empty(&frames)) {
+        SimplifyFrame* frame = (SimplifyFrame*) stack_top(&frames);
+        AstNode** slot = frame->slot;
+        AstNode* current = *slot;
+
+        if (!frame->children_done) {
+            if (current == NULL || (current->flags & AST_FLAG_SIMPLIFIED)
+                || current->type == AST_NUM || current->type == AST_VAR) { // nothing to rewrite
+                finish_frame(&memo, frame);
+                stack_pop(&frames);
+                continue;
             }
-        } else if (op == OP_POW) {
-            // x ^ 1 -> x
-            if (is_node_value_num(right, 1)) {
-                destroy_ast_node_only(parent);
-                destroy_ast_node_only(right);
-                *parent_dp = left;
-                is_changed = true;
-            } else if (is_node_value_num(right, 0)) {
-                // x ^ 0 -> 1 (including x = 0)
-                destroy_ast_node_only(parent);
-                destroy_ast_node_only(right);
-                destroy_ast_node(left);
-                *parent_dp = create_num_node(1);
-                is_changed = true;
-            } else if (is_node_value_num(left, 0)) {
-                // 0 ^ x -> 0 (if x->type = num: x->number > 0)
-                if (right->type != AST_OP || right->number > 0) {
-                    destroy_ast_node_only(parent);
-                    destroy_ast_node(left);
-                    *parent_dp = right;
-                    is_changed = true;
-                } else if (right->number < 0) {
-                    fprintf(stderr, "0 ^ (%lf) is invalid!\n", right->number);
-                    return false;
+
+            if (is_shared(current)) {
+                AstNode* known = (AstNode*) ptrmap_get(&memo, current);
+                if (known != NULL) {
+                    *slot = retain_ast_node(known);
+                    destroy_ast_node(current);
+                    finish_frame(&memo, frame);
+                    stack_pop(&frames);
+                    continue;
                 }
-            } else if (is_node_value_num(left, 1)) {
-                // 1 ^ x = 1
-                destroy_ast_node(parent);
-                destroy_ast_node(right);
-                *parent_dp = left;
-                is_changed = true;
-            }
-        }
-    } else if (parent->type == AST_UNARY) {
-        AstNode* operand = parent->unary.operand;
 
-        if (simplify_ast_node(&parent->unary.operand)) is_changed = true;
+                // after a rewrite the frame keeps the node it started from
+                if (frame->original == NULL) frame->original = retain_ast_node(current);
+            }
 
-        // if constasnt change to negative number
-        if (is_node_num(operand)) {
-            if (parent->unary.unary == UNARY_MINUS) {
-                destroy_ast_node_only(parent);
-                operand->number = -operand->number;
-                *parent_dp = operand;
+            // copy on write: the children are replaced in place
+            current = unshare_ast_node(current);
+            *slot = current;
+            frame->children_done = true;
+
+            // the right child is pushed first so the left one is done first
+            if (current->type == AST_OP) {
+                *(SimplifyFrame*) stack_push(&frames) = (SimplifyFrame) { &current->op.right, false, NULL };
+                *(SimplifyFrame*) stack_push(&frames) = (SimplifyFrame) { &current->op.left, false, NULL };
+            } else if (current->type == AST_FUNC) {
+                *(SimplifyFrame*) stack_push(&frames) = (SimplifyFrame) { &current->func.arg, false, NULL };
             } else {
-                destroy_ast_node_only(parent);
-                *parent_dp = operand;
+                *(SimplifyFrame*) stack_push(&frames) = (SimplifyFrame) { &current->unary.operand, false, NULL };
             }
+            continue;
+        }
 
-            is_changed = true;
-        } else if (operand->type == AST_OP) {
-            Operator operand_op = operand->op.op;
-            AstNode* left = operand->op.left;
-            AstNode* right = operand->op.right;
-
-            if (operand_op == OP_ADD) {
-                destroy_ast_node_only(parent);
-                *parent_dp = operand;
-                parent->op.op = OP_SUB;
-               
-                if (is_node_num(left)) {
-                    left->number = -left->number;
-                } else {
-                    operand->op.left = create_unary_node(UNARY_MINUS, left);
-                }
-                
-                is_changed = true;
-            } else if (operand_op == OP_SUB) {
-                destroy_ast_node_only(parent);
-                *parent_dp = operand;
-                parent->op.op = OP_ADD;
-
-                if (is_node_num(left)) {
-                    left->number = -left->number;
-                } else {
-                    operand->op.left = create_unary_node(UNARY_MINUS, left);
-                }
-                
-                is_changed = true;
-            } else if (operand_op == OP_MUL || operand_op == OP_DIV) {
-                if (is_node_num(left)) {
-                    destroy_ast_node_only(parent);
-                    *parent_dp = operand;
-                    left->number = -left->number;
-                    is_changed = true;
-                } else if (is_node_num(right)) {
-                    destroy_ast_node_only(parent);
-                    *parent_dp = operand;
-                    right->number = -right->number;
-                    is_changed = true;
-                }
-            }
-        } else if (operand->type == AST_UNARY) {
-            *parent_dp = operand->unary.operand;
-            destroy_ast_node_only(parent);
-            destroy_ast_node_only(operand);
-            is_changed = true;
+        AstNode* rewritten = NULL;
+        switch (current->type) {
+        case AST_OP:
+            rewritten = rewrite_op(current);
+            break;
+        case AST_FUNC:
+            rewritten = rewrite_func(current);
+            break;
+        case AST_UNARY:
+            rewritten = rewrite_unary(current);
+            break;
+        default:
+            break;
         }
-    } else if (parent->type == AST_FUNC) {
-        if (simplify_ast_node(&parent->func.arg)) is_changed = true;
 
-        if (calculate_constant(parent_dp)) is_changed = true;
+        if (rewritten == NULL) {
+            current->flags |= AST_FLAG_SIMPLIFIED;
+            finish_frame(&memo, frame);
+            stack_pop(&frames);
+        } else {
+            *slot = rewritten;
+            *is_changed = true;
+            frame->children_done = false; // again from the new root
+        }
     }
 
-    printf("\n");
-    print_ast_node(*parent_dp, 0);
+    for (size_t i = 0; i < memo.capacity; i++) {
+        if (memo.keys[i] == NULL) continue;
+        destroy_ast_node((AstNode*) memo.keys[i]);
+        destroy_ast_node((AstNode*) memo.values[i]);
+    }
+    free_ptrmap(&memo);
+    free_stack(&frames);
+    return node;
+}
 
+bool simplify_ast_node(AstNode** tree) {
+    bool is_changed = false;
+    if (*tree != NULL) *tree = simplify_node(*tree, &is_changed);
     return is_changed;
 }
-
-
-
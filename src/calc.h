@@ -8,24 +8,67 @@
 /*
 simplify rule:
 x + 0 = x, x * 1 = x, x - 0 = x, 0 - x = -x, x / 1 = x
-x * 0 = 0, x ^ 1 = x, x ^ 0 = 1
-0 ^ x = 0 (x>0), 0 ^ 0 = 1, 0 ^ x (x<0 num) = error, 1 ^ x = 1
+x * 0 = 0, 0 / x = 0, x ^ 1 = x, x ^ 0 = 1
+0 ^ x = 0 (x>0), 0 ^ 0 = 1, 0 ^ x (x<0 num) = error (kept), 1 ^ x = 1
 x^(-n) = 1 / x^n
-2 + 3 = 5 (constant calculation)
-ln(e^x) = x, log(10^x) = x
--(-x) = x, -0 = 0, -(x+2) = -x-2
+2 + 3 = 5 (constant calculation, only when the result is exact: 1 / 3 and 0.1 + 0.2 stay)
+2 + (x + 3) = 5 + x, 2 * (x * 3) = 6 * x
+ln(exp(x)) = x, log(10^x) = x
+sin(0) = 0, cos(0) = 1, tan(0) = 0, ln(1) = 0, log(1) = 0, exp(0) = 1
+-(-x) = x, -0 = 0, -(x+2) = -x-2, -(2 * x) = -2 * x
 2-(x+2) = 2 - x - 2
 
--> simplify mutliple times until doesn't change
-
+-> one call reaches the fixpoint (a second call returns false).
+simplified subtrees are marked with AST_FLAG_SIMPLIFIED and never visited again,
+so after a rewrite only the new nodes are revisited: close to O(n) per call,
+and simplifying a tree built around simplified parts (clone_ast_node keeps
+the mark) only walks the new parts.
+
+the tree is rewritten in place: replaced nodes are destroyed, '*tree' may change.
+only the nodes '*tree' holds alone are changed, shared ones (retain_ast_node)
+and interned ones (hashcons.h) are copied on write: the other users of a
+shared subtree never see the change. the result may still point to unchanged
+interned nodes, so their store must outlive it.
 */
 
 
 
 
 
+// return true if the tree has changed
 bool simplify_ast_node(AstNode** tree);
 
+// a op b in *result, only when the result is exact (no rounding) and finite (1 / 3, 0.1 + 0.2 and 2 ^ -1 fail)
+bool calculate_constant(Operator op, double a, double b, double* result);
+
+
+/*
+folding constructors:
+the local rules above (identity, zero, one, constants, -(-x) = x) applied
+while a node is built, so the trivial node is never allocated.
+    fold_op_node(OP_MUL, create_num_node(0), cos) -> 0
+    fold_op_node(OP_MUL, x, create_num_node(1)) -> x
+same ownership as create_*: the children are taken and the discarded ones are destroyed
+*/
+
+typedef enum {
+    FOLD_NONE, // no rule: the node is built as it is
+    FOLD_NUMBER, // the node is the number *value
+    FOLD_LEFT, // the node is its left operand (the operand of +x)
+    FOLD_RIGHT, // the node is its right operand
+    FOLD_NEGATE, // the node is -(right operand): 0 - x
+    FOLD_INNER // the node is the operand of its operand: -(-x)
+} FoldResult;
+
+// what the node would fold to, nothing is built or destroyed
+FoldResult fold_op(Operator op, AstNode* left, AstNode* right, double* value);
+FoldResult fold_func(Function func, AstNode* arg, double* value);
+FoldResult fold_unary(Unary unary, AstNode* operand, double* value);
+
+AstNode* fold_op_node(Operator op, AstNode* left, AstNode* right);
+AstNode* fold_func_node(Function func, AstNode* arg);
+AstNode* fold_unary_node(Unary unary, AstNode* operand);
+
 
 
 
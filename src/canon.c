@@ -0,0 +1,737 @@
+#include "canon.h"
+
+#include "ast.h"
+#include "arena.h"
+#include "ptrmap.h"
+#include "stack.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// declaration order = sort order of the kinds
+typedef enum {
+    CANON_NUM, CANON_VAR, CANON_POW, CANON_FUNC, CANON_SUM, CANON_PRODUCT
+} CanonType;
+
+typedef struct Canon Canon;
+
+typedef struct {
+    double scalar; // SUM: coefficient of 'node', PRODUCT: exponent of 'node'
+    Canon* node;
+} CanonTerm;
+
+/*
+invariants (so that equal expressions have the same structure):
+SUM: number + sum of scalar * node, at least one term, nodes are neither numbers,
+     sums nor products with a coefficient != 1, sorted by 'compare_monomial', scalars != 0
+PRODUCT: number * product of node ^ scalar, number != 0, nodes are not numbers nor products
+         (except a product raised to a non integer power), sorted by 'compare_canon', scalars != 0,
+         never a single node ^ 1 with number 1, never number * sum
+POW: base ^ exponent for an exponent that is not a number
+*/
+struct Canon {
+    CanonType type;
+    double number; // NUM: value, SUM: constant term, PRODUCT: coefficient
+    Function func; // FUNC
+    Canon* base; // FUNC: argument, POW: base
+    Canon* exponent; // POW
+    CanonTerm* terms; // SUM, PRODUCT
+    int count;
+};
+
+typedef struct {
+    Arena* arena; // every Canon lives here, freed at the end of canonicalize_ast
+    PtrMap memo; // AstNode -> Canon (input DAGs are canonicalized once per node)
+    PtrMap uses; // AstNode -> parents in the input (count_ast_uses)
+} Canonicalizer;
+
+
+static Canon* new_canon(Canonicalizer* cz, CanonType type) {
+    Canon* c = (Canon*) arena_alloc(cz->arena, sizeof(Canon));
+    c->type = type;
+    c->number = 0;
+    c->func = FUNC_INVALID;
+    c->base = NULL;
+    c->exponent = NULL;
+    c->terms = NULL;
+    c->count = 0;
+    return c;
+}
+
+static CanonTerm* new_terms(Canonicalizer* cz, int count) {
+    return (CanonTerm*) arena_alloc(cz->arena, (count > 0 ? count : 1) * sizeof(CanonTerm));
+}
+
+static Canon* canon_num(Canonicalizer* cz, double value) {
+    Canon* c = new_canon(cz, CANON_NUM);
+    c->number = value;
+    return c;
+}
+
+static bool is_integer(double value) {
+    return isfinite(value) && value == floor(value);
+}
+
+static int compare_number(double a, double b) {
+    return a < b ? -1 : a > b ? 1 : 0;
+}
+
+
+static int compare_canon(Canon* a, Canon* b);
+
+static int compare_term_lists(const CanonTerm* a, int na, const CanonTerm* b, int nb) {
+    for (int i = 0; i < na && i < nb; i++) {
+        int cmp = compare_canon(a[i].node, b[i].node);
+        if (cmp != 0) return cmp;
+        cmp = compare_number(a[i].scalar, b[i].scalar);
+        if (cmp != 0) return cmp;
+    }
+    return na - nb;
+}
+
+// total order on canonical nodes, 0 = structurally equal
+static int compare_canon(Canon* a, Canon* b) {
+    if (a == b) return 0;
+    if (a->type != b->type) return (int) a->type - (int) b->type;
+
+    int cmp;
+    switch (a->type) {
+    case CANON_NUM:
+        return compare_number(a->number, b->number);
+    case CANON_VAR:
+        return 0;
+    case CANON_POW:
+        cmp = compare_canon(a->base, b->base);
+        return cmp != 0 ? cmp : compare_canon(a->exponent, b->exponent);
+    case CANON_FUNC:
+        if (a->func != b->func) return (int) a->func - (int) b->func;
+        return compare_canon(a->base, b->base);
+    case CANON_SUM:
+    case CANON_PRODUCT:
+        cmp = compare_term_lists(a->terms, a->count, b->terms, b->count);
+        return cmp != 0 ? cmp : compare_number(a->number, b->number);
+    }
+    return 0;
+}
+
+// order of the terms of a sum: factor by factor, higher powers first
+// (x ^ 3 + x ^ 2 + x, x ^ 2 * cos(x) + x * sin(x))
+static int compare_monomial(Canon* a, Canon* b) {
+    CanonTerm single_a = { 1, a }, single_b = { 1, b };
+    const CanonTerm* fa = a->type == CANON_PRODUCT ? a->terms : &single_a;
+    const CanonTerm* fb = b->type == CANON_PRODUCT ? b->terms : &single_b;
+    int na = a->type == CANON_PRODUCT ? a->count : 1;
+    int nb = b->type == CANON_PRODUCT ? b->count : 1;
+
+    for (int i = 0; i < na && i < nb; i++) {
+        int cmp = compare_canon(fa[i].node, fb[i].node);
+        if (cmp != 0) return cmp;
+        cmp = compare_number(fb[i].scalar, fa[i].scalar);
+        if (cmp != 0) return cmp;
+    }
+    return na - nb;
+}
+
+// stable merge sort of terms[0..count) by node
+// equal nodes keep their order, so their scalars add up left to right
+static void sort_terms(Canonicalizer* cz, CanonTerm* terms, int count, int (*compare)(Canon*, Canon*)) {
+    CanonTerm* from = terms;
+    CanonTerm* to = new_terms(cz, count);
+
+    for (int width = 1; width < count; width *= 2) {
+        for (int low = 0; low < count; low += 2 * width) {
+            int middle = low + width < count ? low + width : count;
+            int high = low + 2 * width < count ? low + 2 * width : count;
+            int i = low, j = middle, n = low;
+
+            while (i < middle || j < high) {
+                if (j == high || (i < middle && compare(from[i].node, from[j].node) <= 0)) {
+                    to[n++] = from[i++];
+                } else {
+                    to[n++] = from[j++];
+                }
+            }
+        }
+
+        CanonTerm* swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != terms) memcpy(terms, from, count * sizeof(CanonTerm));
+}
+
+// equal nodes of a sorted list add their scalars (zeros dropped), in place
+// return the new length
+static int combine_terms(CanonTerm* terms, int count, int (*compare)(Canon*, Canon*)) {
+    int n = 0;
+
+    for (int i = 0; i < count;) {
+        CanonTerm term = terms[i++];
+        while (i < count && compare(term.node, terms[i].node) == 0) term.scalar += terms[i++].scalar;
+        if (term.scalar != 0) terms[n++] = term;
+    }
+
+    return n;
+}
+
+
+static Canon* make_product(Canonicalizer* cz, double coeff, CanonTerm* factors, int count);
+
+static Canon* make_sum(Canonicalizer* cz, double constant, CanonTerm* terms, int count) {
+    if (count == 0) return canon_num(cz, constant);
+    if (count == 1 && constant == 0) {
+        // coeff * monomial
+        Canon* mono = terms[0].node;
+        if (mono->type == CANON_PRODUCT) return make_product(cz, terms[0].scalar, mono->terms, mono->count);
+
+        CanonTerm* factor = new_terms(cz, 1);
+        factor->scalar = 1;
+        factor->node = mono;
+        return make_product(cz, terms[0].scalar, factor, 1);
+    }
+
+    Canon* c = new_canon(cz, CANON_SUM);
+    c->number = constant;
+    c->terms = terms;
+    c->count = count;
+    return c;
+}
+
+// scalar * sum, distributed
+static Canon* scale_sum(Canonicalizer* cz, Canon* sum, double scalar) {
+    if (scalar == 0) return canon_num(cz, 0);
+
+    CanonTerm* terms = new_terms(cz, sum->count);
+    for (int i = 0; i < sum->count; i++) {
+        terms[i].scalar = sum->terms[i].scalar * scalar;
+        terms[i].node = sum->terms[i].node;
+    }
+    return make_sum(cz, sum->number * scalar, terms, sum->count);
+}
+
+static Canon* make_product(Canonicalizer* cz, double coeff, CanonTerm* factors, int count) {
+    if (coeff == 0 || count == 0) return canon_num(cz, coeff);
+
+    if (count == 1 && factors[0].scalar == 1) {
+        if (factors[0].node->type == CANON_SUM) return scale_sum(cz, factors[0].node, coeff);
+        if (coeff == 1) return factors[0].node;
+    }
+
+    Canon* c = new_canon(cz, CANON_PRODUCT);
+    c->number = coeff;
+    c->terms = factors;
+    c->count = count;
+    return c;
+}
+
+// c = constant + sum of terms
+static void split_sum(Canonicalizer* cz, Canon* c, double* constant, CanonTerm** terms, int* count) {
+    if (c->type == CANON_NUM) {
+        *constant = c->number;
+        *terms = NULL;
+        *count = 0;
+    } else if (c->type == CANON_SUM) {
+        *constant = c->number;
+        *terms = c->terms;
+        *count = c->count;
+    } else {
+        // one term: coeff * monomial
+        CanonTerm* term = new_terms(cz, 1);
+        term->scalar = 1;
+        term->node = c;
+
+        if (c->type == CANON_PRODUCT && c->number != 1) {
+            term->scalar = c->number;
+            term->node = make_product(cz, 1, c->terms, c->count);
+        }
+
+        *constant = 0;
+        *terms = term;
+        *count = 1;
+    }
+}
+
+// c = coeff * product of factors (c is not a number)
+static void split_product(Canonicalizer* cz, Canon* c, double* coeff, CanonTerm** factors, int* count) {
+    if (c->type == CANON_PRODUCT) {
+        *coeff = c->number;
+        *factors = c->terms;
+        *count = c->count;
+    } else {
+        CanonTerm* factor = new_terms(cz, 1);
+        factor->scalar = 1;
+        factor->node = c;
+
+        *coeff = 1;
+        *factors = factor;
+        *count = 1;
+    }
+}
+
+
+// sum of n operands: all their terms in one list, sorted and merged once
+static Canon* canon_add_all(Canonicalizer* cz, Canon** operands, int count) {
+    int total = 0;
+    for (int i = 0; i < count; i++) {
+        total += operands[i]->type == CANON_NUM ? 0 : operands[i]->type == CANON_SUM ? operands[i]->count : 1;
+    }
+
+    CanonTerm* terms = new_terms(cz, total);
+    double constant = 0;
+    int n = 0;
+
+    for (int i = 0; i < count; i++) {
+        double c;
+        CanonTerm* t;
+        int k;
+        split_sum(cz, operands[i], &c, &t, &k);
+
+        constant += c;
+        if (k > 0) memcpy(terms + n, t, k * sizeof(CanonTerm)); // t = NULL for a number
+        n += k;
+    }
+
+    sort_terms(cz, terms, n, compare_monomial);
+    return make_sum(cz, constant, terms, combine_terms(terms, n, compare_monomial));
+}
+
+static Canon* canon_scale(Canonicalizer* cz, Canon* c, double scalar) {
+    switch (c->type) {
+    case CANON_NUM:
+        return canon_num(cz, c->number * scalar);
+    case CANON_SUM:
+        return scale_sum(cz, c, scalar);
+    case CANON_PRODUCT:
+        return make_product(cz, c->number * scalar, c->terms, c->count);
+    default: {
+        CanonTerm* factor = new_terms(cz, 1);
+        factor->scalar = 1;
+        factor->node = c;
+        return make_product(cz, scalar, factor, 1);
+    }
+    }
+}
+
+// product of n operands: the numbers make the coefficient,
+// the factors of the others go in one list, sorted and merged once
+static Canon* canon_mul_all(Canonicalizer* cz, Canon** operands, int count) {
+    int total = 0;
+    for (int i = 0; i < count; i++) {
+        total += operands[i]->type == CANON_NUM ? 0 : operands[i]->type == CANON_PRODUCT ? operands[i]->count : 1;
+    }
+
+    CanonTerm* factors = new_terms(cz, total);
+    double coeff = 1;
+    int n = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (operands[i]->type == CANON_NUM) {
+            coeff *= operands[i]->number;
+            continue;
+        }
+
+        double c;
+        CanonTerm* f;
+        int k;
+        split_product(cz, operands[i], &c, &f, &k);
+
+        coeff *= c;
+        memcpy(factors + n, f, k * sizeof(CanonTerm));
+        n += k;
+    }
+
+    sort_terms(cz, factors, n, compare_canon);
+    return make_product(cz, coeff, factors, combine_terms(factors, n, compare_canon));
+}
+
+static Canon* canon_pow(Canonicalizer* cz, Canon* a, Canon* b) {
+    if (b->type != CANON_NUM) {
+        Canon* c = new_canon(cz, CANON_POW);
+        c->base = a;
+        c->exponent = b;
+        return c;
+    }
+
+    double r = b->number;
+    if (a->type == CANON_NUM) return canon_num(cz, pow(a->number, r));
+    if (r == 0) return canon_num(cz, 1);
+    if (r == 1) return a;
+
+    CanonTerm* factors;
+    if (a->type == CANON_PRODUCT && is_integer(r)) {
+        // (c * x^p * ...)^r = c^r * x^(p*r) * ...
+        factors = new_terms(cz, a->count);
+        for (int i = 0; i < a->count; i++) {
+            factors[i].scalar = a->terms[i].scalar * r;
+            factors[i].node = a->terms[i].node;
+        }
+        return make_product(cz, pow(a->number, r), factors, a->count);
+    }
+
+    factors = new_terms(cz, 1);
+    factors->scalar = r;
+    factors->node = a;
+    return make_product(cz, 1, factors, 1);
+}
+
+// functions of numbers stay symbolic (ln(10) is exact, 2.302585093 is not)
+static Canon* canon_func(Canonicalizer* cz, Function func, Canon* arg) {
+    Canon* c = new_canon(cz, CANON_FUNC);
+    c->func = func;
+    c->base = arg;
+    return c;
+}
+
+
+// an operand of a run, 'inverse': subtracted (in a sum) or divided by (in a product)
+typedef struct {
+    AstNode* node;
+    bool inverse;
+} RunOperand;
+
+static bool is_sum_op(AstNode* node) {
+    return node->type == AST_OP && (node->op.op == OP_ADD || node->op.op == OP_SUB);
+}
+
+static bool is_product_op(AstNode* node) {
+    return node->type == AST_OP && (node->op.op == OP_MUL || node->op.op == OP_DIV);
+}
+
+// operands of the run of + and - (or of * and /) under 'root' pushed on 'operands', left to right
+//     a - (b + c) - d -> a, -b, -c, -d    a / (b * c) -> a, 1 / b, 1 / c
+// the run only goes through nodes used once: a shared subtree is one operand,
+// so it is canonicalized once whatever the number of its parents
+static int collect_run(Canonicalizer* cz, AstNode* root, Stack* pending, Stack* operands) {
+    bool (*in_run)(AstNode*) = is_sum_op(root) ? is_sum_op : is_product_op;
+    int count = 0;
+
+    *(RunOperand*) stack_push(pending) = (RunOperand) { root, false };
+    while (!stack_empty(pending)) {
+        RunOperand operand = *(RunOperand*) stack_pop(pending);
+        AstNode* node = operand.node;
+
+        bool expand = node == root || (node != NULL && in_run(node)
+            && (intptr_t) ptrmap_get(&cz->uses, node) == 1);
+
+        if (expand) {
+            bool right_inverse = node->op.op == OP_SUB || node->op.op == OP_DIV;
+            *(RunOperand*) stack_push(pending) = (RunOperand) { node->op.right, operand.inverse != right_inverse };
+            *(RunOperand*) stack_push(pending) = (RunOperand) { node->op.left, operand.inverse };
+        } else {
+            *(RunOperand*) stack_push(operands) = operand;
+            count++;
+        }
+    }
+
+    return count;
+}
+
+// applied to an operand once it is canonical (the memo keeps it as it is)
+typedef enum {
+    INVERT_NONE, INVERT_NEGATE, INVERT_RECIPROCAL
+} Invert;
+
+// a node waiting for the canonical forms of its operands
+typedef struct {
+    AstNode* node;
+    bool children_done;
+    int count; // operands on 'done' once they are canonical
+    Invert invert;
+} CanonFrame;
+
+#define LOCAL_STACK 64
+
+static Canon* invert_canon(Canonicalizer* cz, Canon* c, Invert invert) {
+    switch (invert) {
+    case INVERT_NEGATE: return canon_scale(cz, c, -1);
+    case INVERT_RECIPROCAL: return canon_pow(cz, c, canon_num(cz, -1));
+    default: return c;
+    }
+}
+
+// postorder with an explicit stack (no recursion: any depth)
+// a run of + and - (or * and /) is one frame whose operands are all the nodes under it,
+// merged at once (a left-folded chain is not merged level by level)
+static Canon* canonicalize_node(Canonicalizer* cz, AstNode* tree) {
+    CanonFrame frames_local[LOCAL_STACK];
+    Canon* done_local[LOCAL_STACK];
+    RunOperand pending_local[LOCAL_STACK];
+    RunOperand operands_local[LOCAL_STACK];
+    Stack frames, done, pending, operands;
+    STACK_INIT_LOCAL(&frames, CanonFrame, frames_local);
+    STACK_INIT_LOCAL(&done, Canon*, done_local);
+    STACK_INIT_LOCAL(&pending, RunOperand, pending_local);
+    STACK_INIT_LOCAL(&operands, RunOperand, operands_local);
+
+    *(CanonFrame*) stack_push(&frames) = (CanonFrame) { tree, false, 0, INVERT_NONE };
+
+    while (!stack_empty(&frames)) {
+        CanonFrame* frame = (CanonFrame*) stack_top(&frames);
+        AstNode* node = frame->node;
+
+        if (!frame->children_done) {
+            Canon* memo = node != NULL ? (Canon*) ptrmap_get(&cz->memo, node) : NULL;
+
+            if (node == NULL || memo != NULL || node->type == AST_NUM || node->type == AST_VAR) {
+                Canon* c = memo;
+                if (node == NULL) {
+                    c = canon_num(cz, NAN);
+                } else if (memo == NULL) {
+                    c = node->type == AST_NUM ? canon_num(cz, node->number) : new_canon(cz, CANON_VAR);
+                    ptrmap_put(&cz->memo, node, c);
+                }
+
+                CanonFrame finished = *(CanonFrame*) stack_pop(&frames);
+                *(Canon**) stack_push(&done) = invert_canon(cz, c, finished.invert);
+                continue;
+            }
+
+            frame->children_done = true;
+
+            int count;
+            Invert invert = INVERT_NONE;
+            if (is_sum_op(node) || is_product_op(node)) {
+                count = collect_run(cz, node, &pending, &operands);
+                invert = is_sum_op(node) ? INVERT_NEGATE : INVERT_RECIPROCAL;
+            } else {
+                count = node->type == AST_OP ? 2 : 1;
+                if (node->type == AST_OP) *(RunOperand*) stack_push(&operands) = (RunOperand) { node->op.left, false };
+                *(RunOperand*) stack_push(&operands) = (RunOperand) {
+                    node->type == AST_OP ? node->op.right
+                        : node->type == AST_FUNC ? node->func.arg : node->unary.operand,
+                    false
+                };
+            }
+            frame->count = count;
+
+            // the last operand is pushed first so the first one is done first
+            for (int i = 0; i < count; i++) {
+                RunOperand operand = *(RunOperand*) stack_pop(&operands);
+                *(CanonFrame*) stack_push(&frames) = (CanonFrame) {
+                    operand.node, false, 0, operand.inverse ? invert : INVERT_NONE
+                };
+            }
+            continue;
+        }
+
+        CanonFrame finished = *(CanonFrame*) stack_pop(&frames);
+        Canon** results = (Canon**) stack_top(&done) - (finished.count - 1);
+        Canon* c;
+
+        if (is_sum_op(node)) {
+            c = canon_add_all(cz, results, finished.count);
+        } else if (is_product_op(node)) {
+            c = canon_mul_all(cz, results, finished.count);
+        } else if (node->type == AST_OP) {
+            c = canon_pow(cz, results[0], results[1]);
+        } else if (node->type == AST_FUNC) {
+            c = canon_func(cz, node->func.func, results[0]);
+        } else {
+            c = node->unary.unary == UNARY_MINUS ? canon_scale(cz, results[0], -1) : results[0];
+        }
+
+        done.size -= finished.count;
+        ptrmap_put(&cz->memo, node, c);
+        *(Canon**) stack_push(&done) = invert_canon(cz, c, finished.invert);
+    }
+
+    Canon* c = *(Canon**) stack_pop(&done);
+    free_stack(&frames);
+    free_stack(&done);
+    free_stack(&pending);
+    free_stack(&operands);
+    return c;
+}
+
+
+// factor ^ power (power > 0), 'node' is the factor already converted
+static AstNode* factor_to_ast(AstNode* node, double power) {
+    if (power == 1) return node;
+    return create_op_node(OP_POW, node, create_num_node(power));
+}
+
+static AstNode* multiply_ast(AstNode* product, AstNode* factor) {
+    return product == NULL ? factor : create_op_node(OP_MUL, product, factor);
+}
+
+// |coeff| * numerator factors / denominator factors, the sign is left to the caller
+// built[i]: factors[i].node already converted
+static AstNode* product_to_ast(double coeff, const CanonTerm* factors, int count, AstNode** built) {
+    AstNode* numerator = NULL;
+    AstNode* denominator = NULL;
+
+    if (fabs(coeff) != 1) numerator = create_num_node(fabs(coeff));
+
+    for (int i = 0; i < count; i++) {
+        if (factors[i].scalar > 0) {
+            numerator = multiply_ast(numerator, factor_to_ast(built[i], factors[i].scalar));
+        } else {
+            denominator = multiply_ast(denominator, factor_to_ast(built[i], -factors[i].scalar));
+        }
+    }
+
+    if (numerator == NULL) numerator = create_num_node(1);
+    if (denominator == NULL) return numerator;
+    return create_op_node(OP_DIV, numerator, denominator);
+}
+
+// c without its sign, '*negative' tells if it was negative
+// built: the nodes below c already converted, in the order of 'push_canon_children'
+static AstNode* magnitude_to_ast(Canon* c, AstNode** built, bool* negative) {
+    *negative = false;
+
+    switch (c->type) {
+    case CANON_NUM:
+        *negative = c->number < 0;
+        return create_num_node(fabs(c->number));
+    case CANON_VAR:
+        return create_var_node();
+    case CANON_POW:
+        return create_op_node(OP_POW, built[0], built[1]);
+    case CANON_FUNC:
+        return create_func_node(c->func, built[0]);
+    case CANON_PRODUCT:
+        *negative = c->number < 0;
+        return product_to_ast(c->number, c->terms, c->count, built);
+    case CANON_SUM: {
+        // terms in order, then the constant: a - b + c + 2
+        AstNode* sum = NULL;
+
+        for (int i = 0; i <= c->count; i++) {
+            AstNode* term;
+            bool term_negative;
+
+            if (i < c->count) {
+                Canon* mono = c->terms[i].node;
+                double coeff = c->terms[i].scalar;
+                term_negative = coeff < 0;
+
+                if (mono->type == CANON_PRODUCT) {
+                    term = product_to_ast(coeff, mono->terms, mono->count, built);
+                    built += mono->count;
+                } else {
+                    CanonTerm factor = { 1, mono };
+                    term = product_to_ast(coeff, &factor, 1, built);
+                    built++;
+                }
+            } else {
+                if (c->number == 0) break;
+                term_negative = c->number < 0;
+                term = create_num_node(fabs(c->number));
+            }
+
+            if (sum == NULL) {
+                sum = term_negative ? create_unary_node(UNARY_MINUS, term) : term;
+            } else {
+                sum = create_op_node(term_negative ? OP_SUB : OP_ADD, sum, term);
+            }
+        }
+        return sum;
+    }
+    }
+
+    return NULL;
+}
+
+typedef struct {
+    Canon* c;
+    bool children_done;
+    int count; // nodes on 'done' once they are converted
+} ToAstFrame;
+
+// push the nodes 'magnitude_to_ast' uses, the last one first, return how many
+static int push_canon_children(Stack* frames, Canon* c) {
+    int count = 0;
+
+    switch (c->type) {
+    case CANON_POW:
+        *(ToAstFrame*) stack_push(frames) = (ToAstFrame) { c->exponent, false, 0 };
+        *(ToAstFrame*) stack_push(frames) = (ToAstFrame) { c->base, false, 0 };
+        return 2;
+    case CANON_FUNC:
+        *(ToAstFrame*) stack_push(frames) = (ToAstFrame) { c->base, false, 0 };
+        return 1;
+    case CANON_PRODUCT:
+        for (int i = c->count - 1; i >= 0; i--) {
+            *(ToAstFrame*) stack_push(frames) = (ToAstFrame) { c->terms[i].node, false, 0 };
+        }
+        return c->count;
+    case CANON_SUM:
+        // the factors of every monomial
+        for (int i = c->count - 1; i >= 0; i--) {
+            Canon* mono = c->terms[i].node;
+            if (mono->type == CANON_PRODUCT) {
+                for (int j = mono->count - 1; j >= 0; j--) {
+                    *(ToAstFrame*) stack_push(frames) = (ToAstFrame) { mono->terms[j].node, false, 0 };
+                }
+                count += mono->count;
+            } else {
+                *(ToAstFrame*) stack_push(frames) = (ToAstFrame) { mono, false, 0 };
+                count++;
+            }
+        }
+        return count;
+    default:
+        return 0;
+    }
+}
+
+// the children of a canonical node are converted before it, on an explicit stack like above
+static AstNode* canon_to_ast(Canon* c) {
+    ToAstFrame frames_local[LOCAL_STACK];
+    AstNode* done_local[LOCAL_STACK];
+    Stack frames, done;
+    STACK_INIT_LOCAL(&frames, ToAstFrame, frames_local);
+    STACK_INIT_LOCAL(&done, AstNode*, done_local);
+
+    *(ToAstFrame*) stack_push(&frames) = (ToAstFrame) { c, false, 0 };
+
+    while (!stack_empty(&frames)) {
+        ToAstFrame* frame = (ToAstFrame*) stack_top(&frames);
+
+        if (!frame->children_done) {
+            frame->children_done = true;
+            size_t parent = frames.size - 1; // 'frame' moves if the stack grows
+            int count = push_canon_children(&frames, frame->c);
+            ((ToAstFrame*) frames.data)[parent].count = count;
+            continue;
+        }
+
+        ToAstFrame finished = *(ToAstFrame*) stack_pop(&frames);
+        AstNode** built = finished.count > 0 ? (AstNode**) stack_top(&done) - (finished.count - 1) : NULL;
+
+        bool negative;
+        AstNode* node = magnitude_to_ast(finished.c, built, &negative);
+        if (negative) node = create_unary_node(UNARY_MINUS, node);
+
+        done.size -= finished.count;
+        *(AstNode**) stack_push(&done) = node;
+    }
+
+    AstNode* node = *(AstNode**) stack_pop(&done);
+    free_stack(&frames);
+    free_stack(&done);
+    return node;
+}
+
+
+AstNode* canonicalize_ast(AstNode* tree) {
+    if (tree == NULL) return NULL;
+
+    Canonicalizer cz;
+    cz.arena = create_arena(0);
+    init_ptrmap(&cz.memo);
+    init_ptrmap(&cz.uses);
+    count_ast_uses(tree, &cz.uses);
+
+    AstNode* result = canon_to_ast(canonicalize_node(&cz, tree));
+
+    free_ptrmap(&cz.memo);
+    free_ptrmap(&cz.uses);
+    destroy_arena(cz.arena);
+    return result;
+}
@@ -0,0 +1,24 @@
+#ifndef __CANON_H__
+#define __CANON_H__
+
+#include "ast.h"
+
+/*
+canonical form:
+sums and products are flattened to n-ary lists with sorted operands,
+numbers are folded into one constant term per sum and one coefficient per product,
+equal factors merge their exponents and like terms merge their coefficients
+    x*x*3*x -> 3 * x ^ 3
+    sin(x) * 2 * x ^ 1 * 1 + cos(x) * 1 * x ^ 2 -> x ^ 2 * cos(x) + 2 * x * sin(x)
+a number times a sum is distributed, other products of sums are not expanded.
+functions of numbers are kept as they are (ln(10) stays exact).
+
+the algebra assumes the usual identities hold (x / x = 1, x * 0 = 0),
+like simplify_ast_node does.
+*/
+
+// canonical form of the tree as a new tree (allocated like create_*)
+// 'tree' is only read: it may be a DAG (derivative_nth) and is not destroyed
+AstNode* canonicalize_ast(AstNode* tree);
+
+#endif
@@ -0,0 +1,132 @@
+#include "cse.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "stack.h"
+
+
+// numbers and x are cheaper to repeat than to name
+static bool is_leaf(AstNode* node) {
+    return node->type == AST_NUM || node->type == AST_VAR;
+}
+
+static void push_temp(Cse* cse, AstNode* node, int* capacity) {
+    if (cse->temp_count == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 16;
+        cse->temps = (AstNode**) realloc(cse->temps, *capacity * sizeof(AstNode*));
+    }
+
+    cse->temps[cse->temp_count++] = node;
+    ptrmap_put(&cse->names, node, (void*) (intptr_t) cse->temp_count);
+}
+
+typedef struct {
+    AstNode* node;
+    bool children_done;
+} TempFrame;
+
+#define LOCAL_STACK 64
+
+// postorder: the temporaries a node uses are numbered before it
+// (explicit stack, no recursion: any depth)
+static void collect_temps(Cse* cse, PtrMap* uses, int* capacity) {
+    TempFrame frames_local[LOCAL_STACK];
+    Stack frames;
+    STACK_INIT_LOCAL(&frames, TempFrame, frames_local);
+
+    PtrMap visited;
+    init_ptrmap(&visited);
+
+    *(TempFrame*) stack_push(&frames) = (TempFrame) { cse->root, false };
+
+    while (!stack_empty(&frames)) {
+        TempFrame* frame = (TempFrame*) stack_top(&frames);
+        AstNode* node = frame->node;
+
+        if (!frame->children_done) {
+            if (node == NULL || ptrmap_get(&visited, node) != NULL) {
+                stack_pop(&frames);
+                continue;
+            }
+            ptrmap_put(&visited, node, node);
+            frame->children_done = true;
+
+            // the right child is pushed first so the left one is done first
+            if (node->type == AST_OP) {
+                *(TempFrame*) stack_push(&frames) = (TempFrame) { node->op.right, false };
+                *(TempFrame*) stack_push(&frames) = (TempFrame) { node->op.left, false };
+            } else if (node->type == AST_FUNC) {
+                *(TempFrame*) stack_push(&frames) = (TempFrame) { node->func.arg, false };
+            } else if (node->type == AST_UNARY) {
+                *(TempFrame*) stack_push(&frames) = (TempFrame) { node->unary.operand, false };
+            }
+            continue;
+        }
+        stack_pop(&frames);
+
+        if (node != cse->root && !is_leaf(node) && (intptr_t) ptrmap_get(uses, node) > 1) {
+            push_temp(cse, node, capacity);
+        }
+    }
+
+    free_ptrmap(&visited);
+    free_stack(&frames);
+}
+
+Cse* create_cse(AstNode* tree) {
+    Cse* cse = (Cse*) malloc(sizeof(Cse));
+    cse->hc = create_hashcons();
+    cse->root = intern_ast_node(cse->hc, tree);
+    cse->temps = NULL;
+    cse->temp_count = 0;
+    init_ptrmap(&cse->names);
+
+    // uses[node] = number of references to the node in the DAG
+    PtrMap uses;
+    init_ptrmap(&uses);
+
+    int capacity = 0;
+    count_ast_uses(cse->root, &uses);
+    collect_temps(cse, &uses, &capacity);
+
+    free_ptrmap(&uses);
+    return cse;
+}
+
+void destroy_cse(Cse* cse) {
+    if (cse == NULL) return;
+
+    free(cse->temps);
+    free_ptrmap(&cse->names);
+    destroy_hashcons(cse->hc);
+    free(cse);
+}
+
+int cse_temp_number(Cse* cse, AstNode* node) {
+    return (int) (intptr_t) ptrmap_get(&cse->names, node);
+}
+
+
+void cse_fprint(FILE* fp, Cse* cse) {
+    for (int i = 0; i < cse->temp_count; i++) {
+        fprintf(fp, "t%d = ", i + 1);
+        ast_fprint_infix_named(fp, cse->temps[i], &cse->names);
+        fputc('\n', fp);
+    }
+
+    ast_fprint_infix_named(fp, cse->root, &cse->names);
+    fputc('\n', fp);
+}
+
+void cse_append(StrBuf* buf, Cse* cse) {
+    char name[24];
+
+    for (int i = 0; i < cse->temp_count; i++) {
+        int len = snprintf(name, sizeof(name), "t%d = ", i + 1);
+        strbuf_append(buf, name, len);
+        ast_append_infix_named(buf, cse->temps[i], &cse->names);
+        strbuf_append(buf, "; ", 2);
+    }
+
+    ast_append_infix_named(buf, cse->root, &cse->names);
+}
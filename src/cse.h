@@ -0,0 +1,49 @@
+#ifndef __CSE_H__
+#define __CSE_H__
+
+#include <stdio.h>
+#include "ast.h"
+#include "hashcons.h"
+#include "ptrmap.h"
+#include "strbuf.h"
+
+/*
+common subexpression elimination:
+the tree is interned (hashcons.h) so equal subtrees become one node,
+and every node used more than once (except numbers and x) becomes a temporary
+computed once before the expression that uses it:
+    ((x + 1) * cos(x) - sin(x) * 1) / (x + 1) ^ 2 + cos(x)
+->  t1 = x + 1
+    t2 = cos(x)
+    (t1 * t2 - sin(x)) / t1 ^ 2 + t2
+a temporary only uses x and the temporaries before it.
+the printers (cse_fprint) and the bytecode (compile_cse) take the same result,
+so every shared value is written and computed once.
+*/
+
+typedef struct {
+    HashCons* hc; // owns the interned nodes
+    AstNode* root;
+
+    // temps[i] is t(i+1), in an order where a temporary comes after the ones it uses
+    AstNode** temps;
+    int temp_count;
+
+    // temporary node -> its number (1-based) as (void*) (intptr_t)
+    PtrMap names;
+} Cse;
+
+
+// 'tree' is only read (it may be a DAG, even interned in another store)
+Cse* create_cse(AstNode* tree);
+void destroy_cse(Cse* cse);
+
+// number of the temporary computing 'node', 0 if the node is not a temporary
+int cse_temp_number(Cse* cse, AstNode* node);
+
+// one line per temporary "t1 = cos(x)", then the expression itself
+void cse_fprint(FILE* fp, Cse* cse);
+// the same on one line: "t1 = cos(x); t2 = t1 ^ 2; sin(x) / t2"
+void cse_append(StrBuf* buf, Cse* cse);
+
+#endif
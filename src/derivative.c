@@ -1,164 +1,455 @@
 #include "derivative.h"
 
 #include "ast.h"
+#include "calc.h"
+#include "stack.h"
 #include <stdlib.h>
 #include <stdbool.h>
 
 
+// exponent that is a number (2, +2, -2): the power rule applies
+// anything else goes through exp(ln(factor1) * factor2)
+static bool constant_exponent(AstNode* right, double* value) {
+    if (right->type == AST_NUM) {
+        *value = right->number;
+        return true;
+    }
+
+    if (right->type == AST_UNARY && right->unary.operand->type == AST_NUM) {
+        double number = right->unary.operand->number;
+        *value = right->unary.unary == UNARY_MINUS ? -number : number;
+        return true;
+    }
+
+    return false;
+}
+
+static bool is_zero(AstNode* node) {
+    return node->type == AST_NUM && node->number == 0;
+}
+
+// factor * derivative (or derivative * factor)
+// 'factor' is shared with the input tree, unless the product folds to 0
+static AstNode* times_derivative(AstNode* factor, AstNode* derivative, bool factor_first) {
+    if (is_zero(derivative)) return derivative;
+
+    retain_ast_node(factor);
+    return factor_first
+        ? fold_op_node(OP_MUL, factor, derivative)
+        : fold_op_node(OP_MUL, derivative, factor);
+}
+
+
+// (left op right)' from the derivatives of the children
+// right_d is unused (NULL) for a power with a number exponent
+static AstNode* derive_op(AstNode* tree, AstNode* left_d, AstNode* right_d) {
+    Operator op = tree->op.op;
+    AstNode* left = tree->op.left;
+    AstNode* right = tree->op.right;
+
+    if (op == OP_ADD || op == OP_SUB) {
+        // (factor1 +/- factor2)' = factor1' +/- factor2'
+        return fold_op_node(op, left_d, right_d);
+    } else if (op == OP_MUL) {
+        // (factor1 * factor2)' = factor1 * factor2' + factor1' * factor2
+        return fold_op_node(OP_ADD,
+            times_derivative(left, right_d, true),
+            times_derivative(right, left_d, false)
+        );
+    } else if (op == OP_DIV) {
+        // (factor1 / factor2)' = (factor1' * factor2 - factor1 * factor2')/(factor2)^2
+        AstNode* numerator = fold_op_node(OP_SUB,
+            times_derivative(right, left_d, false),
+            times_derivative(left, right_d, true)
+        );
+
+        if (is_zero(numerator)) return numerator; // no denominator needed
+
+        return fold_op_node(OP_DIV, numerator,
+            create_op_node(OP_POW, retain_ast_node(right), create_num_node(2))
+        );
+    } else if (op == OP_POW) {
+        // (factor ^ num)' = num * factor ^ (num-1) * factor'
+        // any other exponent is rewritten as exp(ln(factor) * exponent) before it gets here
+        double exponent;
+        if (!constant_exponent(right, &exponent)) return NULL;
+
+        if (is_zero(left_d)) return left_d;
+
+        return fold_op_node(OP_MUL,
+            fold_op_node(OP_MUL,
+                create_num_node(exponent),
+                fold_op_node(OP_POW, retain_ast_node(left), create_num_node(exponent - 1))
+            ),
+            left_d
+        );
+    }
+
+    return NULL;
+}
+
+// (func(expr))' = func'(expr) * expr'
+static AstNode* derive_func(AstNode* tree, AstNode* arg_d) {
+    // d/dx func(constant) = 0
+    if (arg_d == NULL || is_zero(arg_d)) return arg_d;
+
+    AstNode* arg = retain_ast_node(tree->func.arg);
+    Function func = tree->func.func;
+
+    if (func == FUNC_SIN) {
+        // sin' = cos
+        return fold_op_node(OP_MUL,
+            create_func_node(FUNC_COS, arg),
+            arg_d
+        );
+    } else if (func == FUNC_COS) {
+        // cos' = -sin
+        return fold_op_node(OP_MUL,
+            create_unary_node(UNARY_MINUS,
+                create_func_node(FUNC_SIN, arg)
+            ),
+            arg_d
+        );
+    } else if (func == FUNC_TAN) {
+        // tan' = 1/cos^2
+        return fold_op_node(OP_MUL,
+            create_op_node(OP_DIV, create_num_node(1),
+                create_op_node(OP_POW,
+                    create_func_node(FUNC_COS, arg),
+                    create_num_node(2)
+                )
+            ),
+            arg_d
+        );
+    } else if (func == FUNC_LN) {
+        // ln' = 1/()
+        return fold_op_node(OP_DIV, arg_d, arg);
+    } else if (func == FUNC_LOG) {
+        // log' = 1/(ln(10)*())
+        return fold_op_node(OP_DIV, arg_d,
+            create_op_node(OP_MUL,
+                create_func_node(FUNC_LN, create_num_node(10)),
+                arg
+            )
+        );
+    } else if (func == FUNC_EXP) {
+        // exp' = exp
+        return fold_op_node(OP_MUL,
+            create_func_node(FUNC_EXP, arg),
+            arg_d
+        );
+    }
+
+    // else should never happen (FUNC_INVALID should not be parsed)
+    destroy_ast_node(arg);
+    destroy_ast_node(arg_d);
+    return NULL;
+}
+
+
+// a node waiting for the derivatives of its children
+typedef struct {
+    AstNode* tree;
+    bool children_done;
+    AstNode* exp; // temporary exp(ln(factor1) * factor2) of a power, or NULL
+} DerivativeFrame;
+
+#define LOCAL_STACK 64
 
-// DONT FORGET!!: If building a new ast tree, it should ALWAYS clone the ast node
+// 'derivative_expression' does not change 'AstNode* tree':
+// the parts of it used again in the result are shared (retain_ast_node),
+// an increment instead of a clone. the caller still destroys 'AstNode* tree',
+// the shared parts live on in the result.
 //
-// 'derivative_expression' clone the 'AstNode* tree'
-// so it doesn't have responsibility to destroy 'AstNode* tree'
-// and caller should destroy 'AstNode* tree'
+// every node is built with the folding constructors (calc.h) and
+// the derivatives of the children are computed first:
+// trivial nodes (0 * cos(x), x * 1, d/dx 2 = 0) are never built
+//
+// postorder with an explicit stack (no recursion: any depth),
+// the derivatives of the children wait on 'done' until their parent is derived
 AstNode* derivative_expression(AstNode* tree) {
     if (tree == NULL) return NULL;
 
-    AstNode* node;
-
-    if (tree->type == AST_OP) {
-        Operator op = tree->op.op;
-
-        if (op == OP_ADD || op == OP_SUB) {
-            // (factor1 +/- factor2)' = factor1' +/- factor2'
-            AstNode* left_d = derivative_expression(tree->op.left);
-            AstNode* right_d = derivative_expression(tree->op.right);
-            node = create_op_node(op, left_d, right_d);
-        } else if (op == OP_MUL) {
-            // (factor1 * factor2)' = factor1 * factor2' + factor1' * factor2
-            AstNode* left = clone_ast_node(tree->op.left);
-            AstNode* right = clone_ast_node(tree->op.right);
-            AstNode* left_d = derivative_expression(left);
-            AstNode* right_d = derivative_expression(right);
-
-            node = create_op_node(OP_ADD,
-                create_op_node(OP_MUL, left, right_d),
-                create_op_node(OP_MUL, left_d, right)
-            );
-        } else if (op == OP_DIV) {
-            // (factor1 / factor2)' = (factor1' * factor2 - factor1 * factor2')/(factor2)^2
-            AstNode* left = clone_ast_node(tree->op.left);
-            AstNode* right = clone_ast_node(tree->op.right);
-            AstNode* left_d = derivative_expression(left);
-            AstNode* right_d = derivative_expression(right);
-
-            // clone for the denominator part
-            // should not use a same node twice in ast tree
-            AstNode* right2 = clone_ast_node(tree->op.right);
-
-            node = create_op_node(OP_DIV,
-                create_op_node(OP_SUB,
-                    create_op_node(OP_MUL, left_d, right),
-                    create_op_node(OP_MUL, left, right_d)
-                ),
-                create_op_node(OP_POW, right2, create_num_node(2))
-            );
-        } else if (op == OP_POW) {
-            AstNode* left = clone_ast_node(tree->op.left);
-            AstNode* right = clone_ast_node(tree->op.right);
-
-            if (right->type == AST_NUM) {
-                // (factor ^ num)' = num * factor ^ (num-1) * factor'
-                AstNode* left_d = derivative_expression(left);
-
-                node = create_op_node(OP_MUL,
+    DerivativeFrame frames_local[LOCAL_STACK];
+    AstNode* done_local[LOCAL_STACK];
+    Stack frames, done;
+    STACK_INIT_LOCAL(&frames, DerivativeFrame, frames_local);
+    STACK_INIT_LOCAL(&done, AstNode*, done_local);
+
+    *(DerivativeFrame*) stack_push(&frames) = (DerivativeFrame) { tree, false, NULL };
+
+    while (!stack_empty(&frames)) {
+        DerivativeFrame* frame = (DerivativeFrame*) stack_top(&frames);
+        tree = frame->tree;
+
+        if (tree == NULL || tree->type == AST_NUM || tree->type == AST_VAR) {
+            stack_pop(&frames);
+            AstNode* node = tree == NULL ? NULL : create_num_node(tree->type == AST_VAR ? 1 : 0);
+            *(AstNode**) stack_push(&done) = node;
+            continue;
+        }
+
+        if (!frame->children_done) {
+            frame->children_done = true;
+
+            // children to derive, the last one is pushed first
+            AstNode* children[2];
+            int count = 0;
+            double exponent;
+
+            if (tree->type == AST_OP && tree->op.op == OP_POW
+                && !constant_exponent(tree->op.right, &exponent)) {
+                // (factor1 ^ factor2)' = (exp(ln(factor1) * factor2))'
+                // temporary nodes around the original children
+                frame->exp = create_func_node(FUNC_EXP,
                     create_op_node(OP_MUL,
-                        right,
-                        create_op_node(OP_POW, left, create_num_node(right->number-1))
-                    ),
-                    left_d
+                        create_func_node(FUNC_LN, retain_ast_node(tree->op.left)),
+                        retain_ast_node(tree->op.right)
+                    )
                 );
-            } else if (right->type == AST_UNARY) {
-                AstNode* left_d = derivative_expression(left);
-
-                if (right->unary.unary == UNARY_PLUS) {
-                    node = derivative_expression(right->unary.operand);
-                } else { // minus
-                    // (f^(-a))' = (-a) * f * (-(a+1)) * f'
-                    node = create_op_node(OP_MUL,
-                        create_op_node(OP_MUL,
-                            right,
-                            create_op_node(OP_POW, left,
-                                create_unary_node(UNARY_MINUS, create_num_node(right->unary.operand->number+1))
-                            )
-                        ),
-                        left_d
-                    );
-                }
+                children[count++] = frame->exp;
+            } else if (tree->type == AST_OP) {
+                children[count++] = tree->op.left;
+                if (tree->op.op != OP_POW) children[count++] = tree->op.right;
+            } else if (tree->type == AST_FUNC) {
+                children[count++] = tree->func.arg;
             } else {
-                // (factor1 ^ factor2)' = (exp(ln(factor1) * factor2))'
+                children[count++] = tree->unary.operand;
+            }
 
-                // these are temporary nodes! they should be destroyed in this block
-                AstNode* ln_left = create_func_node(FUNC_LN, left);
-                AstNode* arg = create_op_node(OP_MUL, ln_left, right);
-                AstNode* exp = create_func_node(FUNC_EXP, arg);
+            for (int i = count - 1; i >= 0; i--) {
+                *(DerivativeFrame*) stack_push(&frames) = (DerivativeFrame) { children[i], false, NULL };
+            }
+            continue;
+        }
 
-                node = derivative_expression(exp);
+        DerivativeFrame finished = *(DerivativeFrame*) stack_pop(&frames);
+        AstNode* node;
 
-                destroy_ast_node(exp); // temporary node 'exp' becomes useless
-                // also recursively destroy arg and ln_left
-            }
+        if (finished.exp != NULL) {
+            node = *(AstNode**) stack_pop(&done);
+            destroy_ast_node(finished.exp); // what the derivative uses of it is retained
+        } else if (tree->type == AST_OP) {
+            AstNode* right_d = tree->op.op != OP_POW ? *(AstNode**) stack_pop(&done) : NULL;
+            AstNode* left_d = *(AstNode**) stack_pop(&done);
+            node = derive_op(tree, left_d, right_d);
+        } else if (tree->type == AST_FUNC) {
+            node = derive_func(tree, *(AstNode**) stack_pop(&done));
+        } else {
+            node = fold_unary_node(tree->unary.unary, *(AstNode**) stack_pop(&done));
         }
-    } else if (tree->type == AST_NUM) {
-        node = create_num_node(0);
-    } else if (tree->type == AST_VAR) {
-        node = create_num_node(1);
-    } else if (tree->type == AST_UNARY) {
-        node = create_unary_node(tree->unary.unary, derivative_expression(tree->unary.operand));
-    } else if (tree->type == AST_FUNC) {
-        // (func(expr))' = func'(expr) * expr'
-        AstNode* arg = clone_ast_node(tree->func.arg);
-        AstNode* arg_d = derivative_expression(arg);
-
-        Function func = tree->func.func;
-
-        if (func == FUNC_SIN) {
-            // sin' = cos
-            node = create_op_node(OP_MUL,
-                create_func_node(FUNC_COS, arg),
-                arg_d
-            );
-        } else if (func == FUNC_COS) {
-            // cos' = -sin
-            node = create_op_node(OP_MUL,
-                create_unary_node(UNARY_MINUS,
-                    create_func_node(FUNC_SIN, arg)
-                ),
-                arg_d
-            );
-        } else if (func == FUNC_TAN) {
-            // tan' = 1/cos^2
-            node = create_op_node(OP_MUL,
-                create_op_node(OP_DIV, create_num_node(1),
-                    create_op_node(OP_POW,
-                        create_func_node(FUNC_COS, arg),
-                        create_num_node(2)
-                    )
-                ),
-                arg_d
-            );
-        } else if (func == FUNC_LN) {
-            // ln' = 1/()
-            node = create_op_node(OP_DIV, arg_d, arg);
-        } else if (func == FUNC_LOG) {
-            // log' = 1/(ln(10)*())
-            node = create_op_node(OP_DIV, arg_d,
-                create_op_node(OP_MUL,
-                    create_func_node(FUNC_LN, create_num_node(10)),
-                    arg
+
+        *(AstNode**) stack_push(&done) = node;
+    }
+
+    AstNode* node = *(AstNode**) stack_pop(&done);
+    free_stack(&frames);
+    free_stack(&done);
+    return node;
+}
+
+
+
+// (left op right)' for interned nodes, from the derivatives of the children
+// right_d is unused (NULL) for a power with a number exponent
+static AstNode* derive_shared_op(HashCons* hc, AstNode* tree, AstNode* left_d, AstNode* right_d) {
+    Operator op = tree->op.op;
+    AstNode* left = tree->op.left;
+    AstNode* right = tree->op.right;
+
+    if (op == OP_ADD || op == OP_SUB) {
+        // (factor1 +/- factor2)' = factor1' +/- factor2'
+        return intern_fold_op_node(hc, op, left_d, right_d);
+    } else if (op == OP_MUL) {
+        // (factor1 * factor2)' = factor1 * factor2' + factor1' * factor2
+        return intern_fold_op_node(hc, OP_ADD,
+            intern_fold_op_node(hc, OP_MUL, left, right_d),
+            intern_fold_op_node(hc, OP_MUL, left_d, right)
+        );
+    } else if (op == OP_DIV) {
+        // (factor1 / factor2)' = (factor1' * factor2 - factor1 * factor2')/(factor2)^2
+        return intern_fold_op_node(hc, OP_DIV,
+            intern_fold_op_node(hc, OP_SUB,
+                intern_fold_op_node(hc, OP_MUL, left_d, right),
+                intern_fold_op_node(hc, OP_MUL, left, right_d)
+            ),
+            intern_fold_op_node(hc, OP_POW, right, intern_num_node(hc, 2))
+        );
+    } else if (op == OP_POW) {
+        // (factor ^ num)' = num * factor ^ (num-1) * factor'
+        // any other exponent is rewritten as exp(ln(factor) * exponent) before it gets here
+        double exponent;
+        if (!constant_exponent(right, &exponent)) return NULL;
+
+        return intern_fold_op_node(hc, OP_MUL,
+            intern_fold_op_node(hc, OP_MUL,
+                intern_num_node(hc, exponent),
+                intern_fold_op_node(hc, OP_POW, left, intern_num_node(hc, exponent - 1))
+            ),
+            left_d
+        );
+    }
+
+    return NULL;
+}
+
+// (func(expr))' = func'(expr) * expr' for interned nodes
+static AstNode* derive_shared_func(HashCons* hc, AstNode* tree, AstNode* arg_d) {
+    AstNode* arg = tree->func.arg;
+
+    switch (tree->func.func) {
+    case FUNC_SIN:
+        // sin' = cos
+        return intern_fold_op_node(hc, OP_MUL, intern_fold_func_node(hc, FUNC_COS, arg), arg_d);
+    case FUNC_COS:
+        // cos' = -sin
+        return intern_fold_op_node(hc, OP_MUL,
+            intern_fold_unary_node(hc, UNARY_MINUS, intern_fold_func_node(hc, FUNC_SIN, arg)),
+            arg_d
+        );
+    case FUNC_TAN:
+        // tan' = 1/cos^2
+        return intern_fold_op_node(hc, OP_MUL,
+            intern_fold_op_node(hc, OP_DIV, intern_num_node(hc, 1),
+                intern_fold_op_node(hc, OP_POW,
+                    intern_fold_func_node(hc, FUNC_COS, arg),
+                    intern_num_node(hc, 2)
                 )
-            );
-        } else if (func == FUNC_EXP) {
-            // exp' = exp
-            node = create_op_node(OP_MUL,
-                create_func_node(FUNC_EXP, arg),
-                arg_d
-            );
-        } else { // else should never happen (FUNC_INVALID should not be parsed)
-            node = NULL;
+            ),
+            arg_d
+        );
+    case FUNC_LN:
+        // ln' = 1/()
+        return intern_fold_op_node(hc, OP_DIV, arg_d, arg);
+    case FUNC_LOG:
+        // log' = 1/(ln(10)*())
+        return intern_fold_op_node(hc, OP_DIV, arg_d,
+            intern_fold_op_node(hc, OP_MUL,
+                intern_fold_func_node(hc, FUNC_LN, intern_num_node(hc, 10)),
+                arg
+            )
+        );
+    case FUNC_EXP:
+        // exp' = exp
+        return intern_fold_op_node(hc, OP_MUL, intern_fold_func_node(hc, FUNC_EXP, arg), arg_d);
+    case FUNC_INVALID: // should never happen (FUNC_INVALID should not be parsed)
+        return NULL;
+    }
+
+    return NULL;
+}
+
+// hash-consed version of derivative_expression
+// no clone needed: the interned nodes are immutable and can be shared freely
+// the nodes are folded like in derivative_expression (intern_fold_*)
+//
+// same postorder with an explicit stack, every derivative is memoized in 'hc':
+// a node is looked up when its frame comes to the top, so a subtree shared
+// by two parents is derived once
+AstNode* derivative_expression_shared(HashCons* hc, AstNode* tree) {
+    if (tree == NULL) return NULL;
+
+    DerivativeFrame frames_local[LOCAL_STACK];
+    AstNode* done_local[LOCAL_STACK];
+    Stack frames, done;
+    STACK_INIT_LOCAL(&frames, DerivativeFrame, frames_local);
+    STACK_INIT_LOCAL(&done, AstNode*, done_local);
+
+    *(DerivativeFrame*) stack_push(&frames) = (DerivativeFrame) { tree, false, NULL };
+
+    while (!stack_empty(&frames)) {
+        DerivativeFrame* frame = (DerivativeFrame*) stack_top(&frames);
+        tree = frame->tree;
+
+        if (!frame->children_done) {
+            AstNode* memo = tree != NULL ? (AstNode*) ptrmap_get(&hc->derivatives, tree) : NULL;
+
+            if (tree == NULL || memo != NULL || tree->type == AST_NUM || tree->type == AST_VAR) {
+                stack_pop(&frames);
+                AstNode* node = memo;
+                if (tree == NULL) {
+                    node = NULL;
+                } else if (memo == NULL) {
+                    node = intern_num_node(hc, tree->type == AST_VAR ? 1 : 0);
+                    ptrmap_put(&hc->derivatives, tree, node);
+                }
+                *(AstNode**) stack_push(&done) = node;
+                continue;
+            }
+
+            frame->children_done = true;
+
+            // children to derive, the last one is pushed first
+            AstNode* children[2];
+            int count = 0;
+            double exponent;
+
+            if (tree->type == AST_OP && tree->op.op == OP_POW
+                && !constant_exponent(tree->op.right, &exponent)) {
+                // (factor1 ^ factor2)' = (exp(ln(factor1) * factor2))'
+                frame->exp = intern_fold_func_node(hc, FUNC_EXP,
+                    intern_fold_op_node(hc, OP_MUL,
+                        intern_fold_func_node(hc, FUNC_LN, tree->op.left),
+                        tree->op.right
+                    )
+                );
+                children[count++] = frame->exp;
+            } else if (tree->type == AST_OP) {
+                children[count++] = tree->op.left;
+                if (tree->op.op != OP_POW) children[count++] = tree->op.right;
+            } else if (tree->type == AST_FUNC) {
+                children[count++] = tree->func.arg;
+            } else {
+                children[count++] = tree->unary.operand;
+            }
+
+            for (int i = count - 1; i >= 0; i--) {
+                *(DerivativeFrame*) stack_push(&frames) = (DerivativeFrame) { children[i], false, NULL };
+            }
+            continue;
+        }
+
+        DerivativeFrame finished = *(DerivativeFrame*) stack_pop(&frames);
+        AstNode* node;
+
+        if (finished.exp != NULL) {
+            node = *(AstNode**) stack_pop(&done); // owned by 'hc', nothing to destroy
+        } else if (tree->type == AST_OP) {
+            AstNode* right_d = tree->op.op != OP_POW ? *(AstNode**) stack_pop(&done) : NULL;
+            AstNode* left_d = *(AstNode**) stack_pop(&done);
+            node = derive_shared_op(hc, tree, left_d, right_d);
+        } else if (tree->type == AST_FUNC) {
+            node = derive_shared_func(hc, tree, *(AstNode**) stack_pop(&done));
+        } else {
+            node = intern_fold_unary_node(hc, tree->unary.unary, *(AstNode**) stack_pop(&done));
         }
+
+        if (node != NULL) ptrmap_put(&hc->derivatives, tree, node);
+        *(AstNode**) stack_push(&done) = node;
     }
 
+    AstNode* node = *(AstNode**) stack_pop(&done);
+    free_stack(&frames);
+    free_stack(&done);
     return node;
 }
 
+
+AstNode** derivative_nth(HashCons* hc, AstNode* tree, int n) {
+    if (tree == NULL || n < 0) return NULL;
+
+    AstNode** derivatives = (AstNode**) malloc((n + 1) * sizeof(AstNode*));
+    derivatives[0] = intern_ast_node(hc, tree);
+
+    // each order is the derivative of the previous (shared) one:
+    // subexpressions already derived at a lower order come straight from the memo
+    for (int k = 1; k <= n; k++) {
+        derivatives[k] = derivative_expression_shared(hc, derivatives[k - 1]);
+        if (derivatives[k] == NULL) {
+            free(derivatives);
+            return NULL;
+        }
+    }
+
+    return derivatives;
+}
@@ -2,6 +2,7 @@
 #define __DERIVATIVE_H__
 
 #include "ast.h"
+#include "hashcons.h"
 #include <stdbool.h>
 
 /*
@@ -9,13 +10,30 @@ derivative rule:
 (factor1 +/- factor2)' = factor1' +/- factor2'
 (factor1 * factor2)' = factor1 * factor2' + factor1' * factor2
 (factor1 / factor2)' = (factor1' * factor2 - factor1 * factor2')/(factor2)^2
-(factor ^ num)' = num * factor ^ (num-1) * factor'
+(factor ^ num)' = num * factor ^ (num-1) * factor'   (num may be signed: x^-2, x^(+2))
 (factor1 ^ factor2)' = (exp(ln(factor1) * factor2))'
 (func(expr))' = func'(expr) * expr'
+
+nodes are built with the folding constructors (calc.h):
+0 * cos(x), x * 1, -(-x) and 2 + 3 are folded while the derivative is built
 */
 
 // 'AstNode* tree' must be the result of 'parse()' in parse.h
+// it is not changed: the result shares (retains) subtrees of it, the caller still destroys 'tree'
 AstNode* derivative_expression(AstNode* tree);
 
+// same rules, but the result is a DAG interned in 'hc' sharing its subtrees
+// with 'tree' instead of cloning them.
+// the derivative of each distinct subexpression is computed once (memoized in hc)
+// 'tree' must be interned in 'hc' (see intern_ast_node)
+// the result is owned by 'hc', never destroy or modify it
+AstNode* derivative_expression_shared(HashCons* hc, AstNode* tree);
+
+// derivatives[k] = k-th derivative of 'tree' for k = 0..n (derivatives[0]: 'tree' interned)
+// every order is interned in 'hc' and shares structure with the others
+// the returned array must be freed by the caller (not its nodes, owned by 'hc')
+// return NULL on error
+AstNode** derivative_nth(HashCons* hc, AstNode* tree, int n);
+
 
 #endif
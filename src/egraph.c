@@ -0,0 +1,864 @@
+#include "egraph.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <assert.h>
+#include "calc.h"
+#include "ptrmap.h"
+#include "stack.h"
+
+
+#define EGRAPH_INITIAL_CAPACITY 256
+
+const CostModel COST_SIZE = { 1, 1, 1, 1, 1, 1, 1 };
+const CostModel COST_SPEED = { 0.5, 1, 1, 4, 40, 1, 20 };
+
+const EGraphLimits EGRAPH_DEFAULT_LIMITS = { 20000, 30, 0.5 };
+
+
+// rewrite rules: "lhs", "rhs" in prefix notation
+// (op child child), (neg child), (func child), ?a pattern variable, x, number
+// the cheap simplifying rules come first: they are applied first when a limit stops a round
+static const char* rule_strings[][2] = {
+    // calc.h
+    { "(+ ?a 0)", "?a" },
+    { "(- ?a 0)", "?a" },
+    { "(- 0 ?a)", "(neg ?a)" },
+    { "(* ?a 1)", "?a" },
+    { "(* ?a 0)", "0" },
+    { "(/ ?a 1)", "?a" },
+    { "(/ 0 ?a)", "0" },
+    { "(^ ?a 1)", "?a" },
+    { "(^ ?a 0)", "1" },
+    { "(^ 1 ?a)", "1" },
+    { "(neg (neg ?a))", "?a" },
+    { "(- ?a ?a)", "0" },
+    { "(/ ?a ?a)", "1" },
+    { "(ln (exp ?a))", "?a" },
+    { "(log (^ 10 ?a))", "?a" },
+    { "(exp (ln ?a))", "?a" },
+    { "(exp (* (ln ?a) ?b))", "(^ ?a ?b)" },
+    { "(ln 1)", "0" },
+    { "(exp 0)", "1" },
+    { "(log 1)", "0" },
+    { "(log 10)", "1" },
+    { "(sin 0)", "0" },
+    { "(cos 0)", "1" },
+    { "(tan 0)", "0" },
+    { "(+ (^ (sin ?a) 2) (^ (cos ?a) 2))", "1" },
+    { "(/ (sin ?a) (cos ?a))", "(tan ?a)" },
+    { "(/ (ln ?a) (ln 10))", "(log ?a)" },
+    { "(+ ?a (neg ?b))", "(- ?a ?b)" },
+    { "(* -1 ?a)", "(neg ?a)" },
+    { "(* ?a (^ ?b -1))", "(/ ?a ?b)" },
+    { "(^ ?a -1)", "(/ 1 ?a)" },
+    { "(^ ?a (neg ?b))", "(/ 1 (^ ?a ?b))" },
+    { "(+ ?a ?a)", "(* 2 ?a)" },
+    { "(* ?a ?a)", "(^ ?a 2)" },
+    { "(* ?a (^ ?a ?b))", "(^ ?a (+ ?b 1))" },
+    { "(* (^ ?a ?b) (^ ?a ?c))", "(^ ?a (+ ?b ?c))" },
+    { "(* (exp ?a) (exp ?b))", "(exp (+ ?a ?b))" },
+    { "(+ (* ?a ?b) (* ?a ?c))", "(* ?a (+ ?b ?c))" },
+    { "(neg (+ ?a ?b))", "(- (neg ?a) ?b)" },
+    { "(- ?a (+ ?b ?c))", "(- (- ?a ?b) ?c)" },
+
+    // moves: commutativity, associativity, inverses
+    { "(+ ?a ?b)", "(+ ?b ?a)" },
+    { "(* ?a ?b)", "(* ?b ?a)" },
+    { "(+ (+ ?a ?b) ?c)", "(+ ?a (+ ?b ?c))" },
+    { "(+ ?a (+ ?b ?c))", "(+ (+ ?a ?b) ?c)" },
+    { "(* (* ?a ?b) ?c)", "(* ?a (* ?b ?c))" },
+    { "(* ?a (* ?b ?c))", "(* (* ?a ?b) ?c)" },
+    { "(- ?a ?b)", "(+ ?a (neg ?b))" },
+    { "(neg ?a)", "(* -1 ?a)" },
+    { "(/ ?a ?b)", "(* ?a (^ ?b -1))" },
+    { "(* (neg ?a) ?b)", "(neg (* ?a ?b))" },
+    { "(neg (* ?a ?b))", "(* (neg ?a) ?b)" },
+    { "(/ (neg ?a) ?b)", "(neg (/ ?a ?b))" },
+    { "(* (/ ?a ?b) ?c)", "(/ (* ?a ?c) ?b)" },
+    { "(/ (* ?a ?b) ?c)", "(* ?a (/ ?b ?c))" },
+    { "(/ ?a (/ ?b ?c))", "(/ (* ?a ?c) ?b)" },
+    { "(/ (/ ?a ?b) ?c)", "(/ ?a (* ?b ?c))" },
+    { "(* ?a (+ ?b ?c))", "(+ (* ?a ?b) (* ?a ?c))" },
+
+    // exp, ln and trig identities
+    { "(ln (* ?a ?b))", "(+ (ln ?a) (ln ?b))" },
+    { "(ln (^ ?a ?b))", "(* ?b (ln ?a))" },
+    { "(log ?a)", "(/ (ln ?a) (ln 10))" },
+    { "(sin (neg ?a))", "(neg (sin ?a))" },
+    { "(cos (neg ?a))", "(cos ?a)" },
+    { "(tan ?a)", "(/ (sin ?a) (cos ?a))" },
+    { "(+ 1 (^ (tan ?a) 2))", "(/ 1 (^ (cos ?a) 2))" },
+    { "(/ 1 (^ (cos ?a) 2))", "(+ 1 (^ (tan ?a) 2))" },
+};
+
+#define RULE_COUNT ((int) (sizeof(rule_strings) / sizeof(rule_strings[0])))
+
+
+/* ---------- patterns ---------- */
+
+#define PATTERN_VARIABLE -1 // Pattern.type of ?a, ?b, ...
+#define PATTERN_MAX_VARS 4
+#define PATTERN_MAX_NODES 16 // nodes of one pattern
+#define RULE_POOL_SIZE (RULE_COUNT * 2 * PATTERN_MAX_NODES)
+
+typedef struct Pattern {
+    int type; // AstType or PATTERN_VARIABLE
+    int symbol; // Operator, Function or Unary
+    double number; // AST_NUM
+    int var; // PATTERN_VARIABLE: 0 for ?a, 1 for ?b, ...
+    struct Pattern* children[2];
+} Pattern;
+
+typedef struct {
+    Pattern* lhs;
+    Pattern* rhs;
+} Rule;
+
+typedef struct {
+    Rule rules[RULE_COUNT];
+    Pattern pool[RULE_POOL_SIZE];
+    int pool_used;
+} RuleSet;
+
+static int node_arity(AstType type) {
+    switch (type) {
+    case AST_OP: return 2;
+    case AST_FUNC:
+    case AST_UNARY: return 1;
+    default: return 0;
+    }
+}
+
+static const char* skip_spaces(const char* s) {
+    while (*s == ' ') s++;
+    return s;
+}
+
+// the rules are written by hand: a malformed one is a programming error
+static Pattern* parse_pattern(RuleSet* set, const char** text) {
+    static const char* functions[] = { "sin", "cos", "tan", "ln", "log", "exp" };
+
+    assert(set->pool_used < RULE_POOL_SIZE);
+    Pattern* pattern = &set->pool[set->pool_used++];
+    memset(pattern, 0, sizeof(*pattern));
+
+    const char* s = skip_spaces(*text);
+
+    if (*s == '?') {
+        pattern->type = PATTERN_VARIABLE;
+        pattern->var = s[1] - 'a';
+        assert(pattern->var >= 0 && pattern->var < PATTERN_MAX_VARS);
+        *text = s + 2;
+        return pattern;
+    }
+
+    if (*s == 'x') {
+        pattern->type = AST_VAR;
+        *text = s + 1;
+        return pattern;
+    }
+
+    if (*s != '(') {
+        char* end;
+        pattern->type = AST_NUM;
+        pattern->number = strtod(s, &end);
+        assert(end != s);
+        *text = end;
+        return pattern;
+    }
+
+    s++;
+    size_t length = strcspn(s, " ");
+
+    if (length == 1 && strchr("+-*/^", *s) != NULL) {
+        static const char operators[] = "+-*/^"; // same order as Operator
+        pattern->type = AST_OP;
+        pattern->symbol = (int) (strchr(operators, *s) - operators);
+    } else if (length == 3 && strncmp(s, "neg", 3) == 0) {
+        pattern->type = AST_UNARY;
+        pattern->symbol = UNARY_MINUS;
+    } else {
+        pattern->type = AST_FUNC;
+        pattern->symbol = FUNC_INVALID;
+        for (int i = 0; i < FUNC_INVALID; i++) {
+            if (strlen(functions[i]) == length && strncmp(s, functions[i], length) == 0) {
+                pattern->symbol = i;
+            }
+        }
+        assert(pattern->symbol != FUNC_INVALID);
+    }
+    s += length;
+
+    for (int i = 0; i < node_arity(pattern->type); i++) {
+        pattern->children[i] = parse_pattern(set, &s);
+    }
+
+    s = skip_spaces(s);
+    assert(*s == ')');
+    *text = s + 1;
+    return pattern;
+}
+
+static void load_rules(RuleSet* set) {
+    set->pool_used = 0;
+    for (int i = 0; i < RULE_COUNT; i++) {
+        const char* lhs = rule_strings[i][0];
+        const char* rhs = rule_strings[i][1];
+        set->rules[i].lhs = parse_pattern(set, &lhs);
+        set->rules[i].rhs = parse_pattern(set, &rhs);
+    }
+}
+
+
+/* ---------- graph ---------- */
+
+static uint64_t hash_mix(uint64_t h, uint64_t v) {
+    h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    return h;
+}
+
+// children must be canonical (egraph_find)
+static size_t hash_enode(const ENode* node) {
+    uint64_t h = hash_mix(node->type, node->symbol);
+
+    if (node->type == AST_NUM) {
+        uint64_t bits;
+        memcpy(&bits, &node->number, sizeof(bits));
+        h = hash_mix(h, bits);
+    }
+    for (int i = 0; i < node_arity(node->type); i++) {
+        h = hash_mix(h, (uint64_t) node->children[i]);
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t) h;
+}
+
+static bool enode_equal(EGraph* graph, const ENode* a, const ENode* b) {
+    if (a->type != b->type || a->symbol != b->symbol) return false;
+    if (a->type == AST_NUM) return memcmp(&a->number, &b->number, sizeof(double)) == 0;
+
+    for (int i = 0; i < node_arity(a->type); i++) {
+        if (egraph_find(graph, a->children[i]) != egraph_find(graph, b->children[i])) return false;
+    }
+    return true;
+}
+
+static void canonicalize_enode(EGraph* graph, ENode* node) {
+    for (int i = 0; i < node_arity(node->type); i++) {
+        node->children[i] = egraph_find(graph, node->children[i]);
+    }
+}
+
+
+static void clear_table(EGraph* graph) {
+    memset(graph->table, -1, graph->table_capacity * sizeof(int));
+    graph->table_size = 0;
+}
+
+// node index equal to 'node', -1 if none
+static int table_lookup(EGraph* graph, const ENode* node) {
+    size_t mask = graph->table_capacity - 1;
+    for (size_t i = hash_enode(node) & mask; graph->table[i] >= 0; i = (i + 1) & mask) {
+        if (enode_equal(graph, &graph->nodes[graph->table[i]], node)) return graph->table[i];
+    }
+    return -1;
+}
+
+static void table_insert_slot(EGraph* graph, int index) {
+    size_t mask = graph->table_capacity - 1;
+    size_t i = hash_enode(&graph->nodes[index]) & mask;
+    while (graph->table[i] >= 0) i = (i + 1) & mask;
+    graph->table[i] = index;
+    graph->table_size++;
+}
+
+static void table_insert(EGraph* graph, int index) {
+    if ((graph->table_size + 1) * 2 > graph->table_capacity) {
+        free(graph->table);
+        graph->table_capacity *= 2;
+        graph->table = (int*) malloc(graph->table_capacity * sizeof(int));
+        clear_table(graph);
+
+        // nodes are canonicalized again by the next rebuild, the stale ones may be missed until then
+        for (int i = 0; i < graph->node_count; i++) {
+            if (!graph->nodes[i].dead && i != index) table_insert_slot(graph, i);
+        }
+    }
+    table_insert_slot(graph, index);
+}
+
+
+static void class_push(EClass* eclass, int node) {
+    if (eclass->count == eclass->capacity) {
+        eclass->capacity = eclass->capacity ? eclass->capacity * 2 : 2;
+        eclass->nodes = (int*) realloc(eclass->nodes, eclass->capacity * sizeof(int));
+    }
+    eclass->nodes[eclass->count++] = node;
+}
+
+static EClassId new_class(EGraph* graph) {
+    if (graph->class_count == graph->class_capacity) {
+        graph->class_capacity *= 2;
+        graph->parents = (EClassId*) realloc(graph->parents, graph->class_capacity * sizeof(EClassId));
+        graph->classes = (EClass*) realloc(graph->classes, graph->class_capacity * sizeof(EClass));
+    }
+
+    EClassId id = graph->class_count++;
+    graph->parents[id] = id;
+    graph->classes[id] = (EClass) { NULL, 0, 0, -1 };
+    return id;
+}
+
+// class of the node, the node is added if it does not exist yet
+static EClassId add_enode(EGraph* graph, ENode node) {
+    canonicalize_enode(graph, &node);
+
+    int existing = table_lookup(graph, &node);
+    if (existing >= 0) return egraph_find(graph, graph->nodes[existing].eclass);
+
+    if (graph->node_count == graph->node_capacity) {
+        graph->node_capacity *= 2;
+        graph->nodes = (ENode*) realloc(graph->nodes, graph->node_capacity * sizeof(ENode));
+    }
+
+    int index = graph->node_count++;
+    node.eclass = new_class(graph);
+    node.dead = false;
+    graph->nodes[index] = node;
+
+    class_push(&graph->classes[node.eclass], index);
+    if (node.type == AST_NUM) graph->classes[node.eclass].num_node = index;
+    table_insert(graph, index);
+
+    return node.eclass;
+}
+
+static EClassId add_num(EGraph* graph, double number) {
+    ENode node = { .type = AST_NUM, .number = number };
+    return add_enode(graph, node);
+}
+
+// return false if they were already the same class
+static bool union_classes(EGraph* graph, EClassId a, EClassId b) {
+    a = egraph_find(graph, a);
+    b = egraph_find(graph, b);
+    if (a == b) return false;
+
+    // the bigger class stays root
+    if (graph->classes[a].count < graph->classes[b].count) {
+        EClassId t = a; a = b; b = t;
+    }
+    graph->parents[b] = a;
+    graph->dirty = true;
+    return true;
+}
+
+// restore the invariants after unions:
+// congruent nodes (same op, same classes as children) are merged into one class,
+// duplicates are marked dead and every root class gets its list of live nodes again
+static void rebuild(EGraph* graph) {
+    bool changed;
+    do {
+        changed = false;
+        clear_table(graph);
+
+        for (int i = 0; i < graph->node_count; i++) {
+            ENode* node = &graph->nodes[i];
+            if (node->dead) continue;
+
+            canonicalize_enode(graph, node);
+            int same = table_lookup(graph, node);
+            if (same >= 0) {
+                changed |= union_classes(graph, graph->nodes[same].eclass, node->eclass);
+                node->dead = true;
+            } else {
+                table_insert_slot(graph, i);
+            }
+        }
+    } while (changed);
+
+    for (int c = 0; c < graph->class_count; c++) {
+        graph->classes[c].count = 0;
+        graph->classes[c].num_node = -1;
+    }
+    for (int i = 0; i < graph->node_count; i++) {
+        ENode* node = &graph->nodes[i];
+        if (node->dead) continue;
+
+        EClass* eclass = &graph->classes[egraph_find(graph, node->eclass)];
+        class_push(eclass, i);
+        if (node->type == AST_NUM) eclass->num_node = i;
+    }
+
+    graph->dirty = false;
+}
+
+
+EGraph* create_egraph() {
+    EGraph* graph = (EGraph*) malloc(sizeof(EGraph));
+
+    graph->node_capacity = EGRAPH_INITIAL_CAPACITY;
+    graph->node_count = 0;
+    graph->nodes = (ENode*) malloc(graph->node_capacity * sizeof(ENode));
+
+    graph->class_capacity = EGRAPH_INITIAL_CAPACITY;
+    graph->class_count = 0;
+    graph->parents = (EClassId*) malloc(graph->class_capacity * sizeof(EClassId));
+    graph->classes = (EClass*) malloc(graph->class_capacity * sizeof(EClass));
+
+    graph->table_capacity = EGRAPH_INITIAL_CAPACITY * 2;
+    graph->table = (int*) malloc(graph->table_capacity * sizeof(int));
+    clear_table(graph);
+
+    graph->dirty = false;
+    return graph;
+}
+
+void destroy_egraph(EGraph* graph) {
+    if (graph == NULL) return;
+
+    for (int c = 0; c < graph->class_count; c++) free(graph->classes[c].nodes);
+    free(graph->classes);
+    free(graph->parents);
+    free(graph->nodes);
+    free(graph->table);
+    free(graph);
+}
+
+EClassId egraph_find(EGraph* graph, EClassId id) {
+    while (graph->parents[id] != id) {
+        graph->parents[id] = graph->parents[graph->parents[id]]; // path halving
+        id = graph->parents[id];
+    }
+    return id;
+}
+
+typedef struct {
+    AstNode* tree;
+    bool children_done;
+} AddFrame;
+
+// explicit stack size before the walks below go to the heap
+#define LOCAL_STACK 64
+
+// postorder with an explicit stack (no recursion: any depth)
+// the classes of the children wait on 'done' until their parent is added
+static EClassId add_ast(EGraph* graph, AstNode* tree, PtrMap* added) {
+    AddFrame frames_local[LOCAL_STACK];
+    EClassId done_local[LOCAL_STACK];
+    Stack frames, done;
+    STACK_INIT_LOCAL(&frames, AddFrame, frames_local);
+    STACK_INIT_LOCAL(&done, EClassId, done_local);
+
+    *(AddFrame*) stack_push(&frames) = (AddFrame) { tree, false };
+
+    while (!stack_empty(&frames)) {
+        AddFrame* frame = (AddFrame*) stack_top(&frames);
+        tree = frame->tree;
+
+        if (!frame->children_done) {
+            void* known = ptrmap_get(added, tree);
+            if (known != NULL) {
+                stack_pop(&frames);
+                *(EClassId*) stack_push(&done) = (EClassId) ((intptr_t) known - 1);
+                continue;
+            }
+
+            if (node_arity(tree->type) > 0) {
+                frame->children_done = true;
+                // the right child is pushed first so the left one is added first
+                if (tree->type == AST_OP) {
+                    *(AddFrame*) stack_push(&frames) = (AddFrame) { tree->op.right, false };
+                    *(AddFrame*) stack_push(&frames) = (AddFrame) { tree->op.left, false };
+                } else if (tree->type == AST_FUNC) {
+                    *(AddFrame*) stack_push(&frames) = (AddFrame) { tree->func.arg, false };
+                } else {
+                    *(AddFrame*) stack_push(&frames) = (AddFrame) { tree->unary.operand, false };
+                }
+                continue;
+            }
+        }
+        stack_pop(&frames);
+
+        ENode node = { .type = tree->type };
+        EClassId id;
+
+        switch (tree->type) {
+        case AST_NUM:
+            node.number = tree->number;
+            id = add_enode(graph, node);
+            break;
+        case AST_VAR:
+            id = add_enode(graph, node);
+            break;
+        case AST_OP:
+            node.symbol = tree->op.op;
+            node.children[1] = *(EClassId*) stack_pop(&done);
+            node.children[0] = *(EClassId*) stack_pop(&done);
+            id = add_enode(graph, node);
+            break;
+        case AST_FUNC:
+            node.symbol = tree->func.func;
+            node.children[0] = *(EClassId*) stack_pop(&done);
+            id = add_enode(graph, node);
+            break;
+        case AST_UNARY:
+        default:
+            id = *(EClassId*) stack_pop(&done);
+            if (tree->unary.unary == UNARY_MINUS) {
+                node.symbol = UNARY_MINUS;
+                node.children[0] = id;
+                id = add_enode(graph, node);
+            }
+            break;
+        }
+
+        ptrmap_put(added, tree, (void*) ((intptr_t) id + 1));
+        *(EClassId*) stack_push(&done) = id;
+    }
+
+    EClassId id = *(EClassId*) stack_pop(&done);
+    free_stack(&frames);
+    free_stack(&done);
+    return id;
+}
+
+EClassId egraph_add_ast(EGraph* graph, AstNode* tree) {
+    // shared subtrees (DAG) are added once
+    PtrMap added;
+    init_ptrmap(&added);
+    EClassId id = add_ast(graph, tree, &added);
+    free_ptrmap(&added);
+    return id;
+}
+
+
+/* ---------- saturation ---------- */
+
+typedef struct {
+    int rule;
+    EClassId root;
+    EClassId vars[PATTERN_MAX_VARS];
+} Match;
+
+typedef struct {
+    Match* items;
+    int count;
+    int capacity;
+    int limit; // stop collecting past this many
+} Matches;
+
+static void push_match(Matches* matches, int rule, EClassId root, const EClassId* vars) {
+    if (matches->count == matches->capacity) {
+        matches->capacity = matches->capacity ? matches->capacity * 2 : 256;
+        matches->items = (Match*) realloc(matches->items, matches->capacity * sizeof(Match));
+    }
+
+    Match* match = &matches->items[matches->count++];
+    match->rule = rule;
+    match->root = root;
+    memcpy(match->vars, vars, sizeof(match->vars));
+}
+
+// match the pending (pattern, class) pairs, every full match is pushed
+static void match_pending(EGraph* graph, int rule, EClassId root,
+                          Pattern** patterns, EClassId* classes, int pending,
+                          EClassId* vars, Matches* matches) {
+    if (matches->count >= matches->limit) return;
+
+    if (pending == 0) {
+        push_match(matches, rule, root, vars);
+        return;
+    }
+
+    pending--;
+    Pattern* pattern = patterns[pending];
+    EClassId id = egraph_find(graph, classes[pending]);
+    EClass* eclass = &graph->classes[id];
+
+    if (pattern->type == PATTERN_VARIABLE) {
+        EClassId bound = vars[pattern->var];
+        if (bound >= 0) {
+            if (bound == id) match_pending(graph, rule, root, patterns, classes, pending, vars, matches);
+            return;
+        }
+
+        vars[pattern->var] = id;
+        match_pending(graph, rule, root, patterns, classes, pending, vars, matches);
+        vars[pattern->var] = -1;
+        return;
+    }
+
+    if (pattern->type == AST_NUM) {
+        if (eclass->num_node >= 0 && graph->nodes[eclass->num_node].number == pattern->number) {
+            match_pending(graph, rule, root, patterns, classes, pending, vars, matches);
+        }
+        return;
+    }
+
+    for (int k = 0; k < eclass->count; k++) {
+        ENode* node = &graph->nodes[eclass->nodes[k]];
+        if (node->type != (AstType) pattern->type || node->symbol != pattern->symbol) continue;
+
+        Pattern* next_patterns[PATTERN_MAX_NODES];
+        EClassId next_classes[PATTERN_MAX_NODES];
+        memcpy(next_patterns, patterns, pending * sizeof(Pattern*));
+        memcpy(next_classes, classes, pending * sizeof(EClassId));
+
+        int next_pending = pending;
+        for (int i = 0; i < node_arity(node->type); i++) {
+            next_patterns[next_pending] = pattern->children[i];
+            next_classes[next_pending] = node->children[i];
+            next_pending++;
+        }
+
+        match_pending(graph, rule, root, next_patterns, next_classes, next_pending, vars, matches);
+    }
+}
+
+static EClassId instantiate(EGraph* graph, Pattern* pattern, const EClassId* vars) {
+    if (pattern->type == PATTERN_VARIABLE) return vars[pattern->var];
+
+    ENode node = { .type = (AstType) pattern->type, .symbol = pattern->symbol, .number = pattern->number };
+    for (int i = 0; i < node_arity(node.type); i++) {
+        node.children[i] = instantiate(graph, pattern->children[i], vars);
+    }
+    return add_enode(graph, node);
+}
+
+// exact value of the node if its children are numbers (calculate_constant)
+static bool fold_enode(EGraph* graph, const ENode* node, double* value) {
+    double values[2];
+    for (int i = 0; i < node_arity(node->type); i++) {
+        int num = graph->classes[egraph_find(graph, node->children[i])].num_node;
+        if (num < 0) return false;
+        values[i] = graph->nodes[num].number;
+    }
+
+    switch (node->type) {
+    case AST_OP:
+        return calculate_constant((Operator) node->symbol, values[0], values[1], value);
+    case AST_UNARY:
+        *value = values[0] == 0 ? 0 : -values[0]; // -0 = 0
+        return true;
+    default:
+        return false; // functions are not folded (ln(10) stays exact)
+    }
+}
+
+static double elapsed_seconds(const struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+EGraphStop egraph_saturate(EGraph* graph, const EGraphLimits* limits) {
+    if (limits == NULL) limits = &EGRAPH_DEFAULT_LIMITS;
+
+    RuleSet* set = (RuleSet*) malloc(sizeof(RuleSet));
+    load_rules(set);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    Matches matches = { NULL, 0, 0, limits->max_nodes };
+    EGraphStop stop = EGRAPH_ITERATION_LIMIT;
+    rebuild(graph);
+
+    for (int iteration = 0; iteration < limits->max_iterations; iteration++) {
+        if (graph->node_count >= limits->max_nodes) {
+            stop = EGRAPH_NODE_LIMIT;
+            break;
+        }
+        if (elapsed_seconds(&start) > limits->max_seconds) {
+            stop = EGRAPH_TIME_LIMIT;
+            break;
+        }
+
+        // 1. find every match on the rebuilt graph
+        matches.count = 0;
+        for (int r = 0; r < RULE_COUNT; r++) {
+            for (EClassId c = 0; c < graph->class_count; c++) {
+                if (graph->parents[c] != c || graph->classes[c].count == 0) continue;
+
+                Pattern* patterns[PATTERN_MAX_NODES] = { set->rules[r].lhs };
+                EClassId classes[PATTERN_MAX_NODES] = { c };
+                EClassId vars[PATTERN_MAX_VARS] = { -1, -1, -1, -1 };
+                match_pending(graph, r, c, patterns, classes, 1, vars, &matches);
+            }
+        }
+
+        // 2. add the right hand sides to the classes of the matches
+        int node_count = graph->node_count;
+        bool changed = false;
+        for (int m = 0; m < matches.count && graph->node_count < limits->max_nodes; m++) {
+            Match* match = &matches.items[m];
+            EClassId id = instantiate(graph, set->rules[match->rule].rhs, match->vars);
+            changed |= union_classes(graph, match->root, id);
+        }
+
+        // 3. constant folding: a class computing a number also holds that number
+        int folded_count = graph->node_count;
+        for (int i = 0; i < folded_count; i++) {
+            ENode node = graph->nodes[i];
+            double value;
+            if (node.dead || node.type == AST_NUM || !fold_enode(graph, &node, &value)) continue;
+            if (graph->classes[egraph_find(graph, node.eclass)].num_node >= 0) continue;
+
+            changed |= union_classes(graph, node.eclass, add_num(graph, value));
+        }
+
+        rebuild(graph);
+
+        if (!changed && graph->node_count == node_count) {
+            stop = EGRAPH_SATURATED;
+            break;
+        }
+    }
+
+    free(matches.items);
+    free(set);
+    return stop;
+}
+
+
+/* ---------- extraction ---------- */
+
+static double enode_cost(const ENode* node, const CostModel* cost) {
+    switch (node->type) {
+    case AST_NUM:
+    case AST_VAR:
+        return cost->leaf;
+    case AST_FUNC:
+        return cost->func;
+    case AST_UNARY:
+        return cost->neg;
+    case AST_OP:
+    default:
+        switch ((Operator) node->symbol) {
+        case OP_ADD:
+        case OP_SUB: return cost->add;
+        case OP_MUL: return cost->mul;
+        case OP_DIV: return cost->div;
+        case OP_POW:
+        default: return cost->pow;
+        }
+    }
+}
+
+typedef struct {
+    EClassId id;
+    bool children_done;
+} BuildFrame;
+
+// tree of the cheapest node of every class, its children built first on an explicit stack
+static AstNode* build_ast(EGraph* graph, const int* best, EClassId id) {
+    BuildFrame frames_local[LOCAL_STACK];
+    AstNode* done_local[LOCAL_STACK];
+    Stack frames, done;
+    STACK_INIT_LOCAL(&frames, BuildFrame, frames_local);
+    STACK_INIT_LOCAL(&done, AstNode*, done_local);
+
+    *(BuildFrame*) stack_push(&frames) = (BuildFrame) { id, false };
+
+    while (!stack_empty(&frames)) {
+        BuildFrame* frame = (BuildFrame*) stack_top(&frames);
+        ENode* node = &graph->nodes[best[egraph_find(graph, frame->id)]];
+        int arity = node_arity(node->type);
+
+        if (!frame->children_done && arity > 0) {
+            frame->children_done = true;
+            // the last child is pushed first so the first one is built first
+            for (int k = arity - 1; k >= 0; k--) {
+                *(BuildFrame*) stack_push(&frames) = (BuildFrame) { node->children[k], false };
+            }
+            continue;
+        }
+        stack_pop(&frames);
+
+        AstNode* tree;
+        switch (node->type) {
+        case AST_NUM:
+            tree = create_num_node(node->number);
+            break;
+        case AST_VAR:
+            tree = create_var_node();
+            break;
+        case AST_OP: {
+            AstNode* right = *(AstNode**) stack_pop(&done);
+            AstNode* left = *(AstNode**) stack_pop(&done);
+            tree = create_op_node((Operator) node->symbol, left, right);
+            break;
+        }
+        case AST_FUNC:
+            tree = create_func_node((Function) node->symbol, *(AstNode**) stack_pop(&done));
+            break;
+        case AST_UNARY:
+        default:
+            tree = create_unary_node((Unary) node->symbol, *(AstNode**) stack_pop(&done));
+            break;
+        }
+        *(AstNode**) stack_push(&done) = tree;
+    }
+
+    AstNode* tree = *(AstNode**) stack_pop(&done);
+    free_stack(&frames);
+    free_stack(&done);
+    return tree;
+}
+
+AstNode* egraph_extract(EGraph* graph, EClassId id, const CostModel* cost) {
+    if (graph->dirty) rebuild(graph);
+
+    // cheapest node of every class, relaxed until nothing improves
+    // (costs are > 0, so the chosen nodes never form a cycle)
+    double* costs = (double*) malloc(graph->class_count * sizeof(double));
+    int* best = (int*) malloc(graph->class_count * sizeof(int));
+    for (int c = 0; c < graph->class_count; c++) {
+        costs[c] = INFINITY;
+        best[c] = -1;
+    }
+
+    bool changed;
+    do {
+        changed = false;
+        for (int i = 0; i < graph->node_count; i++) {
+            ENode* node = &graph->nodes[i];
+            if (node->dead) continue;
+
+            double total = enode_cost(node, cost);
+            for (int k = 0; k < node_arity(node->type); k++) {
+                total += costs[egraph_find(graph, node->children[k])];
+            }
+
+            EClassId c = egraph_find(graph, node->eclass);
+            if (total < costs[c]) {
+                costs[c] = total;
+                best[c] = i;
+                changed = true;
+            }
+        }
+    } while (changed);
+
+    AstNode* tree = build_ast(graph, best, id);
+
+    free(costs);
+    free(best);
+    return tree;
+}
+
+AstNode* egraph_simplify(AstNode* tree, const CostModel* cost, const EGraphLimits* limits) {
+    EGraph* graph = create_egraph();
+    EClassId root = egraph_add_ast(graph, tree);
+    egraph_saturate(graph, limits);
+    AstNode* result = egraph_extract(graph, root, cost);
+    destroy_egraph(graph);
+    return result;
+}
@@ -0,0 +1,120 @@
+#ifndef __EGRAPH_H__
+#define __EGRAPH_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "ast.h"
+
+/*
+Equality saturation:
+an e-graph stores many equivalent trees at once. e-nodes are nodes whose children
+are e-classes (sets of equivalent e-nodes), so a rewrite never destroys anything,
+it only adds the rewritten form to the class of the original one.
+the rules are applied all together, round after round, until nothing new appears
+(saturation) or a budget runs out, then the cheapest tree of the root class is
+extracted under a cost model. unlike simplify_ast_node, the result does not
+depend on the order of the rules.
+
+rules (see rule_strings in egraph.c):
+the rules of calc.h, numbers are folded when the result is exact (calculate_constant)
+commutativity, associativity, distributivity and factoring of + and *
+x - y = x + -y, -x = -1 * x, x / y = x * y^-1, x + x = 2 * x, x * x = x ^ 2
+x^a * x^b = x^(a+b), exp(a) * exp(b) = exp(a+b), exp(ln(x) * y) = x ^ y
+sin(x)^2 + cos(x)^2 = 1, tan(x) = sin(x) / cos(x), 1 + tan(x)^2 = 1 / cos(x)^2
+sin(0) = 0, cos(0) = 1, ln(1) = 0, exp(0) = 1, log(10) = 1, log(x) = ln(x) / ln(10)
+exp(ln(x)) = x, ln(x * y) = ln(x) + ln(y), ln(x ^ y) = y * ln(x)
+
+like canon.h, the usual identities are assumed to hold (x / x = 1, ln(x * y) = ln(x) + ln(y)):
+the result is equal to the input wherever both are defined.
+*/
+
+typedef int EClassId;
+
+// one node of the e-graph: an AstNode whose children are e-classes
+typedef struct {
+    AstType type; // never AST_UNARY with UNARY_PLUS (+x is x)
+    int symbol; // Operator, Function or Unary
+    double number; // AST_NUM
+    EClassId children[2];
+
+    EClassId eclass; // class at the time the node was added (use find)
+    bool dead; // congruent duplicate of another node
+} ENode;
+
+typedef struct {
+    int* nodes; // live nodes of the class (valid after a rebuild)
+    int count;
+    int capacity;
+    int num_node; // an AST_NUM node of the class, -1 if none
+} EClass;
+
+typedef struct {
+    ENode* nodes;
+    int node_count;
+    int node_capacity;
+
+    // union-find over the classes: parents[id] == id for a root
+    EClassId* parents;
+    EClass* classes;
+    int class_count;
+    int class_capacity;
+
+    // open addressing table: canonical node -> node index (-1 = empty)
+    int* table;
+    size_t table_capacity; // always power of 2
+    size_t table_size;
+
+    bool dirty; // classes were merged since the last rebuild
+} EGraph;
+
+
+// cost of each kind of node, the cost of a tree is the sum of its nodes
+// every cost must be > 0
+typedef struct {
+    double leaf; // number or x
+    double add; // + and -
+    double mul;
+    double div;
+    double pow;
+    double neg; // unary -
+    double func; // sin, cos, tan, ln, log, exp
+} CostModel;
+
+extern const CostModel COST_SIZE; // 1 per node: smallest tree
+extern const CostModel COST_SPEED; // rough cycles: fastest tree to evaluate
+
+typedef struct {
+    int max_nodes; // stop once the graph has this many e-nodes
+    int max_iterations; // rounds of rule application
+    double max_seconds; // wall time of egraph_saturate
+} EGraphLimits;
+
+extern const EGraphLimits EGRAPH_DEFAULT_LIMITS;
+
+typedef enum {
+    EGRAPH_SATURATED, // no rule adds anything anymore
+    EGRAPH_NODE_LIMIT,
+    EGRAPH_ITERATION_LIMIT,
+    EGRAPH_TIME_LIMIT
+} EGraphStop;
+
+
+EGraph* create_egraph();
+void destroy_egraph(EGraph* graph);
+
+// add a tree (only read, may be a DAG) and return its class
+EClassId egraph_add_ast(EGraph* graph, AstNode* tree);
+
+EClassId egraph_find(EGraph* graph, EClassId id);
+
+// apply every rule until saturation or until a limit is reached
+EGraphStop egraph_saturate(EGraph* graph, const EGraphLimits* limits);
+
+// cheapest tree of the class as a new tree (allocated like create_*)
+AstNode* egraph_extract(EGraph* graph, EClassId id, const CostModel* cost);
+
+// saturate a graph of the tree and extract its cheapest equivalent tree
+// 'tree' is only read and not destroyed, limits may be NULL (EGRAPH_DEFAULT_LIMITS)
+AstNode* egraph_simplify(AstNode* tree, const CostModel* cost, const EGraphLimits* limits);
+
+#endif
@@ -0,0 +1,580 @@
+#include "eval.h"
+
+#include "ast.h"
+#include "calc.h"
+#include "stack.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// points evaluated together by evaluate_ast_batch
+#define EVAL_BLOCK 256
+
+
+double evaluate_function(Function func, double arg) {
+    switch (func) {
+    case FUNC_SIN: return sin(arg);
+    case FUNC_COS: return cos(arg);
+    case FUNC_TAN: return tan(arg);
+    case FUNC_LN: return log(arg);
+    case FUNC_LOG: return log10(arg);
+    case FUNC_EXP: return exp(arg);
+    case FUNC_INVALID: return NAN;
+    }
+    return NAN;
+}
+
+static double evaluate_operator(Operator op, double a, double b) {
+    switch (op) {
+    case OP_ADD: return a + b;
+    case OP_SUB: return a - b;
+    case OP_MUL: return a * b;
+    case OP_DIV: return a / b;
+    case OP_POW: return pow(a, b);
+    }
+    return NAN;
+}
+
+
+// the evaluators below walk the tree without recursion (any depth):
+// down the first operands to a leaf with a frame per node on the way,
+// then up, and down again from the right operand of every binary node
+typedef struct {
+    AstNode* node;
+    bool right_done; // the left operand waits on the value stack, the right one is being evaluated
+} EvalFrame;
+
+#define LOCAL_STACK 64
+
+// push the frames from 'node' down its first operands, return the leaf at the bottom (NULL if missing)
+static AstNode* descend(Stack* frames, AstNode* node) {
+    while (node != NULL && node->type != AST_NUM && node->type != AST_VAR) {
+        *(EvalFrame*) stack_push(frames) = (EvalFrame) { node, false };
+
+        switch (node->type) {
+        case AST_OP: node = node->op.left; break;
+        case AST_FUNC: node = node->func.arg; break;
+        default: node = node->unary.operand; break;
+        }
+    }
+    return node;
+}
+
+static inline double leaf_value(AstNode* leaf, double x) {
+    if (leaf == NULL) return NAN;
+    return leaf->type == AST_NUM ? leaf->number : x;
+}
+
+double evaluate_ast(AstNode* tree, double x) {
+    EvalFrame frames_local[LOCAL_STACK];
+    double values_local[LOCAL_STACK];
+    Stack frames, values;
+    STACK_INIT_LOCAL(&frames, EvalFrame, frames_local);
+    STACK_INIT_LOCAL(&values, double, values_local);
+
+    double value = leaf_value(descend(&frames, tree), x);
+
+    while (!stack_empty(&frames)) {
+        EvalFrame* frame = (EvalFrame*) stack_top(&frames);
+        AstNode* node = frame->node;
+
+        if (node->type == AST_OP && !frame->right_done) {
+            frame->right_done = true;
+            *(double*) stack_push(&values) = value;
+            value = leaf_value(descend(&frames, node->op.right), x);
+            continue;
+        }
+        stack_pop(&frames);
+
+        switch (node->type) {
+        case AST_OP:
+            value = evaluate_operator(node->op.op, *(double*) stack_pop(&values), value);
+            break;
+        case AST_FUNC:
+            value = evaluate_function(node->func.func, value);
+            break;
+        default:
+            if (node->unary.unary == UNARY_MINUS) value = -value;
+            break;
+        }
+    }
+
+    free_stack(&frames);
+    free_stack(&values);
+    return value;
+}
+
+
+// push the block of a leaf for n points
+static void push_leaf_block(Stack* blocks, AstNode* leaf, const double* xs, size_t n) {
+    double* block = (double*) stack_push(blocks);
+    size_t i;
+
+    if (leaf == NULL) {
+        for (i = 0; i < n; i++) block[i] = NAN;
+    } else if (leaf->type == AST_NUM) {
+        for (i = 0; i < n; i++) block[i] = leaf->number;
+    } else {
+        for (i = 0; i < n; i++) block[i] = xs[i];
+    }
+}
+
+// evaluate the tree for n (<= EVAL_BLOCK) points, one node at a time:
+// the walk of 'evaluate_ast' with a block of EVAL_BLOCK values on 'blocks' in place of a value,
+// a node writes its result over the block of its left operand
+static void evaluate_block(AstNode* tree, const double* xs, double* out, size_t n,
+                           Stack* frames, Stack* blocks) {
+    size_t i;
+
+    push_leaf_block(blocks, descend(frames, tree), xs, n);
+
+    while (!stack_empty(frames)) {
+        EvalFrame* frame = (EvalFrame*) stack_top(frames);
+        AstNode* node = frame->node;
+
+        if (node->type == AST_OP && !frame->right_done) {
+            frame->right_done = true;
+            push_leaf_block(blocks, descend(frames, node->op.right), xs, n);
+            continue;
+        }
+        stack_pop(frames);
+
+        double* top = (double*) stack_top(blocks);
+
+        switch (node->type) {
+        case AST_OP: {
+            double* right = top;
+            double* left = top - EVAL_BLOCK;
+            switch (node->op.op) {
+            case OP_ADD: for (i = 0; i < n; i++) left[i] += right[i]; break;
+            case OP_SUB: for (i = 0; i < n; i++) left[i] -= right[i]; break;
+            case OP_MUL: for (i = 0; i < n; i++) left[i] *= right[i]; break;
+            case OP_DIV: for (i = 0; i < n; i++) left[i] /= right[i]; break;
+            case OP_POW: for (i = 0; i < n; i++) left[i] = pow(left[i], right[i]); break;
+            }
+            stack_pop(blocks);
+            break;
+        }
+        case AST_FUNC:
+            for (i = 0; i < n; i++) top[i] = evaluate_function(node->func.func, top[i]);
+            break;
+        default:
+            if (node->unary.unary == UNARY_MINUS) {
+                for (i = 0; i < n; i++) top[i] = -top[i];
+            }
+            break;
+        }
+    }
+
+    memcpy(out, stack_pop(blocks), n * sizeof(double));
+}
+
+void evaluate_ast_batch(AstNode* tree, const double* xs, double* out, size_t n) {
+    EvalFrame frames_local[LOCAL_STACK];
+    Stack frames, blocks;
+    STACK_INIT_LOCAL(&frames, EvalFrame, frames_local);
+    init_stack(&blocks, EVAL_BLOCK * sizeof(double), NULL, 0);
+
+    for (size_t begin = 0; begin < n; begin += EVAL_BLOCK) {
+        size_t count = n - begin < EVAL_BLOCK ? n - begin : EVAL_BLOCK;
+        evaluate_block(tree, xs + begin, out + begin, count, &frames, &blocks);
+    }
+
+    free_stack(&frames);
+    free_stack(&blocks);
+}
+
+
+// exponent of a '^' differentiated with the power rule (see derivative.c): a number, +number or -number
+static bool constant_exponent(AstNode* right, double* value) {
+    if (right == NULL) return false;
+
+    if (right->type == AST_NUM) {
+        *value = right->number;
+        return true;
+    }
+
+    if (right->type == AST_UNARY && right->unary.operand->type == AST_NUM) {
+        double number = right->unary.operand->number;
+        *value = right->unary.unary == UNARY_MINUS ? -number : number;
+        return true;
+    }
+
+    return false;
+}
+
+
+/*
+derivative_expression builds its result with the folding constructors (calc.h):
+a part that folds to a number is that number, whatever the rest evaluates to
+(0 * ln(x-3) is 0, d/dx ln(0) is 0, (x - x)' = 1 - 1 is 0).
+the rules below go through the same folds on the parts known from the tree alone,
+the same for every point: a known part is its number, any other part is computed.
+*/
+
+// a part of a derivative: the number it folds to, if it does
+typedef struct {
+    bool known;
+    double number;
+} Constant;
+
+static const Constant UNKNOWN = { false, 0 };
+
+static inline Constant known(double number) {
+    return (Constant) { true, number };
+}
+
+static inline bool is_known_zero(Constant c) {
+    return c.known && c.number == 0;
+}
+
+// an operand of the input tree: a number or not
+static inline Constant node_constant(AstNode* node) {
+    return node != NULL && node->type == AST_NUM ? known(node->number) : UNKNOWN;
+}
+
+static Constant negate_constant(Constant c) {
+    if (!c.known) return c;
+    return known(c.number == 0 ? 0 : -c.number); // -0 = 0, like fold_unary
+}
+
+// what fold_op_node(op, a, b) builds: a number or not
+static Constant fold_constant(Operator op, Constant a, Constant b) {
+    // stand-ins for the operands: a number, or a variable for any other node
+    AstNode left = { .type = a.known ? AST_NUM : AST_VAR, .number = a.number };
+    AstNode right = { .type = b.known ? AST_NUM : AST_VAR, .number = b.number };
+    double value;
+
+    switch (fold_op(op, &left, &right, &value)) {
+    case FOLD_NUMBER: return known(value);
+    case FOLD_LEFT: return a;
+    case FOLD_RIGHT: return b;
+    case FOLD_NEGATE: return negate_constant(b);
+    default: return UNKNOWN;
+    }
+}
+
+// factor * derivative, 0 without a product when the derivative is 0 (see times_derivative)
+static Constant times_constant(Constant factor, Constant derivative, bool factor_first) {
+    if (is_known_zero(derivative)) return derivative;
+    return factor_first
+        ? fold_constant(OP_MUL, factor, derivative)
+        : fold_constant(OP_MUL, derivative, factor);
+}
+
+
+// the parts of the derivative of a binary node (derive_op), the same for every point
+typedef struct {
+    Constant parts[4]; // see dual_op_rule
+    Constant result;
+    bool constant_exponent; // '^' with a number exponent
+    double exponent;
+} DualRule;
+
+static DualRule dual_op_rule(AstNode* node, Constant a_d, Constant b_d) {
+    Constant left = node_constant(node->op.left);
+    Constant right = node_constant(node->op.right);
+    DualRule rule = { { UNKNOWN, UNKNOWN, UNKNOWN, UNKNOWN }, UNKNOWN, false, 0 };
+    Constant* parts = rule.parts;
+
+    switch (node->op.op) {
+    case OP_ADD:
+    case OP_SUB:
+        rule.result = fold_constant(node->op.op, a_d, b_d);
+        break;
+    case OP_MUL:
+        // factor1 * factor2' + factor1' * factor2
+        parts[0] = times_constant(left, b_d, true);
+        parts[1] = times_constant(right, a_d, false);
+        rule.result = fold_constant(OP_ADD, parts[0], parts[1]);
+        break;
+    case OP_DIV:
+        // (factor1' * factor2 - factor1 * factor2') / factor2 ^ 2, 0 when the numerator is
+        parts[0] = times_constant(right, a_d, false);
+        parts[1] = times_constant(left, b_d, true);
+        parts[2] = fold_constant(OP_SUB, parts[0], parts[1]);
+        if (is_known_zero(parts[2])) rule.result = parts[2];
+        break;
+    case OP_POW:
+        if (constant_exponent(node->op.right, &rule.exponent)) {
+            // num * factor ^ (num-1) * factor'
+            rule.constant_exponent = true;
+            if (is_known_zero(a_d)) {
+                rule.result = a_d;
+                break;
+            }
+            parts[0] = fold_constant(OP_POW, left, known(rule.exponent - 1));
+            parts[1] = fold_constant(OP_MUL, known(rule.exponent), parts[0]);
+            rule.result = fold_constant(OP_MUL, parts[1], a_d);
+        } else {
+            // exp(ln(factor1) * factor2) * (ln(factor1) * factor2' + factor1' / factor1 * factor2)
+            parts[0] = is_known_zero(a_d) ? a_d : fold_constant(OP_DIV, a_d, left);
+            parts[1] = times_constant(UNKNOWN, b_d, true);
+            parts[2] = times_constant(right, parts[0], false);
+            parts[3] = fold_constant(OP_ADD, parts[1], parts[2]);
+            if (is_known_zero(parts[3])) rule.result = parts[3];
+        }
+        break;
+    }
+
+    return rule;
+}
+
+// b ^ 2 as the '^ 2' nodes of the symbolic derivative evaluate it: pow(b, 2) with 2 a literal
+// is compiled to b * b, which does not always round like pow
+static inline double square(double b) {
+    static volatile double two = 2;
+    return pow(b, two);
+}
+
+// a part: its number if known, else the value computed for it
+static inline double part(Constant c, double computed) {
+    return c.known ? c.number : computed;
+}
+
+// (a op b)' with a, b and their derivatives known
+static inline double dual_op_derivative(Operator op, const DualRule* rule, double a, double a_d, double b, double b_d) {
+    const Constant* parts = rule->parts;
+    if (rule->result.known) return rule->result.number;
+
+    switch (op) {
+    case OP_ADD: return a_d + b_d;
+    case OP_SUB: return a_d - b_d;
+    case OP_MUL:
+        return part(parts[0], a * b_d) + part(parts[1], a_d * b);
+    case OP_DIV:
+        return part(parts[2], part(parts[0], a_d * b) - part(parts[1], a * b_d)) / square(b);
+    case OP_POW:
+        if (rule->constant_exponent) {
+            double e = rule->exponent;
+            return part(parts[1], e * part(parts[0], pow(a, e - 1))) * a_d;
+        } else {
+            double ln_a = log(a);
+            double ln_a_d = part(parts[0], a_d / a);
+            return exp(ln_a * b) * part(parts[3], part(parts[1], ln_a * b_d) + part(parts[2], ln_a_d * b));
+        }
+    }
+    return NAN;
+}
+
+// func'(arg) * arg', 0 without a product when arg' is (see derive_func)
+static inline double dual_function_derivative(Function func, double arg, double arg_d) {
+    switch (func) {
+    case FUNC_SIN: return cos(arg) * arg_d;
+    case FUNC_COS: return -sin(arg) * arg_d;
+    case FUNC_TAN: return 1 / square(cos(arg)) * arg_d;
+    case FUNC_LN: return arg_d / arg;
+    case FUNC_LOG: return arg_d / (log(10) * arg);
+    case FUNC_EXP: return exp(arg) * arg_d;
+    case FUNC_INVALID: return NAN;
+    }
+    return NAN;
+}
+
+// the derivative of a leaf
+static inline Constant leaf_constant(AstNode* leaf) {
+    if (leaf == NULL) return UNKNOWN;
+    return known(leaf->type == AST_NUM ? 0 : 1);
+}
+
+// the derivative of a function: 0 if arg' is, else never a number (cos(arg) * arg')
+static inline Constant function_constant(Constant arg_d) {
+    return is_known_zero(arg_d) ? arg_d : UNKNOWN;
+}
+
+
+// a Dual with what its derivative folds to, on the stack of evaluate_ast_dual
+typedef struct {
+    Dual dual;
+    Constant constant;
+} DualValue;
+
+static inline DualValue leaf_dual(AstNode* leaf, double x) {
+    DualValue result = { { NAN, NAN }, leaf_constant(leaf) };
+    if (leaf != NULL) {
+        result.dual.value = leaf_value(leaf, x);
+        result.dual.derivative = result.constant.number;
+    }
+    return result;
+}
+
+// the walk of 'evaluate_ast' with a derivative next to every value
+Dual evaluate_ast_dual(AstNode* tree, double x) {
+    EvalFrame frames_local[LOCAL_STACK];
+    DualValue duals_local[LOCAL_STACK];
+    Stack frames, duals;
+    STACK_INIT_LOCAL(&frames, EvalFrame, frames_local);
+    STACK_INIT_LOCAL(&duals, DualValue, duals_local);
+
+    DualValue result = leaf_dual(descend(&frames, tree), x);
+
+    while (!stack_empty(&frames)) {
+        EvalFrame* frame = (EvalFrame*) stack_top(&frames);
+        AstNode* node = frame->node;
+
+        if (node->type == AST_OP && !frame->right_done) {
+            frame->right_done = true;
+            *(DualValue*) stack_push(&duals) = result;
+            result = leaf_dual(descend(&frames, node->op.right), x);
+            continue;
+        }
+        stack_pop(&frames);
+
+        switch (node->type) {
+        case AST_OP: {
+            DualValue a = *(DualValue*) stack_pop(&duals);
+            DualValue b = result;
+            DualRule rule = dual_op_rule(node, a.constant, b.constant);
+
+            result.dual.value = evaluate_operator(node->op.op, a.dual.value, b.dual.value);
+            result.dual.derivative = dual_op_derivative(node->op.op, &rule,
+                a.dual.value, a.dual.derivative, b.dual.value, b.dual.derivative);
+            result.constant = rule.result;
+            break;
+        }
+        case AST_FUNC:
+            result.constant = function_constant(result.constant);
+            if (!result.constant.known) {
+                result.dual.derivative = dual_function_derivative(node->func.func, result.dual.value, result.dual.derivative);
+            }
+            result.dual.value = evaluate_function(node->func.func, result.dual.value);
+            break;
+        default:
+            if (node->unary.unary == UNARY_MINUS) {
+                result.dual.value = -result.dual.value;
+                result.constant = negate_constant(result.constant);
+                result.dual.derivative = part(result.constant, -result.dual.derivative);
+            }
+            break;
+        }
+    }
+
+    free_stack(&frames);
+    free_stack(&duals);
+    return result.dual;
+}
+
+
+// push the block of a leaf: n values, then n derivatives from EVAL_BLOCK on
+static void push_leaf_dual_block(Stack* blocks, Stack* constants, AstNode* leaf, const double* xs, size_t n) {
+    double* val = (double*) stack_push(blocks);
+    double* der = val + EVAL_BLOCK;
+    Constant constant = leaf_constant(leaf);
+    size_t i;
+
+    if (leaf == NULL) {
+        for (i = 0; i < n; i++) val[i] = der[i] = NAN;
+    } else {
+        for (i = 0; i < n; i++) {
+            val[i] = leaf->type == AST_NUM ? leaf->number : xs[i];
+            der[i] = constant.number;
+        }
+    }
+
+    *(Constant*) stack_push(constants) = constant;
+}
+
+// the derivatives then the values of a binary node for n points, over those of its left operand
+static inline void dual_op_block(Operator op, const DualRule* rule, double* val, double* der,
+                                 const double* right_val, const double* right_der, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        der[i] = dual_op_derivative(op, rule, val[i], der[i], right_val[i], right_der[i]);
+        val[i] = evaluate_operator(op, val[i], right_val[i]);
+    }
+}
+
+// the walk of 'evaluate_block' with a derivative next to every value
+// (a block holds the values and the derivatives, one after the other,
+// 'constants' what the derivatives of each block fold to)
+static void evaluate_dual_block(AstNode* tree, const double* xs, double* values, double* derivatives, size_t n,
+                                Stack* frames, Stack* blocks, Stack* constants) {
+    size_t i;
+
+    push_leaf_dual_block(blocks, constants, descend(frames, tree), xs, n);
+
+    while (!stack_empty(frames)) {
+        EvalFrame* frame = (EvalFrame*) stack_top(frames);
+        AstNode* node = frame->node;
+
+        if (node->type == AST_OP && !frame->right_done) {
+            frame->right_done = true;
+            push_leaf_dual_block(blocks, constants, descend(frames, node->op.right), xs, n);
+            continue;
+        }
+        stack_pop(frames);
+
+        double* val = (double*) stack_top(blocks);
+        double* der = val + EVAL_BLOCK;
+        Constant* constant = (Constant*) stack_top(constants);
+
+        switch (node->type) {
+        case AST_OP: {
+            // the result goes over the left operand, one block below
+            double* right_val = val;
+            double* right_der = der;
+            val -= 2 * EVAL_BLOCK;
+            der -= 2 * EVAL_BLOCK;
+
+            DualRule rule = dual_op_rule(node, constant[-1], constant[0]);
+
+            // called with a literal operator: the switches of the loop fold away
+            switch (node->op.op) {
+            case OP_ADD: dual_op_block(OP_ADD, &rule, val, der, right_val, right_der, n); break;
+            case OP_SUB: dual_op_block(OP_SUB, &rule, val, der, right_val, right_der, n); break;
+            case OP_MUL: dual_op_block(OP_MUL, &rule, val, der, right_val, right_der, n); break;
+            case OP_DIV: dual_op_block(OP_DIV, &rule, val, der, right_val, right_der, n); break;
+            case OP_POW: dual_op_block(OP_POW, &rule, val, der, right_val, right_der, n); break;
+            }
+
+            stack_pop(blocks);
+            stack_pop(constants);
+            constant[-1] = rule.result;
+            break;
+        }
+        case AST_FUNC:
+            *constant = function_constant(*constant);
+            for (i = 0; i < n; i++) {
+                if (!constant->known) der[i] = dual_function_derivative(node->func.func, val[i], der[i]);
+                val[i] = evaluate_function(node->func.func, val[i]);
+            }
+            break;
+        default:
+            if (node->unary.unary == UNARY_MINUS) {
+                *constant = negate_constant(*constant);
+                for (i = 0; i < n; i++) {
+                    val[i] = -val[i];
+                    der[i] = part(*constant, -der[i]);
+                }
+            }
+            break;
+        }
+    }
+
+    double* val = (double*) stack_pop(blocks);
+    stack_pop(constants);
+    if (values != NULL) memcpy(values, val, n * sizeof(double));
+    if (derivatives != NULL) memcpy(derivatives, val + EVAL_BLOCK, n * sizeof(double));
+}
+
+void evaluate_ast_dual_batch(AstNode* tree, const double* xs, double* values, double* derivatives, size_t n) {
+    EvalFrame frames_local[LOCAL_STACK];
+    Constant constants_local[LOCAL_STACK];
+    Stack frames, blocks, constants;
+    STACK_INIT_LOCAL(&frames, EvalFrame, frames_local);
+    STACK_INIT_LOCAL(&constants, Constant, constants_local);
+    init_stack(&blocks, 2 * EVAL_BLOCK * sizeof(double), NULL, 0);
+
+    for (size_t begin = 0; begin < n; begin += EVAL_BLOCK) {
+        size_t count = n - begin < EVAL_BLOCK ? n - begin : EVAL_BLOCK;
+        evaluate_dual_block(tree, xs + begin,
+            values != NULL ? values + begin : NULL,
+            derivatives != NULL ? derivatives + begin : NULL,
+            count, &frames, &blocks, &constants);
+    }
+
+    free_stack(&frames);
+    free_stack(&blocks);
+    free_stack(&constants);
+}
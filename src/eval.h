@@ -0,0 +1,45 @@
+#ifndef __EVAL_H__
+#define __EVAL_H__
+
+#include <stddef.h>
+#include "ast.h"
+
+/*
+numeric evaluation of an ast tree (any tree: parse(), derivative_expression(), ...)
+ln = natural log, log = log10, errors follow the math library (NaN, inf)
+NULL tree or FUNC_INVALID gives NaN
+*/
+
+// value of 'func' at 'arg'
+double evaluate_function(Function func, double arg);
+
+// value of the tree at x
+double evaluate_ast(AstNode* tree, double x);
+
+// out[i] = value of the tree at xs[i] (i < n)
+// walks the tree once per block of points instead of once per point
+void evaluate_ast_batch(AstNode* tree, const double* xs, double* out, size_t n);
+
+
+/*
+forward-mode automatic differentiation: f(x) and f'(x) in one walk of the parsed tree,
+without building derivative_expression(tree).
+the derivative follows the rules of derivative.h operation by operation,
+folds included: a part the symbolic derivative folds to a number is that number here too,
+whatever the rest evaluates to (0 * ln(x-3), ln(x-3) ^ 0 and (x - x)' = 1 - 1 give 0, not NaN).
+so it gives the same numbers as evaluate_ast(derivative_expression(tree), x), up to the sign of a 0
+(f^g with a non constant g is differentiated as exp(ln(f) * g): NaN for f <= 0, like the symbolic path)
+*/
+
+typedef struct {
+    double value;      // f(x)
+    double derivative; // f'(x)
+} Dual;
+
+Dual evaluate_ast_dual(AstNode* tree, double x);
+
+// values[i] = f(xs[i]), derivatives[i] = f'(xs[i]) (i < n)
+// either output may be NULL if not needed
+void evaluate_ast_dual_batch(AstNode* tree, const double* xs, double* values, double* derivatives, size_t n);
+
+#endif
@@ -0,0 +1,278 @@
+#include "hashcons.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "calc.h"
+#include "stack.h"
+
+
+#define HASHCONS_INITIAL_CAPACITY 1024
+
+
+static uint64_t hash_mix(uint64_t h, uint64_t v) {
+    h ^= v + 0x9e3779b97f4a7c15ULL + (h << 6) + (h >> 2);
+    return h;
+}
+
+static uint64_t hash_finish(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+// children are interned so hashing their address is enough (no recursion)
+static size_t hash_node(const AstNode* node) {
+    uint64_t h = hash_mix(0, node->type);
+
+    switch (node->type) {
+    case AST_NUM: {
+        uint64_t bits;
+        memcpy(&bits, &node->number, sizeof(bits));
+        h = hash_mix(h, bits);
+        break;
+    }
+    case AST_VAR:
+        break;
+    case AST_OP:
+        h = hash_mix(h, node->op.op);
+        h = hash_mix(h, (uintptr_t) node->op.left);
+        h = hash_mix(h, (uintptr_t) node->op.right);
+        break;
+    case AST_FUNC:
+        h = hash_mix(h, node->func.func);
+        h = hash_mix(h, (uintptr_t) node->func.arg);
+        break;
+    case AST_UNARY:
+        h = hash_mix(h, node->unary.unary);
+        h = hash_mix(h, (uintptr_t) node->unary.operand);
+        break;
+    }
+
+    return (size_t) hash_finish(h);
+}
+
+// shallow equality: children are compared by address
+static bool node_equal(const AstNode* a, const AstNode* b) {
+    if (a->type != b->type) return false;
+
+    switch (a->type) {
+    case AST_NUM:
+        // bitwise, so 0 and -0 are different nodes
+        return memcmp(&a->number, &b->number, sizeof(double)) == 0;
+    case AST_VAR:
+        return true;
+    case AST_OP:
+        return a->op.op == b->op.op && a->op.left == b->op.left && a->op.right == b->op.right;
+    case AST_FUNC:
+        return a->func.func == b->func.func && a->func.arg == b->func.arg;
+    case AST_UNARY:
+        return a->unary.unary == b->unary.unary && a->unary.operand == b->unary.operand;
+    }
+
+    return false;
+}
+
+
+HashCons* create_hashcons() {
+    HashCons* hc = (HashCons*) malloc(sizeof(HashCons));
+    hc->arena = create_arena(0);
+    hc->capacity = HASHCONS_INITIAL_CAPACITY;
+    hc->size = 0;
+    hc->nodes = (AstNode**) calloc(hc->capacity, sizeof(AstNode*));
+    hc->hashes = (size_t*) malloc(hc->capacity * sizeof(size_t));
+    init_ptrmap(&hc->derivatives);
+    return hc;
+}
+
+void destroy_hashcons(HashCons* hc) {
+    if (hc == NULL) return;
+
+    destroy_arena(hc->arena);
+    free(hc->nodes);
+    free(hc->hashes);
+    free_ptrmap(&hc->derivatives);
+    free(hc);
+}
+
+static void grow_hashcons(HashCons* hc) {
+    AstNode** old_nodes = hc->nodes;
+    size_t* old_hashes = hc->hashes;
+    size_t old_capacity = hc->capacity;
+
+    hc->capacity *= 2;
+    hc->nodes = (AstNode**) calloc(hc->capacity, sizeof(AstNode*));
+    hc->hashes = (size_t*) malloc(hc->capacity * sizeof(size_t));
+
+    size_t mask = hc->capacity - 1;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_nodes[i] == NULL) continue;
+
+        size_t slot = old_hashes[i] & mask;
+        while (hc->nodes[slot] != NULL) slot = (slot + 1) & mask;
+
+        hc->nodes[slot] = old_nodes[i];
+        hc->hashes[slot] = old_hashes[i];
+    }
+
+    free(old_nodes);
+    free(old_hashes);
+}
+
+// return the interned node equal to 'key', interning a copy of it if there is none
+static AstNode* intern(HashCons* hc, const AstNode* key) {
+    size_t hash = hash_node(key);
+    size_t mask = hc->capacity - 1;
+    size_t slot = hash & mask;
+
+    while (hc->nodes[slot] != NULL) {
+        if (hc->hashes[slot] == hash && node_equal(hc->nodes[slot], key)) {
+            return hc->nodes[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    AstNode* node = (AstNode*) arena_alloc(hc->arena, sizeof(AstNode));
+    *node = *key;
+    node->flags = AST_FLAG_ARENA | AST_FLAG_SHARED;
+
+    hc->nodes[slot] = node;
+    hc->hashes[slot] = hash;
+    hc->size++;
+
+    // keep load factor under 1/2
+    if (hc->size * 2 > hc->capacity) grow_hashcons(hc);
+
+    return node;
+}
+
+
+AstNode* intern_num_node(HashCons* hc, double num) {
+    AstNode key = { .type = AST_NUM, .number = num };
+    return intern(hc, &key);
+}
+
+AstNode* intern_var_node(HashCons* hc) {
+    AstNode key = { .type = AST_VAR };
+    return intern(hc, &key);
+}
+
+AstNode* intern_op_node(HashCons* hc, Operator op, AstNode* left, AstNode* right) {
+    AstNode key = { .type = AST_OP, .op = { op, left, right } };
+    return intern(hc, &key);
+}
+
+AstNode* intern_func_node(HashCons* hc, Function func, AstNode* arg) {
+    AstNode key = { .type = AST_FUNC, .func = { func, arg } };
+    return intern(hc, &key);
+}
+
+AstNode* intern_unary_node(HashCons* hc, Unary unary, AstNode* operand) {
+    AstNode key = { .type = AST_UNARY, .unary = { unary, operand } };
+    return intern(hc, &key);
+}
+
+
+AstNode* intern_fold_op_node(HashCons* hc, Operator op, AstNode* left, AstNode* right) {
+    double value;
+
+    switch (fold_op(op, left, right, &value)) {
+    case FOLD_NUMBER: return intern_num_node(hc, value);
+    case FOLD_LEFT: return left;
+    case FOLD_RIGHT: return right;
+    case FOLD_NEGATE: return intern_fold_unary_node(hc, UNARY_MINUS, right);
+    default: return intern_op_node(hc, op, left, right);
+    }
+}
+
+AstNode* intern_fold_func_node(HashCons* hc, Function func, AstNode* arg) {
+    double value;
+
+    if (fold_func(func, arg, &value) == FOLD_NUMBER) return intern_num_node(hc, value);
+    return intern_func_node(hc, func, arg);
+}
+
+AstNode* intern_fold_unary_node(HashCons* hc, Unary unary, AstNode* operand) {
+    double value;
+
+    switch (fold_unary(unary, operand, &value)) {
+    case FOLD_NUMBER: return intern_num_node(hc, value);
+    case FOLD_LEFT: return operand;
+    case FOLD_INNER: return operand->unary.operand;
+    default: return intern_unary_node(hc, unary, operand);
+    }
+}
+
+
+typedef struct {
+    AstNode* node;
+    bool children_done;
+} InternFrame;
+
+#define LOCAL_STACK 64
+
+// postorder with an explicit stack (no recursion: any depth)
+// the interned children wait on 'done' until their parent is interned
+AstNode* intern_ast_node(HashCons* hc, AstNode* tree) {
+    if (tree == NULL) return NULL;
+    if (tree->flags & AST_FLAG_SHARED) return tree; // already interned
+
+    InternFrame frames_local[LOCAL_STACK];
+    AstNode* done_local[LOCAL_STACK];
+    Stack frames, done;
+    STACK_INIT_LOCAL(&frames, InternFrame, frames_local);
+    STACK_INIT_LOCAL(&done, AstNode*, done_local);
+
+    *(InternFrame*) stack_push(&frames) = (InternFrame) { tree, false };
+
+    while (!stack_empty(&frames)) {
+        InternFrame* frame = (InternFrame*) stack_top(&frames);
+        AstNode* node = frame->node;
+
+        if (node == NULL || (node->flags & AST_FLAG_SHARED) || node->type == AST_NUM || node->type == AST_VAR) {
+            stack_pop(&frames);
+            AstNode* interned = node;
+            if (node != NULL && !(node->flags & AST_FLAG_SHARED)) {
+                interned = node->type == AST_NUM ? intern_num_node(hc, node->number) : intern_var_node(hc);
+            }
+            *(AstNode**) stack_push(&done) = interned;
+            continue;
+        }
+
+        if (!frame->children_done) {
+            frame->children_done = true;
+            // the right child is pushed first so the left one is interned first
+            if (node->type == AST_OP) {
+                *(InternFrame*) stack_push(&frames) = (InternFrame) { node->op.right, false };
+                *(InternFrame*) stack_push(&frames) = (InternFrame) { node->op.left, false };
+            } else if (node->type == AST_FUNC) {
+                *(InternFrame*) stack_push(&frames) = (InternFrame) { node->func.arg, false };
+            } else {
+                *(InternFrame*) stack_push(&frames) = (InternFrame) { node->unary.operand, false };
+            }
+            continue;
+        }
+        stack_pop(&frames);
+
+        AstNode* interned;
+        if (node->type == AST_OP) {
+            AstNode* right = *(AstNode**) stack_pop(&done);
+            AstNode* left = *(AstNode**) stack_pop(&done);
+            interned = intern_op_node(hc, node->op.op, left, right);
+        } else if (node->type == AST_FUNC) {
+            interned = intern_func_node(hc, node->func.func, *(AstNode**) stack_pop(&done));
+        } else {
+            interned = intern_unary_node(hc, node->unary.unary, *(AstNode**) stack_pop(&done));
+        }
+        *(AstNode**) stack_push(&done) = interned;
+    }
+
+    AstNode* interned = *(AstNode**) stack_pop(&done);
+    free_stack(&frames);
+    free_stack(&done);
+    return interned;
+}
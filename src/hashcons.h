@@ -0,0 +1,60 @@
+#ifndef __HASHCONS_H__
+#define __HASHCONS_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "ast.h"
+#include "arena.h"
+#include "ptrmap.h"
+
+/*
+Hash-consed (interned) node store:
+every structurally distinct node exists only once in the store,
+so trees built with intern_* become DAGs that share their subtrees
+and two interned nodes are equal if and only if their pointers are equal.
+
+interned nodes are immutable and owned by the store (AST_FLAG_SHARED | AST_FLAG_ARENA)
+-> destroy_ast_node does nothing for them, 'destroy_hashcons' frees them all
+-> simplify_ast_node copies them before any change (copy on write),
+   anything else that modifies a tree must not be given them
+*/
+
+typedef struct {
+    Arena* arena; // memory of the interned nodes
+
+    // open addressing hash table of the interned nodes
+    AstNode** nodes;
+    size_t* hashes;
+    size_t capacity; // always power of 2
+    size_t size;
+
+    // interned node -> its interned derivative (see derivative_expression_shared)
+    PtrMap derivatives;
+} HashCons;
+
+
+HashCons* create_hashcons();
+void destroy_hashcons(HashCons* hc);
+
+// children must be interned in the same store
+AstNode* intern_num_node(HashCons* hc, double num);
+AstNode* intern_var_node(HashCons* hc);
+AstNode* intern_op_node(HashCons* hc, Operator op, AstNode* left, AstNode* right);
+AstNode* intern_func_node(HashCons* hc, Function func, AstNode* arg);
+AstNode* intern_unary_node(HashCons* hc, Unary unary, AstNode* operand);
+
+// intern_* applying the rules of the folding constructors (calc.h)
+// x * 1 returns x itself, 0 * x the interned 0
+AstNode* intern_fold_op_node(HashCons* hc, Operator op, AstNode* left, AstNode* right);
+AstNode* intern_fold_func_node(HashCons* hc, Function func, AstNode* arg);
+AstNode* intern_fold_unary_node(HashCons* hc, Unary unary, AstNode* operand);
+
+// intern a whole tree (the tree is not modified nor destroyed)
+AstNode* intern_ast_node(HashCons* hc, AstNode* tree);
+
+// O(1) because of interning (both must be from the same store)
+static inline bool interned_equal(AstNode* a, AstNode* b) {
+    return a == b;
+}
+
+#endif
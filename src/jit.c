@@ -0,0 +1,386 @@
+#include "jit.h"
+#include "balance.h"
+#include "stack.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__unix__) || defined(__APPLE__))
+#define JIT_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+
+#ifdef JIT_SUPPORTED
+
+/*
+code shape:
+every subtree leaves its value in xmm0.
+x lives in the stack frame [rsp], the left operand of a binary op is spilled to [rsp + 8*depth]
+while the right one is computed (libm calls clobber every xmm register anyway).
+numbers are in a constant pool after the code, addressed rip-relative.
+*/
+
+typedef struct {
+    uint8_t* code;
+    size_t size;
+    size_t capacity;
+
+    // constant pool (placed after the code)
+    double* constants;
+    int constant_count;
+    int constant_capacity;
+
+    // rip-relative disp32 to patch once the pool address is known
+    struct { size_t pos; int constant; } *fixups;
+    int fixup_count;
+    int fixup_capacity;
+
+    int max_depth; // spill slots needed
+} Assembler;
+
+// index of the sign mask (two doubles for xorpd, 16-byte aligned) in the pool
+#define SIGN_MASK_CONSTANT 0
+
+
+static void emit_bytes(Assembler* as, const void* bytes, size_t len) {
+    if (as->size + len > as->capacity) {
+        while (as->size + len > as->capacity) as->capacity = as->capacity == 0 ? 256 : as->capacity * 2;
+        as->code = (uint8_t*) realloc(as->code, as->capacity);
+    }
+
+    memcpy(as->code + as->size, bytes, len);
+    as->size += len;
+}
+
+static void emit_u32(Assembler* as, uint32_t v) {
+    emit_bytes(as, &v, 4);
+}
+
+static int add_constant(Assembler* as, double value) {
+    if (as->constant_count == as->constant_capacity) {
+        as->constant_capacity = as->constant_capacity == 0 ? 16 : as->constant_capacity * 2;
+        as->constants = (double*) realloc(as->constants, as->constant_capacity * sizeof(double));
+    }
+
+    as->constants[as->constant_count] = value;
+    return as->constant_count++;
+}
+
+// disp32 of a rip-relative operand pointing at constant 'index'
+// (always the last 4 bytes of the instruction)
+static void emit_constant_ref(Assembler* as, int index) {
+    if (as->fixup_count == as->fixup_capacity) {
+        as->fixup_capacity = as->fixup_capacity == 0 ? 16 : as->fixup_capacity * 2;
+        as->fixups = realloc(as->fixups, as->fixup_capacity * sizeof(*as->fixups));
+    }
+
+    as->fixups[as->fixup_count].pos = as->size;
+    as->fixups[as->fixup_count].constant = index;
+    as->fixup_count++;
+    emit_u32(as, 0);
+}
+
+
+// SSE2 opcodes (F2 0F xx), for xmm0 = xmm0 op operand
+#define SSE_MOVSD_LOAD 0x10
+#define SSE_MOVSD_STORE 0x11
+#define SSE_ADDSD 0x58
+#define SSE_MULSD 0x59
+#define SSE_SUBSD 0x5C
+#define SSE_DIVSD 0x5E
+
+// op xmm<reg>, [rsp + disp32]   (movsd store: [rsp + disp32], xmm<reg>)
+static void emit_sse_stack(Assembler* as, uint8_t opcode, int reg, int32_t disp) {
+    uint8_t bytes[] = { 0xF2, 0x0F, opcode, (uint8_t) (0x84 | reg << 3), 0x24 };
+    emit_bytes(as, bytes, sizeof(bytes));
+    emit_u32(as, (uint32_t) disp);
+}
+
+// op xmm<reg>, [rip + constant]
+static void emit_sse_constant(Assembler* as, uint8_t opcode, int reg, int constant) {
+    uint8_t bytes[] = { 0xF2, 0x0F, opcode, (uint8_t) (0x05 | reg << 3) };
+    emit_bytes(as, bytes, sizeof(bytes));
+    emit_constant_ref(as, constant);
+}
+
+// op xmm0, xmm1
+static void emit_sse_xmm1(Assembler* as, uint8_t opcode) {
+    uint8_t bytes[] = { 0xF2, 0x0F, opcode, 0xC1 };
+    emit_bytes(as, bytes, sizeof(bytes));
+}
+
+// movapd xmm1, xmm0
+static void emit_move_xmm0_to_xmm1(Assembler* as) {
+    uint8_t bytes[] = { 0x66, 0x0F, 0x28, 0xC8 };
+    emit_bytes(as, bytes, sizeof(bytes));
+}
+
+// mov rax, imm64; call rax
+static void emit_call(Assembler* as, void* func) {
+    uint8_t mov[] = { 0x48, 0xB8 };
+    uint64_t address = (uint64_t) (uintptr_t) func;
+    uint8_t call[] = { 0xFF, 0xD0 };
+
+    emit_bytes(as, mov, sizeof(mov));
+    emit_bytes(as, &address, 8);
+    emit_bytes(as, call, sizeof(call));
+}
+
+static int32_t slot_disp(int slot) {
+    return slot * 8;
+}
+
+// leaf operand (number or x) of an instruction: no register needed
+static bool is_leaf(AstNode* node) {
+    return node != NULL && (node->type == AST_NUM || node->type == AST_VAR);
+}
+
+static void emit_sse_leaf(Assembler* as, uint8_t opcode, int reg, AstNode* leaf) {
+    if (leaf->type == AST_VAR) {
+        emit_sse_stack(as, opcode, reg, slot_disp(0));
+    } else {
+        emit_sse_constant(as, opcode, reg, add_constant(as, leaf->number));
+    }
+}
+
+static void* function_address(Function func) {
+    switch (func) {
+    case FUNC_SIN: return (void*) sin;
+    case FUNC_COS: return (void*) cos;
+    case FUNC_TAN: return (void*) tan;
+    case FUNC_LN: return (void*) log;
+    case FUNC_LOG: return (void*) log10;
+    case FUNC_EXP: return (void*) exp;
+    default: return NULL;
+    }
+}
+
+static uint8_t operator_opcode(Operator op) {
+    switch (op) {
+    case OP_ADD: return SSE_ADDSD;
+    case OP_SUB: return SSE_SUBSD;
+    case OP_MUL: return SSE_MULSD;
+    case OP_DIV: return SSE_DIVSD;
+    default: return 0; // OP_POW is a call
+    }
+}
+
+typedef struct {
+    AstNode* node;
+    int depth; // spill slots in use by the callers
+    int operands_done; // operands compiled so far (0 = the node is not visited yet)
+} JitFrame;
+
+#define LOCAL_STACK 64
+
+// value of the tree -> xmm0
+// slots 1..depth hold spilled values of the callers
+// postorder with an explicit stack (no recursion: any depth), the code is emitted in the same order
+static void compile_jit_node(Assembler* as, AstNode* tree, int depth) {
+    JitFrame frames_local[LOCAL_STACK];
+    Stack frames;
+    STACK_INIT_LOCAL(&frames, JitFrame, frames_local);
+
+    *(JitFrame*) stack_push(&frames) = (JitFrame) { tree, depth, 0 };
+
+    while (!stack_empty(&frames)) {
+        JitFrame* frame = (JitFrame*) stack_top(&frames);
+        AstNode* node = frame->node;
+        int node_depth = frame->depth;
+        int slot = node_depth + 1; // spill slot of a binary node
+
+        if (node == NULL || (node->type == AST_FUNC && function_address(node->func.func) == NULL)) {
+            emit_sse_constant(as, SSE_MOVSD_LOAD, 0, add_constant(as, NAN));
+            stack_pop(&frames);
+            continue;
+        }
+
+        switch (node->type) {
+        case AST_NUM:
+        case AST_VAR:
+            emit_sse_leaf(as, SSE_MOVSD_LOAD, 0, node);
+            stack_pop(&frames);
+            break;
+        case AST_OP: {
+            Operator op = node->op.op;
+            AstNode* right = node->op.right;
+
+            if (frame->operands_done == 0) {
+                frame->operands_done = 1;
+                *(JitFrame*) stack_push(&frames) = (JitFrame) { node->op.left, node_depth, 0 };
+                break;
+            }
+
+            if (frame->operands_done == 1 && is_leaf(right)) {
+                if (op == OP_POW) {
+                    emit_sse_leaf(as, SSE_MOVSD_LOAD, 1, right);
+                    emit_call(as, (void*) pow);
+                } else {
+                    emit_sse_leaf(as, operator_opcode(op), 0, right);
+                }
+                stack_pop(&frames);
+                break;
+            }
+
+            if (frame->operands_done == 1) {
+                // spill the left value while computing the right one
+                if (slot > as->max_depth) as->max_depth = slot;
+
+                emit_sse_stack(as, SSE_MOVSD_STORE, 0, slot_disp(slot));
+                frame->operands_done = 2;
+                *(JitFrame*) stack_push(&frames) = (JitFrame) { right, slot, 0 };
+                break;
+            }
+
+            if (op == OP_ADD || op == OP_MUL) {
+                // commutative: xmm0 = right op left
+                emit_sse_stack(as, operator_opcode(op), 0, slot_disp(slot));
+            } else {
+                emit_move_xmm0_to_xmm1(as);
+                emit_sse_stack(as, SSE_MOVSD_LOAD, 0, slot_disp(slot));
+                if (op == OP_POW) {
+                    emit_call(as, (void*) pow);
+                } else {
+                    emit_sse_xmm1(as, operator_opcode(op));
+                }
+            }
+            stack_pop(&frames);
+            break;
+        }
+        case AST_FUNC:
+            if (frame->operands_done == 0) {
+                frame->operands_done = 1;
+                *(JitFrame*) stack_push(&frames) = (JitFrame) { node->func.arg, node_depth, 0 };
+                break;
+            }
+            emit_call(as, function_address(node->func.func));
+            stack_pop(&frames);
+            break;
+        case AST_UNARY:
+            if (frame->operands_done == 0) {
+                frame->operands_done = 1;
+                *(JitFrame*) stack_push(&frames) = (JitFrame) { node->unary.operand, node_depth, 0 };
+                break;
+            }
+            if (node->unary.unary == UNARY_MINUS) {
+                // xorpd xmm0, [rip + sign mask]
+                uint8_t bytes[] = { 0x66, 0x0F, 0x57, 0x05 };
+                emit_bytes(as, bytes, sizeof(bytes));
+                emit_constant_ref(as, SIGN_MASK_CONSTANT);
+            }
+            stack_pop(&frames);
+            break;
+        }
+    }
+
+    free_stack(&frames);
+}
+
+static void free_assembler(Assembler* as) {
+    free(as->code);
+    free(as->constants);
+    free(as->fixups);
+}
+
+JitFunction* jit_compile(AstNode* tree) {
+    Assembler body = { 0 };
+
+    // sign mask for negation, two lanes because xorpd reads 16 bytes
+    double sign_mask;
+    uint64_t sign_bits = 0x8000000000000000ULL;
+    memcpy(&sign_mask, &sign_bits, sizeof(double));
+    add_constant(&body, sign_mask);
+    add_constant(&body, sign_mask);
+
+    if (get_strict_fp()) {
+        compile_jit_node(&body, tree, 0);
+    } else {
+        AstNode* balanced = balance_ast(tree);
+        compile_jit_node(&body, balanced, 0);
+        destroy_ast_node(balanced);
+    }
+
+    // frame: x + spill slots, rsp % 16 == 8 at entry so the frame size % 16 == 8 keeps calls aligned
+    uint32_t frame = (uint32_t) (body.max_depth + 1) * 8;
+    if (frame % 16 == 0) frame += 8;
+
+    // prologue: sub rsp, frame; movsd [rsp], xmm0
+    Assembler as = { 0 };
+    uint8_t sub_rsp[] = { 0x48, 0x81, 0xEC };
+    emit_bytes(&as, sub_rsp, sizeof(sub_rsp));
+    emit_u32(&as, frame);
+    emit_sse_stack(&as, SSE_MOVSD_STORE, 0, slot_disp(0));
+
+    size_t body_offset = as.size;
+    emit_bytes(&as, body.code, body.size);
+
+    // epilogue: add rsp, frame; ret
+    uint8_t add_rsp[] = { 0x48, 0x81, 0xC4 };
+    uint8_t ret[] = { 0xC3 };
+    emit_bytes(&as, add_rsp, sizeof(add_rsp));
+    emit_u32(&as, frame);
+    emit_bytes(&as, ret, sizeof(ret));
+
+    // constant pool, 16-byte aligned
+    size_t pool_offset = (as.size + 15) & ~(size_t) 15;
+    size_t total = pool_offset + body.constant_count * sizeof(double);
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t mapped = (total + page - 1) / page * page;
+
+    uint8_t* mem = mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED) {
+        free_assembler(&body);
+        free_assembler(&as);
+        return NULL;
+    }
+
+    memset(mem, 0xCC, mapped); // int3 padding
+    memcpy(mem, as.code, as.size);
+    memcpy(mem + pool_offset, body.constants, body.constant_count * sizeof(double));
+
+    for (int i = 0; i < body.fixup_count; i++) {
+        size_t pos = body_offset + body.fixups[i].pos;
+        size_t target = pool_offset + body.fixups[i].constant * sizeof(double);
+        int32_t disp = (int32_t) (target - (pos + 4)); // relative to the end of the instruction
+        memcpy(mem + pos, &disp, 4);
+    }
+
+    free_assembler(&body);
+    free_assembler(&as);
+
+    // W^X: never writable and executable at the same time
+    if (mprotect(mem, mapped, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, mapped);
+        return NULL;
+    }
+
+    JitFunction* jit = (JitFunction*) malloc(sizeof(JitFunction));
+    jit->code = mem;
+    jit->size = mapped;
+    jit->fn = (JitFn) (void*) mem;
+    return jit;
+}
+
+void destroy_jit_function(JitFunction* jit) {
+    if (jit == NULL) return;
+
+    munmap(jit->code, jit->size);
+    free(jit);
+}
+
+#else
+
+JitFunction* jit_compile(AstNode* tree) {
+    (void) tree;
+    return NULL;
+}
+
+void destroy_jit_function(JitFunction* jit) {
+    (void) jit;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef __JIT_H__
+#define __JIT_H__
+
+#include <stddef.h>
+#include "ast.h"
+
+/*
+x86-64 JIT: the tree is lowered straight to machine code (SSE2 scalar double)
+in its own executable page, callable as a plain double (*)(double).
+sin, cos, tan, ln, log, exp and ^ call libm, so the results are bitwise equal to evaluate_ast
+in strict fp (balance.h), otherwise chains of + and * are compiled balanced and may round differently.
+only for x86-64 System V (Linux, BSD, macOS); elsewhere jit_compile returns NULL.
+*/
+
+typedef double (*JitFn)(double x);
+
+typedef struct {
+    JitFn fn;
+    void* code; // mmap'd page(s)
+    size_t size;
+} JitFunction;
+
+
+// the tree is only read, it can be destroyed after compiling
+// return NULL if not supported here or the page could not be made executable
+JitFunction* jit_compile(AstNode* tree);
+void destroy_jit_function(JitFunction* jit);
+
+#endif
@@ -0,0 +1,116 @@
+#include "linereader.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+
+// pages are given back by steps of this many bytes (one madvise per step)
+#define RELEASE_STEP (16 * 1024 * 1024)
+
+
+// map a regular file, false if it is not one or it cannot be mapped
+static bool map_file(LineReader* reader, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) return false;
+
+    void* map = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) return false;
+
+    madvise(map, (size_t) st.st_size, MADV_SEQUENTIAL); // read ahead, drop behind
+
+    reader->map = (const char*) map;
+    reader->size = (size_t) st.st_size;
+    return true;
+}
+
+bool init_line_reader(LineReader* reader, const char* path) {
+    reader->map = NULL;
+    reader->size = 0;
+    reader->released = 0;
+    reader->stream = NULL;
+    reader->close_stream = false;
+    reader->buffer = NULL;
+    reader->buffer_capacity = 0;
+    reader->offset = 0;
+
+    if (path == NULL || strcmp(path, "-") == 0) {
+        reader->stream = stdin;
+        return true;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    bool mapped = map_file(reader, fd);
+    close(fd); // the mapping stays valid
+
+    if (!mapped) {
+        // a pipe, a device or an empty file: read it as a stream
+        reader->stream = fopen(path, "r");
+        if (reader->stream == NULL) return false;
+        reader->close_stream = true;
+    }
+
+    return true;
+}
+
+void free_line_reader(LineReader* reader) {
+    if (reader->map != NULL) munmap((void*) reader->map, reader->size);
+    if (reader->close_stream) fclose(reader->stream);
+    free(reader->buffer);
+
+    reader->map = NULL;
+    reader->stream = NULL;
+    reader->buffer = NULL;
+}
+
+size_t trim_line_ending(const char* text, size_t bytes) {
+    size_t length = bytes;
+    if (length > 0 && text[length - 1] == '\n') length--;
+    if (length > 0 && text[length - 1] == '\r') length--;
+    return length;
+}
+
+bool read_line(LineReader* reader, Line* line) {
+    line->offset = reader->offset;
+
+    if (reader->map != NULL) {
+        if (reader->offset >= reader->size) return false;
+
+        const char* begin = reader->map + reader->offset;
+        size_t left = reader->size - reader->offset;
+        const char* newline = (const char*) memchr(begin, '\n', left);
+
+        line->text = begin;
+        line->bytes = newline != NULL ? (size_t) (newline - begin) + 1 : left;
+    } else {
+        ssize_t bytes = getline(&reader->buffer, &reader->buffer_capacity, reader->stream);
+        if (bytes == -1) return false;
+
+        line->text = reader->buffer;
+        line->bytes = (size_t) bytes;
+    }
+
+    line->length = trim_line_ending(line->text, line->bytes);
+    reader->offset += line->bytes;
+    return true;
+}
+
+void release_lines(LineReader* reader, size_t offset) {
+    if (reader->map == NULL) return;
+
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t end = offset / page * page; // whole pages only
+    if (end < reader->released + RELEASE_STEP) return;
+
+    // the mapping is read only: the pages are read from the file again if touched
+    madvise((void*) (reader->map + reader->released), end - reader->released, MADV_DONTNEED);
+    reader->released = end;
+}
@@ -0,0 +1,55 @@
+#ifndef __LINEREADER_H__
+#define __LINEREADER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+lines of an input file, for the batch mode:
+a regular file is mapped in memory (mmap) and every line is a slice of the mapping,
+nothing is copied and the tokens point straight into the file.
+the pages already read can be given back (release_lines), so the memory used
+stays the same whatever the size of the file.
+anything else (stdin, a pipe) is read line by line into one reused buffer (getline).
+*/
+
+typedef struct {
+    // mapped file, map == NULL for a stream
+    const char* map;
+    size_t size;
+    size_t released; // the mapping before it was given back to the system
+
+    // stream
+    FILE* stream;
+    bool close_stream;
+    char* buffer;
+    size_t buffer_capacity;
+
+    size_t offset; // of the next line in the input
+} LineReader;
+
+typedef struct {
+    const char* text; // not null-terminated: in the mapping, or in the buffer until the next read_line
+    size_t length; // without the line ending ("\n" or "\r\n")
+    size_t bytes; // with the line ending, as read
+    size_t offset; // of the line in the input (bytes)
+} Line;
+
+
+// path NULL or "-" = stdin
+// return false (errno set) if the file cannot be opened
+bool init_line_reader(LineReader* reader, const char* path);
+void free_line_reader(LineReader* reader);
+
+// return false at the end of the input
+bool read_line(LineReader* reader, Line* line);
+
+// Line.length from Line.bytes: the line without its ending ("\n" or "\r\n")
+size_t trim_line_ending(const char* text, size_t bytes);
+
+// the input before 'offset' will not be read again (no-op for a stream)
+// its pages are given back once there is enough of them
+void release_lines(LineReader* reader, size_t offset);
+
+#endif
@@ -1,52 +1,670 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "ast.h"
 #include "derivative.h"
 #include "parse.h"
 #include "ast.h"
 #include "calc.h"
+#include "arena.h"
+#include "taylor.h"
+#include "canon.h"
+#include "egraph.h"
+#include "cse.h"
+#include "strbuf.h"
+#include "linereader.h"
+
+
+typedef struct {
+    int taylor_order; // --taylor K: print f(x) .. f^(K)(x) at --at X instead of f'
+    double at;
+    int order; // --order N: print f', f'', .., f^(N)
+    bool canonical; // --canonical: print everything in canonical form (canon.h)
+    bool simplify; // --simplify: simplify f and its derivatives (calc.h)
+    const CostModel* egraph; // --egraph size|speed: cheapest equivalent of everything printed (egraph.h)
+    bool cse; // --cse: print repeated subexpressions once as temporaries (cse.h)
+    bool batch; // --batch [FILE]: one expression per line of FILE (default stdin), one record per line
+    const char* batch_file; // NULL or "-" = stdin
+    int threads; // --threads N: workers of --batch (0 = one per core)
+    bool stream; // --stream: parse the input line while it is read, any length (parse_stream)
+} Options;
+
+static void print_usage(const char* program) {
+    fprintf(stderr, "usage: %s [--order N] [--simplify] [--egraph size|speed] [--canonical] [--cse] [--taylor K --at X] [--stream | --batch [FILE] [--threads N]]\n", program);
+}
+
+static bool parse_options(int argc, char** argv, Options* options) {
+    options->taylor_order = -1;
+    options->at = 0;
+    options->order = 1;
+    options->canonical = false;
+    options->simplify = false;
+    options->egraph = NULL;
+    options->cse = false;
+    options->batch = false;
+    options->batch_file = NULL;
+    options->threads = 1;
+    options->stream = false;
+
+    for (int i = 1; i < argc; i++) {
+        char* end;
+
+        if (strcmp(argv[i], "--taylor") == 0 && i + 1 < argc) {
+            long order = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || end == argv[i] || order < 0 || order > 170) { // 171! overflows
+                fprintf(stderr, "Invalid order '%s'\n", argv[i]);
+                return false;
+            }
+            options->taylor_order = (int) order;
+        } else if (strcmp(argv[i], "--order") == 0 && i + 1 < argc) {
+            long order = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || end == argv[i] || order < 1 || order > 1000) {
+                fprintf(stderr, "Invalid order '%s'\n", argv[i]);
+                return false;
+            }
+            options->order = (int) order;
+        } else if (strcmp(argv[i], "--simplify") == 0) {
+            options->simplify = true;
+        } else if (strcmp(argv[i], "--egraph") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "size") == 0) {
+                options->egraph = &COST_SIZE;
+            } else if (strcmp(argv[i], "speed") == 0) {
+                options->egraph = &COST_SPEED;
+            } else {
+                fprintf(stderr, "Invalid cost model '%s'\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--canonical") == 0) {
+            options->canonical = true;
+        } else if (strcmp(argv[i], "--cse") == 0) {
+            options->cse = true;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            long threads = strtol(argv[++i], &end, 10);
+            if (*end != '\0' || end == argv[i] || threads < 0 || threads > 1024) {
+                fprintf(stderr, "Invalid thread count '%s'\n", argv[i]);
+                return false;
+            }
+            if (threads == 0) threads = sysconf(_SC_NPROCESSORS_ONLN);
+            options->threads = threads > 0 ? (int) threads : 1;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            options->stream = true;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            options->batch = true;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) options->batch_file = argv[++i];
+        } else if (strcmp(argv[i], "--at") == 0 && i + 1 < argc) {
+            options->at = strtod(argv[++i], &end);
+            if (*end != '\0' || end == argv[i]) {
+                fprintf(stderr, "Invalid point '%s'\n", argv[i]);
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+
+    if (options->batch && options->taylor_order >= 0) {
+        fprintf(stderr, "--taylor does not work with --batch\n");
+        return false;
+    }
+
+    if (options->batch && options->stream) {
+        fprintf(stderr, "--stream does not work with --batch (its lines have no length limit)\n");
+        return false;
+    }
+
+    if (!options->batch && options->threads != 1) {
+        fprintf(stderr, "--threads only works with --batch\n");
+        return false;
+    }
+
+    return true;
+}
+
+// the form of the tree that is printed (cheapest equivalent, canonical form)
+static AstNode* printed_tree(AstNode* tree, const Options* options) {
+    if (options->egraph) tree = egraph_simplify(tree, options->egraph, NULL); // lives in the request arena
+    if (options->canonical) tree = canonicalize_ast(tree); // lives in the request arena
+    return tree;
+}
+
+static void print_tree(AstNode* tree, const Options* options) {
+    tree = printed_tree(tree, options);
+
+    if (options->cse) {
+        Cse* cse = create_cse(tree);
+        cse_fprint(stdout, cse);
+        destroy_cse(cse);
+        return;
+    }
+
+    ast_fprint_infix(stdout, tree);
+    printf("\n");
+}
+
+// f(x), f'(x), f''(x), f'''(x), f^(4)(x), ...
+static void print_taylor(AstNode* tree, int order, double x) {
+    double* derivs = (double*) malloc((order + 1) * sizeof(double));
+    taylor_derivatives(tree, x, order, derivs);
+
+    for (int k = 0; k <= order; k++) {
+        if (k <= 3) {
+            printf("f%.*s(%.10g) = %.15g\n", k, "'''", x, derivs[k]);
+        } else {
+            printf("f^(%d)(%.10g) = %.15g\n", k, x, derivs[k]);
+        }
+    }
+
+    free(derivs);
+}
+
+
+// same as print_tree on one line (temporaries are joined with "; ")
+static void append_tree(StrBuf* out, AstNode* tree, const Options* options) {
+    tree = printed_tree(tree, options);
+
+    if (options->cse) {
+        Cse* cse = create_cse(tree);
+        cse_append(out, cse);
+        destroy_cse(cse);
+        return;
+    }
+
+    ast_append_infix(out, tree);
+}
+
+// the input of an error record, tabs would split the record
+static void append_field(StrBuf* out, const char* str, size_t len) {
+    size_t start = out->len;
+    strbuf_append(out, str, len);
+
+    for (size_t i = start; i < out->len; i++) {
+        if (out->data[i] == '\t') out->data[i] = ' ';
+    }
+}
+
+static double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void append_error(StrBuf* out, const char* line, size_t length, const char* message) {
+    strbuf_append_str(out, "error\t");
+    append_field(out, line, length);
+    strbuf_append_char(out, '\t');
+    strbuf_append_str(out, message);
+    strbuf_append_char(out, '\n');
+}
+
+// the record of one line (without its newline) appended to 'out', return false for an error record
+// 'offset' is where the line starts in the input: errors give their offset in the input
+// the nodes are allocated in the arena of the calling thread (set_ast_arena), reset it after
+static bool append_record(StrBuf* out, const char* line, size_t length, size_t offset, const Options* options) {
+    ParseError error;
+    AstNode* tree = parse_n_error(line, length, &error);
+
+    if (tree == NULL) {
+        char message[128];
+        snprintf(message, sizeof(message), "%s at offset %zu", error.message, offset + error.offset);
+        append_error(out, line, length, message);
+        return false;
+    }
+
+    if (options->simplify) simplify_ast_node(&tree);
+
+    size_t start = out->len;
+    strbuf_append_str(out, "ok\t");
+    append_tree(out, tree, options);
+
+    // orders share their subexpressions in the store (see main)
+    HashCons* hc = options->order > 1 ? create_hashcons() : NULL;
+    AstNode** derivatives = hc != NULL ? derivative_nth(hc, tree, options->order) : NULL;
+
+    bool failed = false;
+    for (int k = 1; k <= options->order; k++) {
+        AstNode* derivative = hc != NULL
+            ? (derivatives != NULL ? derivatives[k] : NULL)
+            : derivative_expression(tree);
+
+        if (derivative == NULL) {
+            failed = true;
+            break;
+        }
+
+        if (options->simplify) simplify_ast_node(&derivative);
+        strbuf_append_char(out, '\t');
+        append_tree(out, derivative, options);
+    }
+
+    free(derivatives);
+    if (hc != NULL) destroy_hashcons(hc);
+
+    if (failed) {
+        out->len = start; // drop the partial record
+        append_error(out, line, length, "derivative error");
+        return false;
+    }
+
+    strbuf_append_char(out, '\n');
+    return true;
+}
+
+static void print_summary(size_t count, size_t errors, size_t bytes, double seconds, int threads) {
+    fprintf(stderr, "%zu expressions (%zu ok, %zu errors), %.2f MB in %.3f s with %d thread%s: "
+            "%.0f expressions/s, %.2f MB/s\n",
+            count, count - errors, errors, bytes / 1e6, seconds, threads, threads > 1 ? "s" : "",
+            seconds > 0 ? count / seconds : 0.0, seconds > 0 ? bytes / 1e6 / seconds : 0.0);
+}
+
+// --batch: one expression per line (any length), one tab separated record per line
+//     ok <TAB> f <TAB> f' [<TAB> f'' ... up to --order]
+//     error <TAB> input <TAB> message at offset N   (N: byte offset in the input)
+// a file is mapped and parsed in place (linereader.h), the record and the arena
+// are reused from one line to the next, stdout is fully buffered
+// and a summary goes to stderr at the end
+static int run_batch(LineReader* reader, const Options* options) {
+    StrBuf record;
+    init_strbuf(&record);
+
+    Arena* arena = create_arena(0);
+    set_ast_arena(arena);
+
+    size_t count = 0, errors = 0, bytes = 0;
+    double begin = now_seconds();
+
+    Line line;
+    while (read_line(reader, &line)) {
+        bytes += line.bytes;
+        count++;
+
+        clear_strbuf(&record);
+        reset_arena(arena); // every node of the previous line
+
+        if (!append_record(&record, line.text, line.length, line.offset, options)) errors++;
+        fwrite(record.data, 1, record.len, stdout);
+
+        release_lines(reader, line.offset + line.bytes);
+    }
+
+    fflush(stdout);
+    print_summary(count, errors, bytes, now_seconds() - begin, 1);
+
+    set_ast_arena(NULL);
+    destroy_arena(arena);
+    free_strbuf(&record);
+    return 0;
+}
+
+
+/*
+--batch with --threads N: a pipeline of
+- one reader thread cutting the input into chunks of lines,
+- N workers turning a chunk into its records, each with its own arena
+  (nodes, hash-consing stores and refcounts are never shared between threads),
+- the writer (main thread) writing the chunks back in input order.
+a fixed pool of chunks circulates between the stages, so the buffers are reused
+and the reader waits when the writer falls behind (bounded memory).
+the chunks of a mapped file are slices of the mapping, the writer gives
+their pages back once they are written.
+*/
+
+#define CHUNK_LINES 1024
+#define CHUNK_BYTES (64 * 1024)
+#define CHUNKS_PER_THREAD 4
+
+typedef struct Chunk {
+    size_t seq; // position in the input
+    const char* text; // the lines as read: a slice of the mapping, or 'copy'
+    size_t bytes;
+    size_t offset; // of the first line in the input
+    size_t lines;
+    StrBuf copy; // the lines of a stream
+    StrBuf output; // the records
+    size_t errors;
+    struct Chunk* next; // in the free list or the work queue
+} Chunk;
+
+typedef struct {
+    LineReader* reader;
+    const Options* options;
+
+    pthread_mutex_t lock;
+    pthread_cond_t has_free; // reader waits for an empty chunk
+    pthread_cond_t has_work; // workers wait for a filled chunk
+    pthread_cond_t has_done; // writer waits for the next chunk in order
+
+    Chunk* chunks;
+    size_t chunk_count;
+    Chunk* free_list;
+    Chunk* work_head;
+    Chunk* work_tail;
+    Chunk** done; // done[seq % chunk_count]: processed chunk waiting for the writer
+
+    size_t chunks_read;
+    bool reading_done;
+} Pipeline;
+
+static void* reader_thread(void* arg) {
+    Pipeline* pipeline = (Pipeline*) arg;
+    LineReader* reader = pipeline->reader;
+    bool more = true;
+
+    while (more) {
+        pthread_mutex_lock(&pipeline->lock);
+        while (pipeline->free_list == NULL) pthread_cond_wait(&pipeline->has_free, &pipeline->lock);
+        Chunk* chunk = pipeline->free_list;
+        pipeline->free_list = chunk->next;
+        pthread_mutex_unlock(&pipeline->lock);
+
+        clear_strbuf(&chunk->copy);
+        chunk->lines = 0;
+        chunk->bytes = 0;
+        chunk->offset = reader->offset;
+
+        Line line;
+        while (chunk->lines < CHUNK_LINES && chunk->bytes < CHUNK_BYTES && (more = read_line(reader, &line))) {
+            chunk->bytes += line.bytes;
+            chunk->lines++;
+            // the lines of a mapping follow each other in it, a stream reuses its buffer
+            if (reader->map == NULL) strbuf_append(&chunk->copy, line.text, line.bytes);
+        }
+        chunk->text = reader->map != NULL ? reader->map + chunk->offset : chunk->copy.data;
+
+        pthread_mutex_lock(&pipeline->lock);
+        if (chunk->lines > 0) {
+            chunk->seq = pipeline->chunks_read++;
+            chunk->next = NULL;
+            if (pipeline->work_tail != NULL) {
+                pipeline->work_tail->next = chunk;
+            } else {
+                pipeline->work_head = chunk;
+            }
+            pipeline->work_tail = chunk;
+            pthread_cond_signal(&pipeline->has_work);
+        } else {
+            chunk->next = pipeline->free_list;
+            pipeline->free_list = chunk;
+        }
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+
+    pthread_mutex_lock(&pipeline->lock);
+    pipeline->reading_done = true;
+    pthread_cond_broadcast(&pipeline->has_work);
+    pthread_cond_broadcast(&pipeline->has_done);
+    pthread_mutex_unlock(&pipeline->lock);
+
+    return NULL;
+}
+
+static void* worker_thread(void* arg) {
+    Pipeline* pipeline = (Pipeline*) arg;
+
+    // every node this thread allocates (create_*) goes to its own arena
+    Arena* arena = create_arena(0);
+    set_ast_arena(arena);
+
+    while (1) {
+        pthread_mutex_lock(&pipeline->lock);
+        while (pipeline->work_head == NULL && !pipeline->reading_done) {
+            pthread_cond_wait(&pipeline->has_work, &pipeline->lock);
+        }
+        Chunk* chunk = pipeline->work_head;
+        if (chunk == NULL) { // nothing left to read
+            pthread_mutex_unlock(&pipeline->lock);
+            break;
+        }
+        pipeline->work_head = chunk->next;
+        if (pipeline->work_head == NULL) pipeline->work_tail = NULL;
+        pthread_mutex_unlock(&pipeline->lock);
+
+        clear_strbuf(&chunk->output);
+        chunk->errors = 0;
+
+        // the lines again, as read_line cut them
+        size_t done = 0;
+        while (done < chunk->bytes) {
+            const char* line = chunk->text + done;
+            const char* newline = (const char*) memchr(line, '\n', chunk->bytes - done);
+            size_t bytes = newline != NULL ? (size_t) (newline - line) + 1 : chunk->bytes - done;
+
+            reset_arena(arena); // every node of the previous line
+            size_t length = trim_line_ending(line, bytes);
+            if (!append_record(&chunk->output, line, length, chunk->offset + done, pipeline->options)) {
+                chunk->errors++;
+            }
+            done += bytes;
+        }
+
+        pthread_mutex_lock(&pipeline->lock);
+        pipeline->done[chunk->seq % pipeline->chunk_count] = chunk;
+        pthread_cond_signal(&pipeline->has_done);
+        pthread_mutex_unlock(&pipeline->lock);
+    }
+
+    set_ast_arena(NULL);
+    destroy_arena(arena);
+    return NULL;
+}
+
+// same records in the same order as run_batch
+static int run_batch_threads(LineReader* reader, const Options* options, int threads) {
+    Pipeline pipeline;
+    pipeline.reader = reader;
+    pipeline.options = options;
+    pthread_mutex_init(&pipeline.lock, NULL);
+    pthread_cond_init(&pipeline.has_free, NULL);
+    pthread_cond_init(&pipeline.has_work, NULL);
+    pthread_cond_init(&pipeline.has_done, NULL);
+
+    pipeline.chunk_count = (size_t) threads * CHUNKS_PER_THREAD;
+    pipeline.chunks = (Chunk*) malloc(pipeline.chunk_count * sizeof(Chunk));
+    pipeline.done = (Chunk**) calloc(pipeline.chunk_count, sizeof(Chunk*));
+    pipeline.free_list = NULL;
+    for (size_t i = 0; i < pipeline.chunk_count; i++) {
+        Chunk* chunk = &pipeline.chunks[i];
+        init_strbuf(&chunk->copy);
+        init_strbuf(&chunk->output);
+        chunk->next = pipeline.free_list;
+        pipeline.free_list = chunk;
+    }
+    pipeline.work_head = NULL;
+    pipeline.work_tail = NULL;
+    pipeline.chunks_read = 0;
+    pipeline.reading_done = false;
+
+    size_t count = 0, errors = 0, bytes = 0;
+    double begin = now_seconds();
+
+    pthread_t reading;
+    pthread_t* workers = (pthread_t*) malloc(threads * sizeof(pthread_t));
+    pthread_create(&reading, NULL, reader_thread, &pipeline);
+    for (int i = 0; i < threads; i++) pthread_create(&workers[i], NULL, worker_thread, &pipeline);
+
+    // writer: the chunks in the order they were read
+    for (size_t seq = 0; ; seq++) {
+        size_t slot = seq % pipeline.chunk_count;
+
+        pthread_mutex_lock(&pipeline.lock);
+        while (pipeline.done[slot] == NULL && !(pipeline.reading_done && seq == pipeline.chunks_read)) {
+            pthread_cond_wait(&pipeline.has_done, &pipeline.lock);
+        }
+        Chunk* chunk = pipeline.done[slot];
+        pipeline.done[slot] = NULL;
+        pthread_mutex_unlock(&pipeline.lock);
+
+        if (chunk == NULL) break; // every chunk is written
+
+        fwrite(chunk->output.data, 1, chunk->output.len, stdout);
+        count += chunk->lines;
+        errors += chunk->errors;
+        bytes += chunk->bytes;
+        release_lines(reader, chunk->offset + chunk->bytes); // only the writer releases
+
+        pthread_mutex_lock(&pipeline.lock);
+        chunk->next = pipeline.free_list;
+        pipeline.free_list = chunk;
+        pthread_cond_signal(&pipeline.has_free);
+        pthread_mutex_unlock(&pipeline.lock);
+    }
+
+    pthread_join(reading, NULL);
+    for (int i = 0; i < threads; i++) pthread_join(workers[i], NULL);
+
+    fflush(stdout);
+    print_summary(count, errors, bytes, now_seconds() - begin, threads);
+
+    for (size_t i = 0; i < pipeline.chunk_count; i++) {
+        free_strbuf(&pipeline.chunks[i].copy);
+        free_strbuf(&pipeline.chunks[i].output);
+    }
+    free(pipeline.chunks);
+    free(pipeline.done);
+    free(workers);
+    pthread_mutex_destroy(&pipeline.lock);
+    pthread_cond_destroy(&pipeline.has_free);
+    pthread_cond_destroy(&pipeline.has_work);
+    pthread_cond_destroy(&pipeline.has_done);
+    return 0;
+}
+
+
+// ParseReadFn over one line of a stream, the newline ends the input
+typedef struct {
+    FILE* fp;
+    bool line_done;
+} LineSource;
+
+static size_t read_line_piece(void* context, char* buffer, size_t size) {
+    LineSource* source = (LineSource*) context;
+    size_t n = 0;
+
+    while (!source->line_done && n < size) {
+        int c = getc(source->fp);
+        if (c == EOF || c == '\n') {
+            source->line_done = true;
+        } else {
+            buffer[n++] = (char) c;
+        }
+    }
+
+    return n;
+}
+
+// --stream: the line is parsed while it is read, it is never held whole in memory
+static AstNode* parse_stream_line(FILE* fp) {
+    LineSource source = { fp, false };
+    ParseError error;
+
+    AstNode* tree = parse_stream(read_line_piece, &source, &error);
+    if (tree == NULL) fprintf(stderr, "Parsing error: %s at offset %zu\n", error.message, error.offset);
+    return tree;
+}
 
 
 int main (int argc, char **argv) {
+    Options options;
+    if (!parse_options(argc, argv, &options)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (options.batch) {
+        LineReader reader;
+        if (!init_line_reader(&reader, options.batch_file)) {
+            perror(options.batch_file);
+            return 1;
+        }
+
+        static char output_buffer[1 << 16];
+        setvbuf(stdout, output_buffer, _IOFBF, sizeof(output_buffer));
+
+        int status = options.threads > 1
+            ? run_batch_threads(&reader, &options, options.threads)
+            : run_batch(&reader, &options);
+        free_line_reader(&reader);
+        return status;
+    }
+
     printf("***Enter the function***\n");
     printf("f(x) = ");
 
     char user_input[200];
 
-    if (scanf("%[^\n]", user_input) == 0) {
-        printf("No input!\n");
-        return 1;
+    if (!options.stream) {
+        if (scanf("%[^\n]", user_input) == 0) {
+            printf("No input!\n");
+            return 1;
+        }
+        getchar(); // prevent \n for next scanf
     }
-    getchar(); // prevent \n for next scanf
 
-    AstNode* ast_tree = parse(user_input);
+    // every node of this request lives in the arena
+    // and is freed at once by destroy_arena
+    Arena* arena = create_arena(0);
+    set_ast_arena(arena);
+
+    AstNode* ast_tree = options.stream ? parse_stream_line(stdin) : parse(user_input);
     if (ast_tree == NULL) {
         printf("Parsing failed, abort!\n");
+        destroy_arena(arena);
         return 1;
     }
     printf("\n\n");
 
-//    while (simplify_ast_node(&ast_tree));
-    char* inflix = ast_to_infix(ast_tree);
-    printf("%s\n", inflix);
+    if (options.simplify) simplify_ast_node(&ast_tree); // one call reaches the fixpoint
+    print_tree(ast_tree, &options);
+
+    if (options.taylor_order >= 0) {
+        print_taylor(ast_tree, options.taylor_order, options.at);
+
+        set_ast_arena(NULL);
+        destroy_arena(arena);
+        return 0;
+    }
+
+    if (options.order > 1) {
+        // orders share their subexpressions in the store instead of cloning
+        HashCons* hc = create_hashcons();
+        AstNode** derivatives = derivative_nth(hc, ast_tree, options.order);
+        if (derivatives == NULL) {
+            printf("Derivative error!\n");
+            destroy_hashcons(hc);
+            destroy_arena(arena);
+            return 1;
+        }
+
+        for (int k = 1; k <= options.order; k++) {
+            AstNode* tree = derivatives[k];
+            if (options.simplify) simplify_ast_node(&tree); // interned nodes are copied on write
+            print_tree(tree, &options);
+        }
 
-    free(inflix);
+        free(derivatives);
+        destroy_hashcons(hc);
+        set_ast_arena(NULL);
+        destroy_arena(arena);
+        return 0;
+    }
 
     AstNode* derv_tree = derivative_expression(ast_tree);
     if (derv_tree == NULL) {
         printf("Derivative error!\n");
+        destroy_arena(arena);
         return 1;
     }
 //    print_ast_node(derv_tree,0);
-    //while (simplify_ast_node(&derv_tree));
-
-    char* derv_inflix = ast_to_infix(derv_tree);
-    printf("%s\n", derv_inflix);
+    if (options.simplify) simplify_ast_node(&derv_tree);
 
-    free(derv_inflix);
+    print_tree(derv_tree, &options);
 
-    destroy_ast_node(ast_tree);
-    destroy_ast_node(derv_tree);
+    set_ast_arena(NULL);
+    destroy_arena(arena); // ast_tree and derv_tree
 
     return 0;
 }
@@ -0,0 +1,279 @@
+#include "number.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// exactly representable powers of ten (Clinger's fast path)
+static const double exact_powers[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+#define MAX_EXACT_POWER 22
+#define MAX_EXACT_MANTISSA (1ULL << 53)
+
+// a literal has no exponent: its power of ten is minus its decimals
+// (plus the integer digits past the 19th), this range covers 64 decimals
+#define MIN_POWER (-64)
+#define MAX_POWER 64
+
+// 10^q as 128 bits { high, low }, normalized (top bit set) and rounded down
+static const uint64_t powers_of_ten[MAX_POWER - MIN_POWER + 1][2] = {
+    { 0xA87FEA27A539E9A5ULL, 0x3F2398D747B36224ULL }, // 1e-64
+    { 0xD29FE4B18E88640EULL, 0x8EEC7F0D19A03AADULL }, // 1e-63
+    { 0x83A3EEEEF9153E89ULL, 0x1953CF68300424ACULL }, // 1e-62
+    { 0xA48CEAAAB75A8E2BULL, 0x5FA8C3423C052DD7ULL }, // 1e-61
+    { 0xCDB02555653131B6ULL, 0x3792F412CB06794DULL }, // 1e-60
+    { 0x808E17555F3EBF11ULL, 0xE2BBD88BBEE40BD0ULL }, // 1e-59
+    { 0xA0B19D2AB70E6ED6ULL, 0x5B6ACEAEAE9D0EC4ULL }, // 1e-58
+    { 0xC8DE047564D20A8BULL, 0xF245825A5A445275ULL }, // 1e-57
+    { 0xFB158592BE068D2EULL, 0xEED6E2F0F0D56712ULL }, // 1e-56
+    { 0x9CED737BB6C4183DULL, 0x55464DD69685606BULL }, // 1e-55
+    { 0xC428D05AA4751E4CULL, 0xAA97E14C3C26B886ULL }, // 1e-54
+    { 0xF53304714D9265DFULL, 0xD53DD99F4B3066A8ULL }, // 1e-53
+    { 0x993FE2C6D07B7FABULL, 0xE546A8038EFE4029ULL }, // 1e-52
+    { 0xBF8FDB78849A5F96ULL, 0xDE98520472BDD033ULL }, // 1e-51
+    { 0xEF73D256A5C0F77CULL, 0x963E66858F6D4440ULL }, // 1e-50
+    { 0x95A8637627989AADULL, 0xDDE7001379A44AA8ULL }, // 1e-49
+    { 0xBB127C53B17EC159ULL, 0x5560C018580D5D52ULL }, // 1e-48
+    { 0xE9D71B689DDE71AFULL, 0xAAB8F01E6E10B4A6ULL }, // 1e-47
+    { 0x9226712162AB070DULL, 0xCAB3961304CA70E8ULL }, // 1e-46
+    { 0xB6B00D69BB55C8D1ULL, 0x3D607B97C5FD0D22ULL }, // 1e-45
+    { 0xE45C10C42A2B3B05ULL, 0x8CB89A7DB77C506AULL }, // 1e-44
+    { 0x8EB98A7A9A5B04E3ULL, 0x77F3608E92ADB242ULL }, // 1e-43
+    { 0xB267ED1940F1C61CULL, 0x55F038B237591ED3ULL }, // 1e-42
+    { 0xDF01E85F912E37A3ULL, 0x6B6C46DEC52F6688ULL }, // 1e-41
+    { 0x8B61313BBABCE2C6ULL, 0x2323AC4B3B3DA015ULL }, // 1e-40
+    { 0xAE397D8AA96C1B77ULL, 0xABEC975E0A0D081AULL }, // 1e-39
+    { 0xD9C7DCED53C72255ULL, 0x96E7BD358C904A21ULL }, // 1e-38
+    { 0x881CEA14545C7575ULL, 0x7E50D64177DA2E54ULL }, // 1e-37
+    { 0xAA242499697392D2ULL, 0xDDE50BD1D5D0B9E9ULL }, // 1e-36
+    { 0xD4AD2DBFC3D07787ULL, 0x955E4EC64B44E864ULL }, // 1e-35
+    { 0x84EC3C97DA624AB4ULL, 0xBD5AF13BEF0B113EULL }, // 1e-34
+    { 0xA6274BBDD0FADD61ULL, 0xECB1AD8AEACDD58EULL }, // 1e-33
+    { 0xCFB11EAD453994BAULL, 0x67DE18EDA5814AF2ULL }, // 1e-32
+    { 0x81CEB32C4B43FCF4ULL, 0x80EACF948770CED7ULL }, // 1e-31
+    { 0xA2425FF75E14FC31ULL, 0xA1258379A94D028DULL }, // 1e-30
+    { 0xCAD2F7F5359A3B3EULL, 0x096EE45813A04330ULL }, // 1e-29
+    { 0xFD87B5F28300CA0DULL, 0x8BCA9D6E188853FCULL }, // 1e-28
+    { 0x9E74D1B791E07E48ULL, 0x775EA264CF55347DULL }, // 1e-27
+    { 0xC612062576589DDAULL, 0x95364AFE032A819DULL }, // 1e-26
+    { 0xF79687AED3EEC551ULL, 0x3A83DDBD83F52204ULL }, // 1e-25
+    { 0x9ABE14CD44753B52ULL, 0xC4926A9672793542ULL }, // 1e-24
+    { 0xC16D9A0095928A27ULL, 0x75B7053C0F178293ULL }, // 1e-23
+    { 0xF1C90080BAF72CB1ULL, 0x5324C68B12DD6338ULL }, // 1e-22
+    { 0x971DA05074DA7BEEULL, 0xD3F6FC16EBCA5E03ULL }, // 1e-21
+    { 0xBCE5086492111AEAULL, 0x88F4BB1CA6BCF584ULL }, // 1e-20
+    { 0xEC1E4A7DB69561A5ULL, 0x2B31E9E3D06C32E5ULL }, // 1e-19
+    { 0x9392EE8E921D5D07ULL, 0x3AFF322E62439FCFULL }, // 1e-18
+    { 0xB877AA3236A4B449ULL, 0x09BEFEB9FAD487C2ULL }, // 1e-17
+    { 0xE69594BEC44DE15BULL, 0x4C2EBE687989A9B3ULL }, // 1e-16
+    { 0x901D7CF73AB0ACD9ULL, 0x0F9D37014BF60A10ULL }, // 1e-15
+    { 0xB424DC35095CD80FULL, 0x538484C19EF38C94ULL }, // 1e-14
+    { 0xE12E13424BB40E13ULL, 0x2865A5F206B06FB9ULL }, // 1e-13
+    { 0x8CBCCC096F5088CBULL, 0xF93F87B7442E45D3ULL }, // 1e-12
+    { 0xAFEBFF0BCB24AAFEULL, 0xF78F69A51539D748ULL }, // 1e-11
+    { 0xDBE6FECEBDEDD5BEULL, 0xB573440E5A884D1BULL }, // 1e-10
+    { 0x89705F4136B4A597ULL, 0x31680A88F8953030ULL }, // 1e-9
+    { 0xABCC77118461CEFCULL, 0xFDC20D2B36BA7C3DULL }, // 1e-8
+    { 0xD6BF94D5E57A42BCULL, 0x3D32907604691B4CULL }, // 1e-7
+    { 0x8637BD05AF6C69B5ULL, 0xA63F9A49C2C1B10FULL }, // 1e-6
+    { 0xA7C5AC471B478423ULL, 0x0FCF80DC33721D53ULL }, // 1e-5
+    { 0xD1B71758E219652BULL, 0xD3C36113404EA4A8ULL }, // 1e-4
+    { 0x83126E978D4FDF3BULL, 0x645A1CAC083126E9ULL }, // 1e-3
+    { 0xA3D70A3D70A3D70AULL, 0x3D70A3D70A3D70A3ULL }, // 1e-2
+    { 0xCCCCCCCCCCCCCCCCULL, 0xCCCCCCCCCCCCCCCCULL }, // 1e-1
+    { 0x8000000000000000ULL, 0x0000000000000000ULL }, // 1e0
+    { 0xA000000000000000ULL, 0x0000000000000000ULL }, // 1e1
+    { 0xC800000000000000ULL, 0x0000000000000000ULL }, // 1e2
+    { 0xFA00000000000000ULL, 0x0000000000000000ULL }, // 1e3
+    { 0x9C40000000000000ULL, 0x0000000000000000ULL }, // 1e4
+    { 0xC350000000000000ULL, 0x0000000000000000ULL }, // 1e5
+    { 0xF424000000000000ULL, 0x0000000000000000ULL }, // 1e6
+    { 0x9896800000000000ULL, 0x0000000000000000ULL }, // 1e7
+    { 0xBEBC200000000000ULL, 0x0000000000000000ULL }, // 1e8
+    { 0xEE6B280000000000ULL, 0x0000000000000000ULL }, // 1e9
+    { 0x9502F90000000000ULL, 0x0000000000000000ULL }, // 1e10
+    { 0xBA43B74000000000ULL, 0x0000000000000000ULL }, // 1e11
+    { 0xE8D4A51000000000ULL, 0x0000000000000000ULL }, // 1e12
+    { 0x9184E72A00000000ULL, 0x0000000000000000ULL }, // 1e13
+    { 0xB5E620F480000000ULL, 0x0000000000000000ULL }, // 1e14
+    { 0xE35FA931A0000000ULL, 0x0000000000000000ULL }, // 1e15
+    { 0x8E1BC9BF04000000ULL, 0x0000000000000000ULL }, // 1e16
+    { 0xB1A2BC2EC5000000ULL, 0x0000000000000000ULL }, // 1e17
+    { 0xDE0B6B3A76400000ULL, 0x0000000000000000ULL }, // 1e18
+    { 0x8AC7230489E80000ULL, 0x0000000000000000ULL }, // 1e19
+    { 0xAD78EBC5AC620000ULL, 0x0000000000000000ULL }, // 1e20
+    { 0xD8D726B7177A8000ULL, 0x0000000000000000ULL }, // 1e21
+    { 0x878678326EAC9000ULL, 0x0000000000000000ULL }, // 1e22
+    { 0xA968163F0A57B400ULL, 0x0000000000000000ULL }, // 1e23
+    { 0xD3C21BCECCEDA100ULL, 0x0000000000000000ULL }, // 1e24
+    { 0x84595161401484A0ULL, 0x0000000000000000ULL }, // 1e25
+    { 0xA56FA5B99019A5C8ULL, 0x0000000000000000ULL }, // 1e26
+    { 0xCECB8F27F4200F3AULL, 0x0000000000000000ULL }, // 1e27
+    { 0x813F3978F8940984ULL, 0x4000000000000000ULL }, // 1e28
+    { 0xA18F07D736B90BE5ULL, 0x5000000000000000ULL }, // 1e29
+    { 0xC9F2C9CD04674EDEULL, 0xA400000000000000ULL }, // 1e30
+    { 0xFC6F7C4045812296ULL, 0x4D00000000000000ULL }, // 1e31
+    { 0x9DC5ADA82B70B59DULL, 0xF020000000000000ULL }, // 1e32
+    { 0xC5371912364CE305ULL, 0x6C28000000000000ULL }, // 1e33
+    { 0xF684DF56C3E01BC6ULL, 0xC732000000000000ULL }, // 1e34
+    { 0x9A130B963A6C115CULL, 0x3C7F400000000000ULL }, // 1e35
+    { 0xC097CE7BC90715B3ULL, 0x4B9F100000000000ULL }, // 1e36
+    { 0xF0BDC21ABB48DB20ULL, 0x1E86D40000000000ULL }, // 1e37
+    { 0x96769950B50D88F4ULL, 0x1314448000000000ULL }, // 1e38
+    { 0xBC143FA4E250EB31ULL, 0x17D955A000000000ULL }, // 1e39
+    { 0xEB194F8E1AE525FDULL, 0x5DCFAB0800000000ULL }, // 1e40
+    { 0x92EFD1B8D0CF37BEULL, 0x5AA1CAE500000000ULL }, // 1e41
+    { 0xB7ABC627050305ADULL, 0xF14A3D9E40000000ULL }, // 1e42
+    { 0xE596B7B0C643C719ULL, 0x6D9CCD05D0000000ULL }, // 1e43
+    { 0x8F7E32CE7BEA5C6FULL, 0xE4820023A2000000ULL }, // 1e44
+    { 0xB35DBF821AE4F38BULL, 0xDDA2802C8A800000ULL }, // 1e45
+    { 0xE0352F62A19E306EULL, 0xD50B2037AD200000ULL }, // 1e46
+    { 0x8C213D9DA502DE45ULL, 0x4526F422CC340000ULL }, // 1e47
+    { 0xAF298D050E4395D6ULL, 0x9670B12B7F410000ULL }, // 1e48
+    { 0xDAF3F04651D47B4CULL, 0x3C0CDD765F114000ULL }, // 1e49
+    { 0x88D8762BF324CD0FULL, 0xA5880A69FB6AC800ULL }, // 1e50
+    { 0xAB0E93B6EFEE0053ULL, 0x8EEA0D047A457A00ULL }, // 1e51
+    { 0xD5D238A4ABE98068ULL, 0x72A4904598D6D880ULL }, // 1e52
+    { 0x85A36366EB71F041ULL, 0x47A6DA2B7F864750ULL }, // 1e53
+    { 0xA70C3C40A64E6C51ULL, 0x999090B65F67D924ULL }, // 1e54
+    { 0xD0CF4B50CFE20765ULL, 0xFFF4B4E3F741CF6DULL }, // 1e55
+    { 0x82818F1281ED449FULL, 0xBFF8F10E7A8921A4ULL }, // 1e56
+    { 0xA321F2D7226895C7ULL, 0xAFF72D52192B6A0DULL }, // 1e57
+    { 0xCBEA6F8CEB02BB39ULL, 0x9BF4F8A69F764490ULL }, // 1e58
+    { 0xFEE50B7025C36A08ULL, 0x02F236D04753D5B4ULL }, // 1e59
+    { 0x9F4F2726179A2245ULL, 0x01D762422C946590ULL }, // 1e60
+    { 0xC722F0EF9D80AAD6ULL, 0x424D3AD2B7B97EF5ULL }, // 1e61
+    { 0xF8EBAD2B84E0D58BULL, 0xD2E0898765A7DEB2ULL }, // 1e62
+    { 0x9B934C3B330C8577ULL, 0x63CC55F49F88EB2FULL }, // 1e63
+    { 0xC2781F49FFCFA6D5ULL, 0x3CBF6B71C76B25FBULL }, // 1e64
+};
+
+
+double parse_number_literal_strtod(const char* str, size_t len) {
+    char buf[64];
+    char* copy = len < sizeof(buf) ? buf : (char*) malloc(len + 1); // malloc only for huge literals
+
+    memcpy(copy, str, len);
+    copy[len] = '\0';
+    double num = strtod(copy, NULL);
+
+    if (copy != buf) free(copy);
+    return num;
+}
+
+#ifdef __SIZEOF_INT128__
+
+// w * 10^q correctly rounded, false if it cannot be decided here (then use strtod)
+// w != 0, MIN_POWER <= q <= MAX_POWER
+static bool eisel_lemire(uint64_t w, int q, double* value) {
+    // normalize w so its top bit is set
+    int shift = __builtin_clzll(w);
+    w <<= shift;
+
+    // 217706 / 2^16 ~ log2(10): binary exponent of 10^q (floor, arithmetic shift)
+    uint64_t exponent = (uint64_t) (((217706 * q) >> 16) + 64 + 1023) - shift;
+
+    const uint64_t* power = powers_of_ten[q - MIN_POWER];
+    unsigned __int128 product = (unsigned __int128) w * power[0];
+    uint64_t high = (uint64_t) (product >> 64);
+    uint64_t low = (uint64_t) product;
+
+    // the truncated power may be too small: take its lower half into account
+    if ((high & 0x1FF) == 0x1FF && low + w < w) {
+        unsigned __int128 lower = (unsigned __int128) w * power[1];
+        uint64_t lower_high = (uint64_t) (lower >> 64);
+        uint64_t merged_low = low + lower_high;
+        uint64_t merged_high = high + (merged_low < low);
+
+        if ((merged_high & 0x1FF) == 0x1FF && merged_low + 1 == 0 && (uint64_t) lower + w < w) {
+            return false; // still ambiguous
+        }
+        high = merged_high;
+        low = merged_low;
+    }
+
+    // 54 bits: 53 of mantissa and one to round
+    uint64_t top = high >> 63;
+    uint64_t mantissa = high >> (top + 9);
+    exponent -= 1 ^ top;
+
+    // exactly halfway between two doubles: round-to-even needs every digit
+    if (low == 0 && (high & 0x1FF) == 0 && (mantissa & 3) == 1) return false;
+
+    // round to 53 bits
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >> 53 > 0) {
+        mantissa >>= 1;
+        exponent++;
+    }
+
+    // subnormal, infinite: not handled here
+    if (exponent - 1 >= 0x7FF - 1) return false;
+
+    uint64_t bits = exponent << 52 | (mantissa & ((1ULL << 52) - 1));
+    memcpy(value, &bits, sizeof(double));
+    return true;
+}
+
+#else
+
+static bool eisel_lemire(uint64_t w, int q, double* value) {
+    (void) w; (void) q; (void) value;
+    return false; // no 128-bit product: always strtod
+}
+
+#endif
+
+
+double parse_number_literal(const char* str, size_t len) {
+    uint64_t w = 0; // the first 19 significant digits
+    int digits = 0;
+    int q = 0; // value = w * 10^q (before the digits past the 19th)
+    bool truncated = false; // a nonzero digit past the 19th
+    bool fraction = false;
+
+    for (size_t i = 0; i < len; i++) {
+        char c = str[i];
+        if (c == '.') {
+            fraction = true;
+            continue;
+        }
+
+        unsigned d = (unsigned) (c - '0');
+        if (w == 0 && d == 0) { // leading zero
+            if (fraction) q--;
+        } else if (digits < 19) {
+            w = w * 10 + d;
+            digits++;
+            if (fraction) q--;
+        } else {
+            if (d != 0) truncated = true;
+            if (!fraction) q++;
+        }
+    }
+
+    if (w == 0) return 0;
+
+    if (!truncated && w <= MAX_EXACT_MANTISSA && q >= -MAX_EXACT_POWER && q <= MAX_EXACT_POWER) {
+        // both operands are exact: one correctly rounded operation
+        return q < 0 ? (double) w / exact_powers[-q] : (double) w * exact_powers[q];
+    }
+
+    if (q >= MIN_POWER && q <= MAX_POWER) {
+        double value;
+        if (eisel_lemire(w, q, &value)) {
+            // the dropped digits put the literal between w and w + 1:
+            // if both round to the same double, so does the literal
+            double above;
+            if (!truncated || (w + 1 != 0 && eisel_lemire(w + 1, q, &above) && above == value)) return value;
+        }
+    }
+
+    return parse_number_literal_strtod(str, len);
+}
@@ -0,0 +1,24 @@
+#ifndef __NUMBER_H__
+#define __NUMBER_H__
+
+#include <stddef.h>
+
+/*
+conversion of a number literal (digits with at most one '.', no sign, no exponent,
+like the tokenizer reads them) to the nearest double, straight from the input:
+no copy, no allocation, no locale.
+- at most 19 significant digits that fit exactly (w <= 2^53, 10^|q| <= 10^22):
+  one exact multiplication or division (Clinger's fast path)
+- else the Eisel-Lemire algorithm: the digits times a 128-bit power of ten,
+  correct unless the product is too close to a halfway point to tell
+- else (or more than 64 decimals, more than 19 digits that round both ways): strtod
+every path gives the same bits as strtod.
+*/
+
+// str[0..len) does not have to be null-terminated
+double parse_number_literal(const char* str, size_t len);
+
+// the same through a null-terminated copy and strtod (the fallback, for comparison)
+double parse_number_literal_strtod(const char* str, size_t len);
+
+#endif
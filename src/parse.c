@@ -14,24 +14,39 @@ static AstNode* parse_power(TokenStream* s);
 static AstNode* parse_primary(TokenStream* s);
 
 
-AstNode* parse(char* str) {
-    TokenList* token_list = tokenize_string(str);
-    if (token_list == NULL) {
+AstNode* parse_descent(char* str) {
+    TokenArray tokens;
+    init_token_array(&tokens);
+
+    if (!tokenize_string(str, strlen(str), &tokens)) {
         fprintf(stderr, "Tokenizing error!\n");
+        free_token_array(&tokens);
         return NULL;
     }
 
-    TokenStream* s = create_token_stream(token_list);
-    AstNode* ast_tree = parse_expression(s);
+    AstNode* ast_tree = parse_tokens(&tokens);
+    free_token_array(&tokens);
+
+    return ast_tree;
+}
+
+AstNode* parse_tokens(const TokenArray* tokens) {
+    TokenStream s = create_token_stream(tokens);
+
+    AstNode* ast_tree = parse_expression(&s);
     if (ast_tree == NULL) {
         fprintf(stderr, "Parsing error!\n");
-        destroy_token_list(token_list);
-        destroy_token_stream(s);
         return NULL;
     }
 
-    destroy_token_list(token_list);
-    destroy_token_stream(s);
+    // the expression should cover the whole input e.g. 'x)' or 'x 2' is wrong
+    const Token* rest = peek_token_stream(&s);
+    if (rest->type != TOKEN_END) {
+        fprintf(stderr, "Unexpected token '%.*s'\n", (int) rest->length, tokens->str + rest->offset);
+        fprintf(stderr, "Parsing error!\n");
+        destroy_ast_node(ast_tree);
+        return NULL;
+    }
 
     return ast_tree;
 }
@@ -43,7 +58,7 @@ static AstNode* parse_expression (TokenStream* s) {
 
     if (node == NULL) return NULL;
 
-    TokenNode* op;
+    const Token* op;
 
     while ((op = match_token_stream(s, TOKEN_ADD)) || (op = match_token_stream(s, TOKEN_SUB))) {
         // current = term
@@ -77,9 +92,8 @@ static bool check_implicit_mul(TokenStream* s) {
     RPAREN FUNC
     */
 
-    TokenNode* curr = peek_token_stream(s);
-    TokenType prev_t = curr->prev->type;
-    TokenType curr_t = curr->type;
+    TokenType prev_t = prev_token_stream(s)->type;
+    TokenType curr_t = peek_token_stream(s)->type;
 
     return (prev_t == TOKEN_NUM && curr_t == TOKEN_VAR)
         || (prev_t == TOKEN_NUM && curr_t == TOKEN_FUNC)
@@ -100,8 +114,6 @@ static AstNode* parse_term(TokenStream* s) {
 
     // current = * or / or else
 
-    TokenNode* op = NULL;
-
     while (1) {
         Operator op;
 
@@ -128,7 +140,7 @@ static AstNode* parse_term(TokenStream* s) {
 
 
 static AstNode* parse_factor(TokenStream* s) {
-    TokenNode* unary;
+    const Token* unary;
     AstNode* node;
 
     if ((unary = match_token_stream(s, TOKEN_ADD)) || (unary = match_token_stream(s, TOKEN_SUB))) {
@@ -161,38 +173,21 @@ static AstNode* parse_power(TokenStream* s) {
     return node;
 }
 
-static Function get_function(char* str) {
-    // so sad cuz no switch-case for string
-    if (strcmp(str, "sin") == 0) {
-        return FUNC_SIN;
-    } else if (strcmp(str, "cos") == 0) {
-        return FUNC_COS;
-    } else if (strcmp(str, "tan") == 0) {
-        return FUNC_TAN;
-    } else if (strcmp(str, "ln") == 0) {
-        return FUNC_LN;
-    } else if (strcmp(str, "log") == 0) {
-        return FUNC_LOG;
-    } else if (strcmp(str, "exp") == 0) {
-        return FUNC_EXP;
-    } else {
-        return FUNC_INVALID;
-    }
-}
-
 static AstNode* parse_primary(TokenStream* s) {
-    TokenNode* curr = advance_token_stream(s);
+    const Token* curr = advance_token_stream(s);
+    const char* str = s->array->str;
     AstNode* node;
 
     if (curr->type == TOKEN_NUM) {
-        node = create_num_node(atof(curr->value));
+        // already converted by the tokenizer
+        node = create_num_node(curr->number);
     } else if (curr->type == TOKEN_VAR) {
         node = create_var_node();
     } else if (curr->type == TOKEN_FUNC) {
-        Function func_name = get_function(curr->value);
+        Function func_name = curr->func;
 
         if (func_name == FUNC_INVALID) {
-            fprintf(stderr, "Invalid function '%s'\n", curr->value);
+            fprintf(stderr, "Invalid function '%.*s'\n", (int) curr->length, str + curr->offset);
             return NULL;
         }
 
@@ -224,8 +219,11 @@ static AstNode* parse_primary(TokenStream* s) {
         }
 
         node = expr;
+    } else if (curr->type == TOKEN_END) {
+        fprintf(stderr, "Unexpected end of expression\n");
+        return NULL;
     } else {
-        fprintf(stderr, "Invalid token at '%s'\n", curr->value);
+        fprintf(stderr, "Invalid token at '%.*s'\n", (int) curr->length, str + curr->offset);
         return NULL;
     }
 
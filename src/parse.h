@@ -28,8 +28,52 @@ VAR FUNC is not allowed like x sin(x) because no way to distinguish x and sin(x)
 (whitespaces are ignored in tokenizer)
 */
 
-// tokenize + parse from string
-// if parsing error, return NULL
+/*
+'parse' is a single pass precedence climbing (Pratt) parser:
+tokens are read one by one from the string while parsing (no token list)
+and each operand costs one loop step instead of one call per grammar level.
+an operator waiting for its operand (binary, unary sign, "(" or a function call)
+is kept on an explicit stack (stack.h): any nesting depth, --((((x)))) a million deep included.
+binding power:
+"+" "-"             1 (left assoc)
+"*" "/" _IMPLICIT_  2 (left assoc)
+unary "+" "-"       operand binds "^" only: -x^2 = -(x^2)
+"^"                 3 (right assoc, no unary on the right side like the grammar)
+so it accepts exactly the same language and builds the same tree as the rules above.
+*/
+
+// why and where parsing failed
+typedef struct {
+    const char* message; // static string, e.g. "')' expected"
+    size_t offset; // byte offset in the input of the character or token at fault
+} ParseError;
+
+// parse from string
+// if parsing error, return NULL (the error is printed on stderr)
 AstNode* parse(char* str);
+// same but str doesn't have to be null-terminated
+AstNode* parse_n(const char* str, size_t len);
+// same as parse_n, but the error is stored in 'error' (may be NULL) instead of printed
+AstNode* parse_n_error(const char* str, size_t len, ParseError* error);
+
+// input of parse_stream: copy up to 'size' bytes into 'buffer' and return how many,
+// 0 at the end of the input
+typedef size_t (*ParseReadFn)(void* context, char* buffer, size_t size);
+
+// bytes asked from ParseReadFn at a time
+#define PARSE_STREAM_BUFFER (64 * 1024)
+
+// parse an input of any size read piece by piece (a pipe, a file, a generator)
+// with the resumable tokenizer of token.h: the input is never held whole in memory,
+// only one buffer and the token cut by its end. same result as parse_n_error on the whole input
+AstNode* parse_stream(ParseReadFn read, void* context, ParseError* error);
+
+// tokenize + recursive descent (one function per grammar rule)
+// slower than 'parse', same result
+AstNode* parse_descent(char* str);
+
+// recursive descent on already tokenized string (see tokenize_string in token.h)
+// if parsing error, return NULL
+AstNode* parse_tokens(const TokenArray* tokens);
 
 #endif
@@ -0,0 +1,360 @@
+#include "parse.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include "token.h"
+#include "ast.h"
+#include "stack.h"
+
+
+// binding power of binary operators (see parse.h)
+#define PREC_ADD 1
+#define PREC_MUL 2
+#define PREC_POW 3
+
+
+typedef struct {
+    const char* str;
+    size_t len;
+    size_t pos; // where the lexer continues
+    Token current; // lookahead token
+    TokenType prev_type; // last consumed token, for _IMPLICIT_MUL_
+    ParseError error; // first failure, message == NULL while there is none
+
+    // parse_stream: tokens come from 'stream', fed from 'read' one buffer at a time
+    // (NULL: the whole input is 'str')
+    ChunkTokenizer* stream;
+    ParseReadFn read;
+    void* context;
+    char* buffer;
+    size_t buffer_size;
+} Parser;
+
+
+// keep the first failure, the callers only unwind after it
+static void fail_parser(Parser* p, const char* message, size_t offset) {
+    if (p->error.message != NULL) return;
+
+    p->error.message = message;
+    p->error.offset = offset;
+}
+
+// next token of a stream, reading more input when it runs out
+static bool advance_stream(Parser* p) {
+    while (1) {
+        ScanStatus status = next_chunk_token(p->stream, &p->current);
+
+        if (status == SCAN_TOKEN) return true;
+        if (status == SCAN_ERROR) {
+            fail_parser(p, "invalid character", p->current.offset);
+            return false;
+        }
+
+        // SCAN_NEED_INPUT: the buffer is not used anymore and can be refilled
+        size_t n = p->read(p->context, p->buffer, p->buffer_size);
+        if (n == 0) {
+            finish_chunk_tokenizer(p->stream);
+        } else {
+            feed_chunk_tokenizer(p->stream, p->buffer, n);
+        }
+    }
+}
+
+// lex the next token into p->current
+static bool advance_parser(Parser* p) {
+    p->prev_type = p->current.type;
+
+    if (p->stream != NULL) return advance_stream(p);
+
+    if (!scan_token(p->str, p->len, &p->pos, &p->current)) {
+        fail_parser(p, "invalid character", p->pos);
+        return false;
+    }
+
+    return true;
+}
+
+// same table as 'check_implicit_mul' in parse.c
+static bool is_implicit_mul(TokenType prev_t, TokenType curr_t) {
+    switch (prev_t) {
+    case TOKEN_NUM:
+        return curr_t == TOKEN_VAR || curr_t == TOKEN_FUNC || curr_t == TOKEN_LPAREN;
+    case TOKEN_VAR:
+        return curr_t == TOKEN_LPAREN || curr_t == TOKEN_FUNC;
+    case TOKEN_RPAREN:
+        return curr_t == TOKEN_LPAREN || curr_t == TOKEN_NUM
+            || curr_t == TOKEN_VAR || curr_t == TOKEN_FUNC;
+    default:
+        return false;
+    }
+}
+
+// an operator waiting for its operand: the recursion of the grammar kept on a Stack
+typedef enum {
+    PENDING_UNARY, // "+" or "-" factor
+    PENDING_GROUP, // "(" expression ")" or FUNCTION "(" expression ")"
+    PENDING_BINARY // left op right
+} PendingType;
+
+typedef struct {
+    PendingType type;
+    int min_prec; // of the level to go back to once the operand is done
+    union {
+        // PENDING_UNARY
+        Unary unary;
+
+        // PENDING_GROUP
+        struct {
+            TokenType open; // TOKEN_FUNC or TOKEN_LPAREN
+            Function func; // with TOKEN_FUNC
+        } group;
+
+        // PENDING_BINARY
+        struct {
+            Operator op;
+            AstNode* left;
+        } binary;
+    };
+} Pending;
+
+#define LOCAL_STACK 64
+
+
+// the start of an operand: a primary, or an operator waiting on 'pending' for the operand after it
+// return the primary, or NULL with *opened = true when the operand is still to come
+// (*min_prec and *allow_unary are then the ones of the inner operand)
+static AstNode* parse_operand_start(Parser* p, Stack* pending, int* min_prec, bool* allow_unary, bool* opened) {
+    Token curr = p->current;
+    *opened = false;
+
+    if (*allow_unary && (curr.type == TOKEN_ADD || curr.type == TOKEN_SUB)) {
+        // factor → ("+" | "-") factor | power
+        if (!advance_parser(p)) return NULL;
+
+        *(Pending*) stack_push(pending) = (Pending) {
+            .type = PENDING_UNARY, .min_prec = *min_prec,
+            .unary = curr.type == TOKEN_ADD ? UNARY_PLUS : UNARY_MINUS
+        };
+        *min_prec = PREC_POW;
+        *allow_unary = true;
+        *opened = true;
+        return NULL;
+    }
+
+    if (curr.type == TOKEN_NUM) {
+        if (!advance_parser(p)) return NULL;
+        return create_num_node(curr.number);
+    }
+
+    if (curr.type == TOKEN_VAR) {
+        if (!advance_parser(p)) return NULL;
+        return create_var_node();
+    }
+
+    if (curr.type == TOKEN_FUNC || curr.type == TOKEN_LPAREN) {
+        if (curr.type == TOKEN_FUNC) {
+            if (curr.func == FUNC_INVALID) {
+                fail_parser(p, "unknown function", curr.offset);
+                return NULL;
+            }
+
+            if (!advance_parser(p)) return NULL;
+            if (p->current.type != TOKEN_LPAREN) {
+                fail_parser(p, "'(' expected after the function", p->current.offset);
+                return NULL;
+            }
+        }
+        if (!advance_parser(p)) return NULL; // after lparen
+
+        *(Pending*) stack_push(pending) = (Pending) {
+            .type = PENDING_GROUP, .min_prec = *min_prec, .group = { curr.type, curr.func }
+        };
+        *min_prec = PREC_ADD;
+        *allow_unary = true;
+        *opened = true;
+        return NULL;
+    }
+
+    if (curr.type == TOKEN_END) {
+        fail_parser(p, "unexpected end of expression", curr.offset);
+    } else {
+        fail_parser(p, "unexpected token", curr.offset);
+    }
+    return NULL;
+}
+
+// the operand of the pending operator on top is 'node': build the node it makes
+// return NULL on error ('node' is destroyed)
+static AstNode* close_pending(Parser* p, const Pending* top, AstNode* node) {
+    switch (top->type) {
+    case PENDING_UNARY:
+        return create_unary_node(top->unary, node);
+
+    case PENDING_GROUP:
+        if (p->current.type != TOKEN_RPAREN) {
+            fail_parser(p, "')' expected", p->current.offset);
+            destroy_ast_node(node);
+            return NULL;
+        }
+        if (!advance_parser(p)) {
+            destroy_ast_node(node);
+            return NULL;
+        }
+        return top->group.open == TOKEN_FUNC ? create_func_node(top->group.func, node) : node;
+
+    default:
+        return create_op_node(top->binary.op, top->binary.left, node);
+    }
+}
+
+// parse operators binding at least as tight as min_prec
+// allow_unary: the operand may begin with unary +/- (not after "^")
+//
+// precedence climbing without recursion (any nesting depth): where the grammar
+// would recurse for an operand (after a binary operator, a unary sign or an open
+// parenthesis), the operator is pushed on 'pending' and the operand is parsed in
+// the same loop; the operator is built once the operand stops at a weaker operator
+static AstNode* parse_binary(Parser* p, int min_prec, bool allow_unary) {
+    Pending pending_local[LOCAL_STACK];
+    Stack pending;
+    STACK_INIT_LOCAL(&pending, Pending, pending_local);
+
+    AstNode* node = NULL;
+    bool need_operand = true;
+
+    while (1) {
+        if (need_operand) {
+            bool opened;
+            node = parse_operand_start(p, &pending, &min_prec, &allow_unary, &opened);
+            if (opened) continue;
+            if (node == NULL) break;
+            need_operand = false;
+        }
+
+        Operator op;
+        int prec;
+        bool implicit = false;
+
+        switch (p->current.type) {
+        case TOKEN_ADD: op = OP_ADD; prec = PREC_ADD; break;
+        case TOKEN_SUB: op = OP_SUB; prec = PREC_ADD; break;
+        case TOKEN_MUL: op = OP_MUL; prec = PREC_MUL; break;
+        case TOKEN_DIV: op = OP_DIV; prec = PREC_MUL; break;
+        case TOKEN_POW: op = OP_POW; prec = PREC_POW; break;
+        default:
+            if (!is_implicit_mul(p->prev_type, p->current.type)) {
+                prec = -1; // not an operator: the operand is done
+                break;
+            }
+            op = OP_MUL;
+            prec = PREC_MUL;
+            implicit = true;
+        }
+
+        if (prec < min_prec) {
+            // the operand of the pending operator on top is done
+            if (stack_empty(&pending)) break;
+
+            Pending top = *(Pending*) stack_pop(&pending);
+            node = close_pending(p, &top, node);
+            if (node == NULL) break;
+            min_prec = top.min_prec;
+            continue;
+        }
+
+        // implicit mul has no operator token to skip
+        if (!implicit && !advance_parser(p)) {
+            destroy_ast_node(node);
+            node = NULL;
+            break;
+        }
+
+        *(Pending*) stack_push(&pending) = (Pending) {
+            .type = PENDING_BINARY, .min_prec = min_prec, .binary = { op, node }
+        };
+        node = NULL;
+        need_operand = true;
+        if (op == OP_POW) {
+            min_prec = PREC_POW; // right assoc
+            allow_unary = false;
+        } else {
+            min_prec = prec + 1; // left assoc
+            allow_unary = true;
+        }
+    }
+
+    // on error, the left operands still waiting are dropped
+    if (node == NULL) {
+        while (!stack_empty(&pending)) {
+            Pending* top = (Pending*) stack_pop(&pending);
+            if (top->type == PENDING_BINARY) destroy_ast_node(top->binary.left);
+        }
+    }
+
+    free_stack(&pending);
+    return node;
+}
+
+
+// the whole input as one expression
+static AstNode* parse_input(Parser* p, ParseError* error) {
+    p->error = (ParseError) { NULL, 0 };
+    p->current.type = TOKEN_END;
+    p->current.offset = 0;
+
+    AstNode* ast_tree = NULL;
+
+    if (advance_parser(p)) {
+        if (p->current.type == TOKEN_END) {
+            fail_parser(p, "empty expression", p->current.offset); // like 'tokenize_string'
+        } else {
+            ast_tree = parse_binary(p, PREC_ADD, true);
+        }
+    }
+
+    if (ast_tree != NULL && p->current.type != TOKEN_END) {
+        // the expression should cover the whole input e.g. 'x)' or 'x 2' is wrong
+        fail_parser(p, "unexpected token", p->current.offset);
+        destroy_ast_node(ast_tree);
+        ast_tree = NULL;
+    }
+
+    if (error != NULL) *error = p->error;
+    return ast_tree;
+}
+
+AstNode* parse_n_error(const char* str, size_t len, ParseError* error) {
+    Parser p = { .str = str, .len = len, .pos = 0, .stream = NULL };
+    return parse_input(&p, error);
+}
+
+AstNode* parse_stream(ParseReadFn read, void* context, ParseError* error) {
+    char buffer[PARSE_STREAM_BUFFER];
+    ChunkTokenizer stream;
+    init_chunk_tokenizer(&stream);
+
+    Parser p = {
+        .str = NULL, .len = 0, .pos = 0, .stream = &stream,
+        .read = read, .context = context, .buffer = buffer, .buffer_size = sizeof(buffer)
+    };
+    AstNode* ast_tree = parse_input(&p, error);
+
+    free_chunk_tokenizer(&stream);
+    return ast_tree;
+}
+
+AstNode* parse_n(const char* str, size_t len) {
+    ParseError error;
+    AstNode* ast_tree = parse_n_error(str, len, &error);
+
+    if (ast_tree == NULL) {
+        fprintf(stderr, "Parsing error: %s at offset %zu\n", error.message, error.offset);
+    }
+
+    return ast_tree;
+}
+
+AstNode* parse(char* str) {
+    return parse_n(str, strlen(str));
+}
@@ -0,0 +1,78 @@
+#include "ptrmap.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+
+
+static size_t hash_pointer(const void* ptr) {
+    uint64_t h = (uint64_t)(uintptr_t) ptr;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t) h;
+}
+
+void init_ptrmap(PtrMap* map) {
+    map->keys = NULL;
+    map->values = NULL;
+    map->capacity = 0;
+    map->size = 0;
+}
+
+void free_ptrmap(PtrMap* map) {
+    free(map->keys);
+    free(map->values);
+    init_ptrmap(map);
+}
+
+// return the slot of the key, or the empty slot where it should be
+static size_t find_slot(const PtrMap* map, const void* key) {
+    size_t mask = map->capacity - 1;
+    size_t i = hash_pointer(key) & mask;
+
+    while (map->keys[i] != NULL && map->keys[i] != key) {
+        i = (i + 1) & mask;
+    }
+
+    return i;
+}
+
+static void grow_ptrmap(PtrMap* map) {
+    const void** old_keys = map->keys;
+    void** old_values = map->values;
+    size_t old_capacity = map->capacity;
+
+    map->capacity = old_capacity == 0 ? 64 : old_capacity * 2;
+    map->keys = (const void**) calloc(map->capacity, sizeof(void*));
+    map->values = (void**) malloc(map->capacity * sizeof(void*));
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_keys[i] == NULL) continue;
+
+        size_t slot = find_slot(map, old_keys[i]);
+        map->keys[slot] = old_keys[i];
+        map->values[slot] = old_values[i];
+    }
+
+    free(old_keys);
+    free(old_values);
+}
+
+void* ptrmap_get(PtrMap* map, const void* key) {
+    if (map->size == 0) return NULL;
+
+    size_t slot = find_slot(map, key);
+    return map->keys[slot] == NULL ? NULL : map->values[slot];
+}
+
+void ptrmap_put(PtrMap* map, const void* key, void* value) {
+    // keep load factor under 1/2
+    if ((map->size + 1) * 2 > map->capacity) grow_ptrmap(map);
+
+    size_t slot = find_slot(map, key);
+    if (map->keys[slot] == NULL) {
+        map->keys[slot] = key;
+        map->size++;
+    }
+    map->values[slot] = value;
+}
@@ -0,0 +1,24 @@
+#ifndef __PTRMAP_H__
+#define __PTRMAP_H__
+
+#include <stddef.h>
+
+// hash map from pointer to pointer (open addressing)
+// NULL key is not allowed
+typedef struct {
+    const void** keys;
+    void** values;
+    size_t capacity; // always power of 2 (or 0)
+    size_t size;
+} PtrMap;
+
+
+void init_ptrmap(PtrMap* map);
+void free_ptrmap(PtrMap* map); // free the storage, not the keys/values
+
+// return NULL if not found
+void* ptrmap_get(PtrMap* map, const void* key);
+// insert or overwrite
+void ptrmap_put(PtrMap* map, const void* key, void* value);
+
+#endif
@@ -0,0 +1,35 @@
+#include "stack.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+void init_stack(Stack* stack, size_t elem_size, void* buffer, size_t buffer_count) {
+    stack->data = (char*) buffer;
+    stack->elem_size = elem_size;
+    stack->size = 0;
+    stack->capacity = buffer != NULL ? buffer_count : 0;
+    stack->on_heap = false;
+}
+
+void free_stack(Stack* stack) {
+    if (stack->on_heap) free(stack->data);
+    stack->data = NULL;
+    stack->size = 0;
+    stack->capacity = 0;
+    stack->on_heap = false;
+}
+
+void grow_stack(Stack* stack) {
+    size_t capacity = stack->capacity == 0 ? 64 : stack->capacity * 2;
+
+    if (stack->on_heap) {
+        stack->data = (char*) realloc(stack->data, capacity * stack->elem_size);
+    } else {
+        char* data = (char*) malloc(capacity * stack->elem_size);
+        if (stack->size > 0) memcpy(data, stack->data, stack->size * stack->elem_size);
+        stack->data = data;
+        stack->on_heap = true;
+    }
+    stack->capacity = capacity;
+}
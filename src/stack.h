@@ -0,0 +1,50 @@
+#ifndef __STACK_H__
+#define __STACK_H__
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// growable stack of fixed-size elements, the explicit stack of the iterative traversals
+// it starts in a buffer given by the caller (usually a local array, NULL = none)
+// and moves to the heap only when it grows past it, so a shallow walk never allocates
+typedef struct {
+    char* data;
+    size_t elem_size;
+    size_t size; // elements on the stack
+    size_t capacity;
+    bool on_heap;
+} Stack;
+
+#define STACK_INIT_LOCAL(stack, type, array) \
+    init_stack((stack), sizeof(type), (array), sizeof(array) / sizeof((array)[0]))
+
+
+void init_stack(Stack* stack, size_t elem_size, void* buffer, size_t buffer_count);
+void free_stack(Stack* stack);
+
+// double the capacity (the slow path of stack_push, the first growth leaves the caller's buffer)
+void grow_stack(Stack* stack);
+
+// room for one more element on top, returned uninitialized
+// inline: the walks push once per node, the call would cost more than the push
+static inline void* stack_push(Stack* stack) {
+    if (stack->size == stack->capacity) grow_stack(stack);
+    return stack->data + stack->size++ * stack->elem_size;
+}
+
+static inline bool stack_empty(const Stack* stack) {
+    return stack->size == 0;
+}
+
+// the top element (valid until the next push)
+static inline void* stack_top(Stack* stack) {
+    return stack->data + (stack->size - 1) * stack->elem_size;
+}
+
+// remove the top element and return it (valid until the next push)
+static inline void* stack_pop(Stack* stack) {
+    stack->size--;
+    return stack->data + stack->size * stack->elem_size;
+}
+
+#endif
@@ -0,0 +1,57 @@
+#include "strbuf.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+void init_strbuf(StrBuf* buf) {
+    buf->data = NULL;
+    buf->len = 0;
+    buf->cap = 0;
+}
+
+void free_strbuf(StrBuf* buf) {
+    free(buf->data);
+    init_strbuf(buf);
+}
+
+void clear_strbuf(StrBuf* buf) {
+    buf->len = 0;
+    if (buf->data != NULL) buf->data[0] = '\0';
+}
+
+void reserve_strbuf(StrBuf* buf, size_t extra) {
+    size_t need = buf->len + extra + 1; // + '\0'
+    if (need <= buf->cap) return;
+
+    size_t cap = buf->cap == 0 ? 64 : buf->cap;
+    while (cap < need) cap *= 2;
+
+    buf->data = (char*) realloc(buf->data, cap);
+    buf->cap = cap;
+}
+
+void strbuf_append(StrBuf* buf, const char* str, size_t len) {
+    reserve_strbuf(buf, len);
+    memcpy(buf->data + buf->len, str, len);
+    buf->len += len;
+    buf->data[buf->len] = '\0';
+}
+
+void strbuf_append_str(StrBuf* buf, const char* str) {
+    strbuf_append(buf, str, strlen(str));
+}
+
+void strbuf_append_char(StrBuf* buf, char c) {
+    reserve_strbuf(buf, 1);
+    buf->data[buf->len++] = c;
+    buf->data[buf->len] = '\0';
+}
+
+char* strbuf_detach(StrBuf* buf) {
+    if (buf->data == NULL) reserve_strbuf(buf, 0); // empty string, not NULL
+
+    char* str = buf->data;
+    init_strbuf(buf);
+    return str;
+}
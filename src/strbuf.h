@@ -0,0 +1,29 @@
+#ifndef __STRBUF_H__
+#define __STRBUF_H__
+
+#include <stddef.h>
+
+// growable string buffer, data is always null-terminated
+// can be cleared and reused without reallocating
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+} StrBuf;
+
+
+void init_strbuf(StrBuf* buf);
+void free_strbuf(StrBuf* buf);
+void clear_strbuf(StrBuf* buf); // len = 0, keep the memory
+
+// make room for at least 'extra' more characters
+void reserve_strbuf(StrBuf* buf, size_t extra);
+
+void strbuf_append(StrBuf* buf, const char* str, size_t len);
+void strbuf_append_str(StrBuf* buf, const char* str);
+void strbuf_append_char(StrBuf* buf, char c);
+
+// hand the string over to the caller (must be freed) and reset the buffer
+char* strbuf_detach(StrBuf* buf);
+
+#endif
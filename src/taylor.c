@@ -0,0 +1,292 @@
+#include "taylor.h"
+
+#include "ast.h"
+#include "stack.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+// series used by one node besides its operands and its result (see 'taylor_step')
+#define TAYLOR_TEMPS 2
+
+
+// everything works on series of n = order + 1 coefficients
+// outputs never alias inputs
+
+static void series_constant(double* out, double value, int n) {
+    out[0] = value;
+    for (int k = 1; k < n; k++) out[k] = 0;
+}
+
+static void series_copy(double* out, const double* a, int n) {
+    memcpy(out, a, n * sizeof(double));
+}
+
+// out = a * b (Cauchy product)
+static void series_mul(double* out, const double* a, const double* b, int n) {
+    for (int k = 0; k < n; k++) {
+        double sum = 0;
+        for (int j = 0; j <= k; j++) sum += a[j] * b[k - j];
+        out[k] = sum;
+    }
+}
+
+// out = a / b: a = out * b solved for out[k]
+static void series_div(double* out, const double* a, const double* b, int n) {
+    for (int k = 0; k < n; k++) {
+        double sum = a[k];
+        for (int j = 0; j < k; j++) sum -= out[j] * b[k - j];
+        out[k] = sum / b[0];
+    }
+}
+
+// out = exp(a): out' = a' * out
+static void series_exp(double* out, const double* a, int n) {
+    out[0] = exp(a[0]);
+    for (int k = 1; k < n; k++) {
+        double sum = 0;
+        for (int j = 1; j <= k; j++) sum += j * a[j] * out[k - j];
+        out[k] = sum / k;
+    }
+}
+
+// out = ln(a): a * out' = a'
+static void series_ln(double* out, const double* a, int n) {
+    out[0] = log(a[0]);
+    for (int k = 1; k < n; k++) {
+        double sum = 0;
+        for (int j = 1; j < k; j++) sum += j * out[j] * a[k - j];
+        out[k] = (a[k] - sum / k) / a[0];
+    }
+}
+
+// s = sin(a), c = cos(a): s' = c * a', c' = -s * a'
+static void series_sincos(double* s, double* c, const double* a, int n) {
+    s[0] = sin(a[0]);
+    c[0] = cos(a[0]);
+    for (int k = 1; k < n; k++) {
+        double sum_s = 0, sum_c = 0;
+        for (int j = 1; j <= k; j++) {
+            sum_s += j * a[j] * c[k - j];
+            sum_c += j * a[j] * s[k - j];
+        }
+        s[k] = sum_s / k;
+        c[k] = -sum_c / k;
+    }
+}
+
+// out = tan(a): out' = (1 + out^2) * a', u = 1 + out^2 kept alongside
+static void series_tan(double* out, double* u, const double* a, int n) {
+    out[0] = tan(a[0]);
+    u[0] = 1 + out[0] * out[0];
+    for (int k = 1; k < n; k++) {
+        double sum = 0;
+        for (int j = 1; j <= k; j++) sum += j * a[j] * u[k - j];
+        out[k] = sum / k;
+
+        double square = 0;
+        for (int j = 0; j <= k; j++) square += out[j] * out[k - j];
+        u[k] = square;
+    }
+}
+
+// out = a ^ r for a constant r, temps: 2 series
+static void series_pow_constant(double* out, const double* a, double r, int n, double* temps) {
+    if (r == floor(r) && fabs(r) <= 1 << 30) {
+        // binary powering: exact for a[0] = 0 too
+        double* base = temps;
+        double* product = temps + n;
+        long e = (long) fabs(r);
+
+        series_constant(out, 1, n);
+        series_copy(base, a, n);
+        while (e > 0) {
+            if (e & 1) {
+                series_mul(product, out, base, n);
+                series_copy(out, product, n);
+            }
+            e >>= 1;
+            if (e > 0) {
+                series_mul(product, base, base, n);
+                series_copy(base, product, n);
+            }
+        }
+
+        if (r < 0) {
+            series_constant(base, 1, n);
+            series_copy(product, out, n);
+            series_div(out, base, product, n);
+        }
+    } else {
+        // a * out' = r * a' * out
+        out[0] = pow(a[0], r);
+        for (int k = 1; k < n; k++) {
+            double sum = 0;
+            for (int j = 1; j <= k; j++) sum += (r * j - (k - j)) * a[j] * out[k - j];
+            out[k] = sum / (k * a[0]);
+        }
+    }
+
+    out[0] = pow(a[0], r); // same value as evaluate_ast
+}
+
+
+// series of one node -> out, from the series of its operands
+// a: left operand, argument or operand, b: right operand
+static void taylor_step(AstNode* tree, double x, int n, const double* a, const double* b,
+                        double* out, double* temps) {
+    if (tree == NULL) {
+        for (int k = 0; k < n; k++) out[k] = NAN;
+        return;
+    }
+
+    switch (tree->type) {
+    case AST_NUM:
+        series_constant(out, tree->number, n);
+        break;
+    case AST_VAR:
+        series_constant(out, x, n);
+        if (n > 1) out[1] = 1;
+        break;
+    case AST_UNARY:
+        for (int k = 0; k < n; k++) out[k] = tree->unary.unary == UNARY_MINUS ? -a[k] : a[k];
+        break;
+    case AST_OP:
+        switch (tree->op.op) {
+        case OP_ADD:
+            for (int k = 0; k < n; k++) out[k] = a[k] + b[k];
+            break;
+        case OP_SUB:
+            for (int k = 0; k < n; k++) out[k] = a[k] - b[k];
+            break;
+        case OP_MUL:
+            series_mul(out, a, b, n);
+            break;
+        case OP_DIV:
+            series_div(out, a, b, n);
+            break;
+        case OP_POW: {
+            bool constant = true;
+            for (int k = 1; k < n; k++) {
+                if (b[k] != 0) constant = false;
+            }
+
+            if (constant) {
+                series_pow_constant(out, a, b[0], n, temps);
+            } else {
+                // f^g = exp(g * ln(f))
+                double* ln_a = temps;
+                double* product = temps + n;
+                series_ln(ln_a, a, n);
+                series_mul(product, b, ln_a, n);
+                series_exp(out, product, n);
+                out[0] = pow(a[0], b[0]);
+            }
+            break;
+        }
+        }
+        break;
+    case AST_FUNC:
+        switch (tree->func.func) {
+        case FUNC_SIN:
+            series_sincos(out, temps, a, n);
+            break;
+        case FUNC_COS:
+            series_sincos(temps, out, a, n);
+            break;
+        case FUNC_TAN:
+            series_tan(out, temps, a, n);
+            break;
+        case FUNC_LN:
+            series_ln(out, a, n);
+            break;
+        case FUNC_LOG:
+            series_ln(out, a, n);
+            for (int k = 0; k < n; k++) out[k] /= log(10);
+            out[0] = log10(a[0]);
+            break;
+        case FUNC_EXP:
+            series_exp(out, a, n);
+            break;
+        case FUNC_INVALID:
+            for (int k = 0; k < n; k++) out[k] = NAN;
+            break;
+        }
+        break;
+    }
+}
+
+
+typedef struct {
+    AstNode* node;
+    bool children_done;
+} TaylorFrame;
+
+#define LOCAL_STACK 64
+
+// postorder with an explicit stack (no recursion: any depth)
+// the series of the operands wait on 'series' (one element = n coefficients) until their node is done
+void taylor_coefficients(AstNode* tree, double x, int order, double* coeffs) {
+    if (order < 0) return;
+
+    int n = order + 1;
+    double* result = (double*) malloc((1 + TAYLOR_TEMPS) * n * sizeof(double));
+    double* temps = result + n;
+
+    TaylorFrame frames_local[LOCAL_STACK];
+    Stack frames, series;
+    STACK_INIT_LOCAL(&frames, TaylorFrame, frames_local);
+    init_stack(&series, n * sizeof(double), NULL, 0);
+
+    *(TaylorFrame*) stack_push(&frames) = (TaylorFrame) { tree, false };
+
+    while (!stack_empty(&frames)) {
+        TaylorFrame* frame = (TaylorFrame*) stack_top(&frames);
+        AstNode* node = frame->node;
+
+        AstNode* children[2];
+        int count = 0;
+        if (node != NULL && node->type == AST_OP) {
+            children[count++] = node->op.left;
+            children[count++] = node->op.right;
+        } else if (node != NULL && node->type == AST_FUNC) {
+            children[count++] = node->func.arg;
+        } else if (node != NULL && node->type == AST_UNARY) {
+            children[count++] = node->unary.operand;
+        }
+
+        if (!frame->children_done && count > 0) {
+            frame->children_done = true;
+            // the last child is pushed first so the first one is done first
+            for (int i = count - 1; i >= 0; i--) {
+                *(TaylorFrame*) stack_push(&frames) = (TaylorFrame) { children[i], false };
+            }
+            continue;
+        }
+        stack_pop(&frames);
+
+        const double* operands = count > 0 ? (const double*) stack_top(&series) - (count - 1) * n : NULL;
+        taylor_step(node, x, n, operands, count > 1 ? operands + n : NULL, result, temps);
+
+        series.size -= count;
+        memcpy(stack_push(&series), result, n * sizeof(double));
+    }
+
+    memcpy(coeffs, stack_pop(&series), n * sizeof(double));
+
+    free_stack(&frames);
+    free_stack(&series);
+    free(result);
+}
+
+void taylor_derivatives(AstNode* tree, double x, int order, double* derivs) {
+    taylor_coefficients(tree, x, order, derivs);
+
+    double factorial = 1;
+    for (int k = 1; k <= order; k++) {
+        factorial *= k;
+        derivs[k] *= factorial;
+    }
+}
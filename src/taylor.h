@@ -0,0 +1,25 @@
+#ifndef __TAYLOR_H__
+#define __TAYLOR_H__
+
+#include "ast.h"
+
+/*
+Taylor-mode automatic differentiation:
+every node is evaluated as a truncated series around x
+    f(x + h) = c[0] + c[1] h + c[2] h^2 + ... + c[order] h^order
+and the series are combined with the usual recurrences (Cauchy product for *,
+exp/ln/sin/cos/tan/^ by their differential equations).
+so f^(k)(x) = k! * c[k] costs O(order^2) per node, no derivative tree is built.
+
+f^g uses exp(g * ln(f)) unless g is constant; integer constant powers
+are exact (x^2 at x = 0 works), other constants need f(x) != 0.
+NULL tree or FUNC_INVALID gives NaN.
+*/
+
+// coeffs[0..order] = Taylor coefficients of the tree at x
+void taylor_coefficients(AstNode* tree, double x, int order, double* coeffs);
+
+// derivs[0..order] = f(x), f'(x), f''(x), ..., f^(order)(x)
+void taylor_derivatives(AstNode* tree, double x, int order, double* derivs);
+
+#endif
@@ -3,220 +3,290 @@
 #include <stdbool.h>
 #include <string.h>
 #include "token.h"
+#include "number.h"
 
 
-// create token
-TokenNode* create_token_node(TokenType type, char* value, TokenNode* prev, TokenNode* next) {
-    TokenNode* token_node = (TokenNode*) malloc(sizeof(TokenNode));
-    token_node->type = type;
-    token_node->next = next;
-    token_node->prev = prev;
+void init_token_array(TokenArray* array) {
+    array->str = NULL;
+    array->tokens = NULL;
+    array->size = 0;
+    array->capacity = 0;
+}
+
+void free_token_array(TokenArray* array) {
+    free(array->tokens);
+    init_token_array(array);
+}
+
+static void push_token_array(TokenArray* array, const Token* token) {
+    if (array->size == array->capacity) {
+        array->capacity = array->capacity == 0 ? 64 : array->capacity * 2;
+        array->tokens = (Token*) realloc(array->tokens, array->capacity * sizeof(Token));
+    }
+
+    array->tokens[array->size++] = *token;
+}
 
-    if (value == NULL)
-        token_node->value = NULL;
-    else
-        token_node->value = strdup(value);
 
-    return token_node;
+TokenStream create_token_stream(const TokenArray* array) {
+    TokenStream stream = { array, 0 };
+    return stream;
 }
 
-// free the heap memory
-void destroy_token_node(TokenNode *token) {
-    if (token == NULL) return;
+const Token* peek_token_stream(TokenStream* s) {
+    if (s->current >= s->array->size) return NULL;
+    return &s->array->tokens[s->current];
+}
 
-    if (token->value != NULL) free(token->value);
-    free(token);
+const Token* prev_token_stream(TokenStream* s) {
+    if (s->current == 0) return NULL;
+    return &s->array->tokens[s->current - 1];
 }
 
-TokenList* init_token_list() {
-    TokenList* list = (TokenList*) malloc(sizeof(TokenList));
-    list->head = NULL;
-    list->tail = NULL;
-    list->size = 0;
-    return list;
+const Token* advance_token_stream(TokenStream* s) {
+    if (s->current >= s->array->size) return NULL;
+    return &s->array->tokens[s->current++];
 }
 
+const Token* match_token_stream(TokenStream* s, TokenType expected) {
+    const Token* curr = peek_token_stream(s);
 
-void add_token_list(TokenList* list, TokenType type, char* value) {
-    if (list->head == NULL) {
-        list->head = create_token_node(type, value, NULL, NULL);
-        list->tail = list->head;
-        list->size = 1;
+    if (curr && curr->type == expected) {
+        s->current++;
+        return curr;
     } else {
-        TokenNode* node = create_token_node(type, value, list->tail, NULL);
-        list->tail->next = node;
-        list->tail = node;
-        list->size++;
+        return NULL;
     }
 }
 
-void destroy_token_list(TokenList* list) {
-    TokenNode* curr = list->head;
-    TokenNode* next;
 
-    while (curr != NULL) {
-        next = curr->next;
-        destroy_token_node(curr);
-        curr = next;
+static Function get_function(const char* str, size_t len) {
+    // so sad cuz no switch-case for string
+    if (len == 3 && memcmp(str, "sin", 3) == 0) {
+        return FUNC_SIN;
+    } else if (len == 3 && memcmp(str, "cos", 3) == 0) {
+        return FUNC_COS;
+    } else if (len == 3 && memcmp(str, "tan", 3) == 0) {
+        return FUNC_TAN;
+    } else if (len == 2 && memcmp(str, "ln", 2) == 0) {
+        return FUNC_LN;
+    } else if (len == 3 && memcmp(str, "log", 3) == 0) {
+        return FUNC_LOG;
+    } else if (len == 3 && memcmp(str, "exp", 3) == 0) {
+        return FUNC_EXP;
+    } else {
+        return FUNC_INVALID;
     }
-
-    free(list);
 }
 
+bool scan_token(const char* str, size_t len, size_t* pos, Token* token) {
+    size_t i = *pos;
 
-TokenStream* create_token_stream(TokenList* list){
-    TokenStream* stream = (TokenStream*) malloc(sizeof(TokenStream));
-    stream->current = list->head;
-    return stream;
-}
+    while (i < len && str[i] == ' ') i++;
 
-TokenNode* peek_token_stream(TokenStream* s) {
-    return s->current;
-}
+    token->offset = i;
 
-TokenNode* advance_token_stream(TokenStream* s) {
-    if (s->current == NULL) return NULL;
+    if (i >= len) {
+        token->type = TOKEN_END;
+        token->length = 0;
+        *pos = i;
+        return true;
+    }
 
-    TokenNode* curr = s->current;
-    s->current = curr->next;
-    return curr;
-}
+    unsigned char c = str[i];
 
-TokenNode* match_token_stream(TokenStream* s, TokenType expected) {
-    if (s->current && s->current->type == expected) {
-        TokenNode* curr = s->current;
-        advance_token_stream(s);
-        return curr;
+    if (isdigit(c) || c == '.') {
+        // read number until the char is not digit or '.'
+        int dot_count = 0; // counting dots to prevent wrong number e.g. '2.0.3'
+        size_t begin = i;
+
+        for (; i < len && (isdigit((unsigned char) str[i]) || str[i] == '.'); i++) {
+            if (str[i] == '.' && ++dot_count > 1) {
+                *pos = i;
+                return false; // wrong numbers e.g. "2.0.3"
+            }
+        }
+
+        token->type = TOKEN_NUM;
+        token->length = i - begin;
+        token->number = parse_number_literal(str + begin, token->length); // in place (number.h)
+    } else if (isalpha(c)) {
+        // read function or variable until the char is not alphabet
+        size_t begin = i;
+        while (i < len && isalpha((unsigned char) str[i])) i++;
+
+        token->length = i - begin;
+        if (token->length == 1 && c == 'x') {
+            // x is the variable
+            token->type = TOKEN_VAR;
+        } else {
+            // otherwise, it's a function
+            token->type = TOKEN_FUNC;
+            token->func = get_function(str + begin, token->length);
+        }
     } else {
-        return NULL;
+        // operators and brackets are one character
+        switch (c) {
+        case '+': token->type = TOKEN_ADD; break;
+        case '-': token->type = TOKEN_SUB; break;
+        case '*': token->type = TOKEN_MUL; break;
+        case '/': token->type = TOKEN_DIV; break;
+        case '^': token->type = TOKEN_POW; break;
+        case '(': token->type = TOKEN_LPAREN; break;
+        case ')': token->type = TOKEN_RPAREN; break;
+        default: // unidentified char found, failed to tokenize
+            *pos = i;
+            return false;
+        }
+
+        token->length = 1;
+        i++;
     }
-}
 
-void destroy_token_stream(TokenStream *s) {
-    if (s != NULL) free(s);
+    *pos = i;
+    return true;
 }
 
 
 // check if only space
-static bool is_blank(char* str) {
-    bool is_blank = true;
-    for (int i = 0; str[i] != '\0'; i++) {
-        if (!isspace((unsigned char)str[i])) {
-            is_blank = 0;
-            break;
-        }
+static bool is_blank(const char* str, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (!isspace((unsigned char)str[i])) return false;
     }
-    return is_blank;
+    return true;
 }
 
 
-TokenList* tokenize_string(char* str) {
-    if (is_blank(str)) return NULL;
+bool tokenize_string(const char* str, size_t len, TokenArray* tokens) {
+    tokens->str = str;
+    tokens->size = 0;
 
-    enum ReadingState { R_NUM, R_ALPHA, R_OTHER };
-    // read number until the char is not digit
-    // read function or variable until the char is not alphabet
-    // operators and brackets are one character so no need to distinguish state
-    enum ReadingState prev_state;
-    enum ReadingState current_state = R_OTHER;
+    if (is_blank(str, len)) return false;
 
-    int i;
-    char* begin; // memorize the beginning of numbers or alphabets
-    int dot_count = 0; // counting dots to prevent wrong number e.g. '2.0.3'
-    int str_len = strlen(str);
+    size_t pos = 0;
+    Token token;
 
-    TokenList* token_list = init_token_list();
-    int tokens_index = 0;
-    char token_value[MAX_TOKEN_LENGTH];
+    do {
+        if (!scan_token(str, len, &pos, &token)) return false;
+        push_token_array(tokens, &token);
+    } while (token.type != TOKEN_END);
 
-    // loop until \0 (including \0)
-    // the reason including null char in loop is to create the token
-    // from the last numbers or alphabets and create END token
-    for (i = 0; i <= str_len; i++) {
-        prev_state = current_state;
-        memset(token_value, 0, sizeof(token_value));
+    return true;
+}
 
-        // set current state
-        if (isdigit(str[i])){
-            current_state = R_NUM;
-        } else if (str[i] == '.') { // '.' is for decimal point
-            current_state = R_NUM;
-            dot_count++;
 
-            if (dot_count > 1)
-                goto tokenize_error; // wrong numbers e.g. "2.0.3"
+void init_chunk_tokenizer(ChunkTokenizer* tokenizer) {
+    tokenizer->chunk = NULL;
+    tokenizer->chunk_len = 0;
+    tokenizer->chunk_pos = 0;
+    tokenizer->chunk_offset = 0;
+    tokenizer->finished = false;
 
-        } else if (isalpha(str[i])) {
-            current_state = R_ALPHA;
-        } else {
-            current_state = R_OTHER;
-        }
+    tokenizer->partial = NULL;
+    tokenizer->partial_len = 0;
+    tokenizer->partial_capacity = 0;
+    tokenizer->partial_offset = 0;
+}
 
-        if (prev_state == R_NUM && current_state != R_NUM) {
-            // numbers ended
-            strncpy(token_value, begin, str+i-begin);
-            token_value[str+i-begin] = '\0'; // strncpy doesn't put \0 automatically
-            add_token_list(token_list, TOKEN_NUM, token_value);
-
-            dot_count = 0;
-        } else if (prev_state == R_ALPHA && current_state != R_ALPHA) {
-            // alphabets ended
-            strncpy(token_value, begin, str+i - begin);
-            token_value[str+i-begin] = '\0';
-
-            if (strcmp(token_value, "x") == 0) {
-                // x is the variable
-                add_token_list(token_list, TOKEN_VAR, token_value);
-            } else {
-                // otherwise, it's a function
-                add_token_list(token_list, TOKEN_FUNC, token_value);
-            }
-        }
+void free_chunk_tokenizer(ChunkTokenizer* tokenizer) {
+    free(tokenizer->partial);
+    init_chunk_tokenizer(tokenizer);
+}
 
-        if (
-            (prev_state != R_NUM && current_state == R_NUM) ||
-            (prev_state != R_ALPHA && current_state == R_ALPHA)
-        ) {
-            // numbers or alphabet begin
-            begin = str + i;
-        }
+void feed_chunk_tokenizer(ChunkTokenizer* tokenizer, const char* chunk, size_t len) {
+    tokenizer->chunk_offset += tokenizer->chunk_len;
+    tokenizer->chunk = chunk;
+    tokenizer->chunk_len = len;
+    tokenizer->chunk_pos = 0;
+}
 
-        if (current_state == R_OTHER) {
-            switch(str[i]) {
-            case '+':
-                add_token_list(token_list, TOKEN_ADD, "+");
-                break;
-            case '-':
-                add_token_list(token_list, TOKEN_SUB, "-");
-                break;
-            case '*':
-                add_token_list(token_list, TOKEN_MUL, "*");
-                break;
-            case '/':
-                add_token_list(token_list, TOKEN_DIV, "/");
-                break;
-            case '^':
-                add_token_list(token_list, TOKEN_POW, "^");
-                break;
-            case '(':
-                add_token_list(token_list, TOKEN_LPAREN, "(");
-                break;
-            case ')':
-                add_token_list(token_list, TOKEN_RPAREN, ")");
-                break;
-            case '\0':
-                add_token_list(token_list, TOKEN_END, NULL);
-                break;
-	    case ' ': break;
-            default: // unidentified char found, failed to tokenize
-                goto tokenize_error;
-            }
-        }
+void finish_chunk_tokenizer(ChunkTokenizer* tokenizer) {
+    feed_chunk_tokenizer(tokenizer, NULL, 0);
+    tokenizer->finished = true;
+}
+
+// characters of a number (digits and '.') or of a name (letters), like scan_token
+static bool same_word(unsigned char first, unsigned char c) {
+    if (isalpha(first)) return isalpha(c);
+    return isdigit(c) || c == '.';
+}
+
+static void append_partial(ChunkTokenizer* tokenizer, const char* str, size_t len) {
+    if (len == 0) return;
+
+    if (tokenizer->partial_len + len > tokenizer->partial_capacity) {
+        size_t capacity = tokenizer->partial_capacity == 0 ? 64 : tokenizer->partial_capacity;
+        while (capacity < tokenizer->partial_len + len) capacity *= 2;
+
+        tokenizer->partial = (char*) realloc(tokenizer->partial, capacity);
+        tokenizer->partial_capacity = capacity;
+    }
+
+    memcpy(tokenizer->partial + tokenizer->partial_len, str, len);
+    tokenizer->partial_len += len;
+}
+
+// scan_token over str[0..len) at input offset 'base', token and error offsets in the input
+static ScanStatus scan_piece(const char* str, size_t len, size_t* pos, size_t base, Token* token) {
+    if (!scan_token(str, len, pos, token)) {
+        token->offset = base + *pos;
+        return SCAN_ERROR;
     }
 
-    return token_list;
+    token->offset += base;
+    return SCAN_TOKEN;
+}
+
+ScanStatus next_chunk_token(ChunkTokenizer* tokenizer, Token* token) {
+    const char* chunk = tokenizer->chunk;
+    size_t len = tokenizer->chunk_len;
+    size_t i = tokenizer->chunk_pos;
+
+    if (tokenizer->partial_len > 0) {
+        // the rest of the cut word, if it goes on in this chunk
+        unsigned char first = tokenizer->partial[0];
+        size_t begin = i;
+        while (i < len && same_word(first, chunk[i])) i++;
+
+        append_partial(tokenizer, chunk + begin, i - begin);
+        tokenizer->chunk_pos = i;
+        if (i == len && !tokenizer->finished) return SCAN_NEED_INPUT; // may go on in the next one
+
+        size_t pos = 0;
+        ScanStatus status = scan_piece(tokenizer->partial, tokenizer->partial_len, &pos,
+                                       tokenizer->partial_offset, token);
+        tokenizer->partial_len = 0;
+        return status;
+    }
+
+    while (i < len && chunk[i] == ' ') i++;
+    tokenizer->chunk_pos = i;
+
+    if (i == len) {
+        if (!tokenizer->finished) return SCAN_NEED_INPUT;
+
+        token->type = TOKEN_END;
+        token->offset = tokenizer->chunk_offset + i;
+        token->length = 0;
+        return SCAN_TOKEN;
+    }
+
+    unsigned char c = chunk[i];
+    if (isalpha(c) || isdigit(c) || c == '.') {
+        size_t end = i;
+        while (end < len && same_word(c, chunk[end])) end++;
+
+        if (end == len && !tokenizer->finished) {
+            // cut by the end of the chunk: keep what there is
+            tokenizer->partial_offset = tokenizer->chunk_offset + i;
+            append_partial(tokenizer, chunk + i, len - i);
+            tokenizer->chunk_pos = len;
+            return SCAN_NEED_INPUT;
+        }
+    }
 
-tokenize_error:
-    destroy_token_list(token_list);
-    return NULL;
+    // the whole token is in the chunk: read in place
+    ScanStatus status = scan_piece(chunk, len, &i, tokenizer->chunk_offset, token);
+    tokenizer->chunk_pos = i;
+    return status;
 }
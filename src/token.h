@@ -1,8 +1,9 @@
 #ifndef __TOKEN_H__
 #define __TOKEN_H__
 
-// each token characters length should be under 20
-#define MAX_TOKEN_LENGTH 20
+#include <stdbool.h>
+#include <stddef.h>
+#include "ast.h"
 
 typedef enum {
     TOKEN_NUM, TOKEN_VAR,
@@ -12,49 +13,99 @@ typedef enum {
     TOKEN_END // end of expression
 } TokenType;
 
-typedef struct TokenNode {
+// a token is just a slice of the input string (no copy)
+typedef struct {
     TokenType type;
-    char* value;
-    struct TokenNode* next;
-    struct TokenNode* prev;
-} TokenNode;
+    size_t offset; // from the beginning of the input
+    size_t length;
+    union {
+        double number; // TOKEN_NUM: already converted
+        Function func; // TOKEN_FUNC: FUNC_INVALID if the name is unknown
+    };
+} Token;
 
+// contiguous array of tokens
+// can be reused for many strings, it only reallocates when it has to grow
 typedef struct {
-    TokenNode* head;
-    TokenNode* tail;
+    const char* str; // the input the tokens point into
+    Token* tokens;
     int size;
-} TokenList;
+    int capacity;
+} TokenArray;
 
-// TokenList iterator
+// TokenArray iterator (no heap memory, just keep it on the stack)
 typedef struct {
-    TokenNode* current;
+    const TokenArray* array;
+    int current; // index of the current token
 } TokenStream;
 
 
-TokenNode* create_token_node(TokenType type, char* value, TokenNode* prev, TokenNode* next);
-void destroy_token_node(TokenNode* token); // free the heap memory
-
-TokenList* init_token_list();
-void add_token_list(TokenList* list, TokenType type, char* value); // add a node next to the tail
-void destroy_token_list(TokenList* list); // destroy and free the list
+void init_token_array(TokenArray* array);
+void free_token_array(TokenArray* array); // free the tokens, not the input string
 
 
-TokenStream* create_token_stream(TokenList* list);
- // return current TokenNode
-TokenNode* peek_token_stream(TokenStream* s);
-// return current TokenNode and move to the next
-TokenNode* advance_token_stream(TokenStream* s);
+TokenStream create_token_stream(const TokenArray* array);
+// return current Token
+const Token* peek_token_stream(TokenStream* s);
+// return the token before the current one (NULL at the beginning)
+const Token* prev_token_stream(TokenStream* s);
+// return current Token and move to the next
+const Token* advance_token_stream(TokenStream* s);
 // check if current type is expected
-// if true: return current node and advance
+// if true: return current token and advance
 // if false: return null and do nothing
-TokenNode* match_token_stream(TokenStream* s, TokenType expected);
-// CAUTION: destroy_token_stream doesn't destroy TokenNode* current !!!
-// because the iterator itself doesn't have responsibility to its linked list in charge
-void destroy_token_stream(TokenStream* s);
-
-// tokenize the string
-// return TokenList
-// return NULL when fail to tokenize
-TokenList* tokenize_string(char* str);
+const Token* match_token_stream(TokenStream* s, TokenType expected);
+
+
+// read one token from str[*pos] (blanks are skipped) and move *pos after it
+// TOKEN_END when *pos reaches len
+// return false when fail to tokenize (*pos is left at the wrong character)
+bool scan_token(const char* str, size_t len, size_t* pos, Token* token);
+
+// tokenize str[0..len) into 'tokens' (previous contents are dropped)
+// the last token is always TOKEN_END
+// return false when fail to tokenize
+bool tokenize_string(const char* str, size_t len, TokenArray* tokens);
+
+
+/*
+resumable tokenizer: the input comes in chunks of any size (read() buffers, pipe data)
+and gives the same tokens as scan_token over the whole input.
+a number or a name cut by the end of a chunk is kept (the only copy of the input)
+until the rest of it arrives, so the whole input is never needed at once.
+token offsets count from the beginning of the whole input.
+*/
+
+typedef enum {
+    SCAN_TOKEN, // *token is the next token (TOKEN_END once finished and everything is read)
+    SCAN_NEED_INPUT, // the chunk is used up: feed the next one or finish
+    SCAN_ERROR // unknown character or wrong number, *token->offset is where
+} ScanStatus;
+
+typedef struct {
+    const char* chunk; // the caller's, not copied
+    size_t chunk_len;
+    size_t chunk_pos;
+    size_t chunk_offset; // of chunk[0] in the input
+    bool finished; // no chunk after this one
+
+    // number or name cut by the end of a chunk
+    char* partial;
+    size_t partial_len;
+    size_t partial_capacity;
+    size_t partial_offset;
+} ChunkTokenizer;
+
+
+void init_chunk_tokenizer(ChunkTokenizer* tokenizer);
+void free_chunk_tokenizer(ChunkTokenizer* tokenizer);
+
+// the next piece of the input, only after SCAN_NEED_INPUT (or at the beginning)
+// it must stay valid until next_chunk_token returns SCAN_NEED_INPUT again
+void feed_chunk_tokenizer(ChunkTokenizer* tokenizer, const char* chunk, size_t len);
+// the end of the input: a pending number or name is complete
+void finish_chunk_tokenizer(ChunkTokenizer* tokenizer);
+
+ScanStatus next_chunk_token(ChunkTokenizer* tokenizer, Token* token);
 
 #endif
@@ -0,0 +1,254 @@
+#ifndef __VECMATH_H__
+#define __VECMATH_H__
+
+/*
+4 lane double math on GCC vector extensions.
+the code is inlined into a function compiled with target("avx2,fma")
+(see bytecode.c), so it becomes AVX2 instructions whatever the build target is.
+
+accuracy (compared with libm): exp, ln, log, sin, cos within a few ulp,
+tan within a few ulp away from the poles.
+special values follow libm: exp overflow -> inf, ln(0) -> -inf, ln(<0) -> NaN, ...
+sin, cos, tan use libm for lanes with |x| > VEC_TRIG_MAX (reduction would lose precision)
+*/
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+typedef double v4df __attribute__((vector_size(32)));
+typedef int64_t v4di __attribute__((vector_size(32))); // also the type of v4df comparisons
+
+// every function is inlined into its caller, so the vector ABI never matters (-Wno-psabi)
+#define VEC_INLINE static inline __attribute__((always_inline))
+
+#define VEC_TRIG_MAX 1e5
+
+
+VEC_INLINE v4df v4_set(double v) {
+    return (v4df) { v, v, v, v };
+}
+
+VEC_INLINE v4di v4_bits(v4df v) {
+    v4di bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+VEC_INLINE v4df v4_from_bits(v4di bits) {
+    v4df v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+// mask lane ? a : b
+VEC_INLINE v4df v4_select(v4di mask, v4df a, v4df b) {
+    return v4_from_bits((mask & v4_bits(a)) | (~mask & v4_bits(b)));
+}
+
+// round to nearest integer, |x| < 2^51
+VEC_INLINE v4df v4_round(v4df x) {
+    const v4df magic = v4_set(0x1.8p52);
+    return (x + magic) - magic;
+}
+
+// integral double (|x| < 2^51) <-> int64
+VEC_INLINE v4di v4_to_int(v4df x) {
+    const v4df magic = v4_set(0x1.8p52);
+    return v4_bits(x + magic) - v4_bits(magic);
+}
+
+VEC_INLINE v4df v4_from_int(v4di i) {
+    const v4df magic = v4_set(0x1.8p52);
+    return v4_from_bits(i + v4_bits(magic)) - magic;
+}
+
+// 2^n for integral n in [-1022, 1023]
+VEC_INLINE v4df v4_pow2(v4df n) {
+    return v4_from_bits((v4_to_int(n) + 1023) << 52);
+}
+
+VEC_INLINE int v4_any(v4di mask) {
+    return (mask[0] | mask[1] | mask[2] | mask[3]) != 0;
+}
+
+
+VEC_INLINE v4df v4_exp(v4df x) {
+    const v4df ln2_hi = v4_set(0x1.62e42feep-1);
+    const v4df ln2_lo = v4_set(0x1.a39ef35793c76p-33);
+
+    // keep n in range, the result is already inf or 0 there (NaN is kept)
+    v4df xc = v4_select(x > v4_set(1100), v4_set(1100), x);
+    xc = v4_select(xc < v4_set(-1100), v4_set(-1100), xc);
+
+    // x = n*ln2 + r, |r| <= ln2/2
+    v4df n = v4_round(xc * v4_set(0x1.71547652b82fep+0));
+    v4df r = (xc - n * ln2_hi) - n * ln2_lo;
+
+    // taylor series up to r^13
+    v4df p = v4_set(1.0 / 6227020800.0);
+    p = p * r + v4_set(1.0 / 479001600.0);
+    p = p * r + v4_set(1.0 / 39916800.0);
+    p = p * r + v4_set(1.0 / 3628800.0);
+    p = p * r + v4_set(1.0 / 362880.0);
+    p = p * r + v4_set(1.0 / 40320.0);
+    p = p * r + v4_set(1.0 / 5040.0);
+    p = p * r + v4_set(1.0 / 720.0);
+    p = p * r + v4_set(1.0 / 120.0);
+    p = p * r + v4_set(1.0 / 24.0);
+    p = p * r + v4_set(1.0 / 6.0);
+    p = p * r + v4_set(0.5);
+    p = p * r + v4_set(1.0);
+    p = p * r + v4_set(1.0);
+
+    // 2^n in two steps so that both factors are normal numbers
+    v4df n1 = v4_round(n * v4_set(0.5));
+    v4df n2 = n - n1;
+    return p * v4_pow2(n1) * v4_pow2(n2);
+}
+
+VEC_INLINE v4df v4_ln(v4df x) {
+    const v4df ln2_hi = v4_set(0x1.62e42feep-1);
+    const v4df ln2_lo = v4_set(0x1.a39ef35793c76p-33);
+
+    // subnormal numbers are scaled to normal ones first
+    v4di subnormal = (x < v4_set(0x1p-1022)) & (x > v4_set(0));
+    v4df xs = v4_select(subnormal, x * v4_set(0x1p52), x);
+    v4df e_adjust = v4_select(subnormal, v4_set(52), v4_set(0));
+
+    // x = 2^e * m, sqrt(1/2) <= m < sqrt(2)
+    v4di bits = v4_bits(xs);
+    v4df e = v4_from_int(((bits >> 52) & 0x7ff) - 1023) - e_adjust;
+    v4df m = v4_from_bits((bits & 0x000fffffffffffffLL) | 0x3ff0000000000000LL);
+
+    v4di big = m > v4_set(0x1.6a09e667f3bcdp+0);
+    m = v4_select(big, m * v4_set(0.5), m);
+    e = v4_select(big, e + v4_set(1), e);
+
+    // ln(m) = 2 atanh(s) = 2 (s + s^3/3 + s^5/5 + ...), s = (m-1)/(m+1), |s| < 0.172
+    v4df f = m - v4_set(1);
+    v4df s = f / (v4_set(2) + f);
+    v4df z = s * s;
+
+    v4df p = v4_set(1.0 / 23);
+    p = p * z + v4_set(1.0 / 21);
+    p = p * z + v4_set(1.0 / 19);
+    p = p * z + v4_set(1.0 / 17);
+    p = p * z + v4_set(1.0 / 15);
+    p = p * z + v4_set(1.0 / 13);
+    p = p * z + v4_set(1.0 / 11);
+    p = p * z + v4_set(1.0 / 9);
+    p = p * z + v4_set(1.0 / 7);
+    p = p * z + v4_set(1.0 / 5);
+    p = p * z + v4_set(1.0 / 3);
+
+    // f = 2s + s*f, so ln(m) = 2s + 2s*z*p = f - s*(f - 2*z*p) (small rounding error)
+    v4df ln_m = f - s * (f - v4_set(2) * z * p);
+    v4df result = e * ln2_hi + (ln_m + e * ln2_lo);
+
+    // special values
+    result = v4_select(x == v4_set(0), v4_set(-INFINITY), result);
+    result = v4_select(x < v4_set(0), v4_set(NAN), result);
+    result = v4_select(x == v4_set(INFINITY), x, result);
+    result = v4_select(x != x, x, result); // NaN
+    return result;
+}
+
+VEC_INLINE v4df v4_log10(v4df x) {
+    return v4_ln(x) * v4_set(0x1.bcb7b1526e50ep-2); // 1/ln(10)
+}
+
+
+// reduce x to r in [-pi/4, pi/4] and the quadrant q (x = q*pi/2 + r)
+// then sin(r) and cos(r) by taylor series
+VEC_INLINE void v4_sincos_kernel(v4df x, v4df* sin_r, v4df* cos_r, v4di* quadrant) {
+    // pi/2 split in 33 bit parts so that q * part is exact
+    const v4df pio2_1 = v4_set(0x1.921fb544p+0);
+    const v4df pio2_2 = v4_set(0x1.0b4611a6p-34);
+    const v4df pio2_3 = v4_set(0x1.3198a2ep-69);
+    const v4df pio2_4 = v4_set(0x1.b839a252049c1p-104);
+
+    v4df q = v4_round(x * v4_set(0x1.45f306dc9c883p-1)); // x * 2/pi
+    v4df r = ((x - q * pio2_1) - q * pio2_2) - q * pio2_3;
+    r = r - q * pio2_4;
+    v4df z = r * r;
+
+    v4df s = v4_set(1.0 / 355687428096000.0);   // 1/17!
+    s = s * z - v4_set(1.0 / 1307674368000.0);  // 1/15!
+    s = s * z + v4_set(1.0 / 6227020800.0);
+    s = s * z - v4_set(1.0 / 39916800.0);
+    s = s * z + v4_set(1.0 / 362880.0);
+    s = s * z - v4_set(1.0 / 5040.0);
+    s = s * z + v4_set(1.0 / 120.0);
+    s = s * z - v4_set(1.0 / 6.0);
+    *sin_r = r + r * z * s;
+
+    v4df c = v4_set(1.0 / 20922789888000.0);    // 1/16!
+    c = c * z - v4_set(1.0 / 87178291200.0);    // 1/14!
+    c = c * z + v4_set(1.0 / 479001600.0);
+    c = c * z - v4_set(1.0 / 3628800.0);
+    c = c * z + v4_set(1.0 / 40320.0);
+    c = c * z - v4_set(1.0 / 720.0);
+    c = c * z + v4_set(1.0 / 24.0);
+    c = c * z - v4_set(0.5);
+    *cos_r = v4_set(1) + z * c;
+
+    *quadrant = v4_to_int(q) & 3;
+}
+
+VEC_INLINE v4df v4_abs(v4df x) {
+    return v4_from_bits(v4_bits(x) & 0x7fffffffffffffffLL);
+}
+
+// lanes outside of the reduction range go to libm
+#define V4_TRIG_FALLBACK(x, result, libm_func) \
+    do { \
+        v4di far = ~(v4_abs(x) <= v4_set(VEC_TRIG_MAX)); \
+        if (v4_any(far)) { \
+            for (int lane = 0; lane < 4; lane++) { \
+                if (far[lane]) (result)[lane] = libm_func((x)[lane]); \
+            } \
+        } \
+    } while (0)
+
+VEC_INLINE v4df v4_sin(v4df x) {
+    v4df s, c;
+    v4di q;
+    v4_sincos_kernel(x, &s, &c, &q);
+
+    // q: 0 -> s, 1 -> c, 2 -> -s, 3 -> -c
+    v4df result = v4_select((q & 1) != 0, c, s);
+    result = v4_select((q & 2) != 0, -result, result);
+    result = v4_select(x == v4_set(0), x, result); // keep -0
+
+    V4_TRIG_FALLBACK(x, result, sin);
+    return result;
+}
+
+VEC_INLINE v4df v4_cos(v4df x) {
+    v4df s, c;
+    v4di q;
+    v4_sincos_kernel(x, &s, &c, &q);
+
+    // q: 0 -> c, 1 -> -s, 2 -> -c, 3 -> s
+    v4df result = v4_select((q & 1) != 0, s, c);
+    result = v4_select(((q + 1) & 2) != 0, -result, result);
+
+    V4_TRIG_FALLBACK(x, result, cos);
+    return result;
+}
+
+VEC_INLINE v4df v4_tan(v4df x) {
+    v4df s, c;
+    v4di q;
+    v4_sincos_kernel(x, &s, &c, &q);
+
+    // tan(r + q*pi/2) = s/c (q even), -c/s (q odd)
+    v4df result = v4_select((q & 1) != 0, -c / s, s / c);
+    result = v4_select(x == v4_set(0), x, result); // keep -0
+
+    V4_TRIG_FALLBACK(x, result, tan);
+    return result;
+}
+
+#endif